@@ -21,12 +21,14 @@
 #ifndef FST_LIB_CATEGORIAL_WEIGHT_H__
 #define FST_LIB_CATEGORIAL_WEIGHT_H__
 
-#include <list>
+#include <algorithm>
 #include <string>
 
 #include <fst/product-weight.h>
 #include <fst/weight.h>
 
+#include "label-kernels.h"
+
 namespace fst {
 
     const int kCategorialInfinity = -1;      // Label for the infinite string
@@ -51,6 +53,18 @@ namespace fst {
       ((S) == CATEGORIAL_LEFT_RESTRICT ? CATEGORIAL_RIGHT_RESTRICT :     \
        CATEGORIAL_LEFT_RESTRICT)))
 
+    // Label of the reversed string: divisions and brackets change side, so
+    // that the reverse of a right division is the left division of the
+    // reverses (and conversely).
+    template <typename L>
+        inline L ReverseCategorialLabel(L l) {
+            if (l == kCategorialLeftDiv) return kCategorialRightDiv;
+            if (l == kCategorialRightDiv) return kCategorialLeftDiv;
+            if (l == kCategorialLeftBracket) return kCategorialRightBracket;
+            if (l == kCategorialRightBracket) return kCategorialLeftBracket;
+            return l;
+        }
+
     template <typename L, CategorialType S = CATEGORIAL_LEFT>
         class CategorialWeight;
 
@@ -70,6 +84,7 @@ namespace fst {
             public:
                 typedef L Label;
                 typedef CategorialWeight<L, REVERSE_CATEGORIAL_TYPE(S)> ReverseWeight;
+                typedef CategorialWeightIterator<L, S> Iterator;
 
                 friend class CategorialWeightIterator<L, S>;
                 friend class CategorialWeightReverseIterator<L, S>;
@@ -78,6 +93,16 @@ namespace fst {
 
                 CategorialWeight() { Init(); }
 
+                CategorialWeight(const CategorialWeight<L, S> &w) {
+                    Init();
+                    Append(w.Data(), w.size_);
+                }
+
+                CategorialWeight(CategorialWeight<L, S> &&w) {
+                    Init();
+                    Swap(w);
+                }
+
                 template <typename Iter>
                     CategorialWeight(const Iter &begin, const Iter &end) {
                         Init();
@@ -87,6 +112,21 @@ namespace fst {
 
                 explicit CategorialWeight(L l) { Init(); PushBack(l); }
 
+                ~CategorialWeight() { delete[] heap_; }
+
+                CategorialWeight<L, S> &operator=(const CategorialWeight<L, S> &w) {
+                    if (this != &w) {
+                        size_ = 0;
+                        Append(w.Data(), w.size_);
+                    }
+                    return *this;
+                }
+
+                CategorialWeight<L, S> &operator=(CategorialWeight<L, S> &&w) {
+                    Swap(w);
+                    return *this;
+                }
+
                 static const CategorialWeight<L, S> &Zero() {
                     static const CategorialWeight<L, S> zero(kCategorialInfinity);
                     return zero;
@@ -125,37 +165,102 @@ namespace fst {
                             kLeftSemiring : kRightSemiring) | kIdempotent | kPath;
                 }
 
-                // NB: This needs to be uncommented only if default fails for this impl.
-                // CategorialWeight<L, S> &operator=(const CategorialWeight<L, S> &w);
-
                 // These operations combined with the CategorialWeightIterator and
                 // CategorialWeightReverseIterator provide the access and mutation of
                 // the string internal elements.
 
                 // Common initializer among constructors.
-                void Init() { first_ = 0; }
-
-                // Clear existing CategorialWeight.
-                void Clear() { first_ = 0; rest_.clear(); }
-
-                size_t Size() const { return first_ ? rest_.size() + 1 : 0; }
+                void Init() { size_ = 0; capacity_ = kInlineSize; heap_ = 0; }
+
+                // Clear existing CategorialWeight (keeps the allocated storage).
+                void Clear() { size_ = 0; }
+
+                size_t Size() const { return size_; }
+
+                // Contiguous labels, from first to last.
+                const L *Labels() const { return Data(); }
+
+                // Makes room for n labels so that the next pushes do not allocate.
+                void Reserve(size_t n) {
+                    if (n <= capacity_)
+                        return;
+                    size_t capacity = std::max(n, 2 * capacity_);
+                    L *heap = new L[capacity];
+                    std::copy(Data(), Data() + size_, heap);
+                    delete[] heap_;
+                    heap_ = heap;
+                    capacity_ = capacity;
+                }
 
+                // As with the former first_/rest_ layout, an epsilon label
+                // never starts a string: CategorialWeight(0) == One().
                 void PushFront(L l) {
-                    if (first_)
-                        rest_.push_front(first_);
-                    first_ = l;
+                    if (!size_ && !l)
+                        return;
+                    Reserve(size_ + 1);
+                    L *data = Data();
+                    std::copy_backward(data, data + size_, data + size_ + 1);
+                    data[0] = l;
+                    ++size_;
                 }
 
                 void PushBack(L l) {
-                    if (!first_)
-                        first_ = l;
-                    else
-                        rest_.push_back(l);
+                    if (!size_ && !l)
+                        return;
+                    Reserve(size_ + 1);
+                    Data()[size_++] = l;
+                }
+
+            protected:
+                // Sets the size to n labels and returns the storage to fill.
+                L *Resize(size_t n) {
+                    Reserve(n);
+                    size_ = n;
+                    return Data();
                 }
 
             private:
-                L first_;         // first label in string (0 if empty)
-                list<L> rest_;    // remaining labels in string
+                // Labels are stored inline up to this length, which covers
+                // most tag strings; longer strings spill to a single heap block.
+                static const size_t kInlineSize = 8;
+
+                const L *Data() const { return heap_ ? heap_ : inline_; }
+                L *Data() { return heap_ ? heap_ : inline_; }
+
+                void Append(const L *labels, size_t n) {
+                    if (!n)
+                        return;
+                    if (!size_ && !labels[0]) {  // keep PushBack() semantics
+                        Append(labels + 1, n - 1);
+                        return;
+                    }
+                    Reserve(size_ + n);
+                    std::copy(labels, labels + n, Data() + size_);
+                    size_ += n;
+                }
+
+                // Exchanges contents; inline labels are copied, heap blocks
+                // change owner.
+                void Swap(CategorialWeight<L, S> &w) {
+                    if (!heap_ && !w.heap_) {
+                        L tmp[kInlineSize];
+                        std::copy(inline_, inline_ + size_, tmp);
+                        std::copy(w.inline_, w.inline_ + w.size_, inline_);
+                        std::copy(tmp, tmp + size_, w.inline_);
+                    } else if (!heap_) {
+                        std::copy(inline_, inline_ + size_, w.inline_);
+                    } else if (!w.heap_) {
+                        std::copy(w.inline_, w.inline_ + w.size_, inline_);
+                    }
+                    std::swap(size_, w.size_);
+                    std::swap(capacity_, w.capacity_);
+                    std::swap(heap_, w.heap_);
+                }
+
+                size_t size_;          // number of labels in string
+                size_t capacity_;      // number of labels that fit in storage
+                L *heap_;              // heap storage (0 if labels are inline)
+                L inline_[kInlineSize];  // inline storage for short strings
         };
 
 
@@ -164,31 +269,20 @@ namespace fst {
         class CategorialWeightIterator {
             public:
                 explicit CategorialWeightIterator(const CategorialWeight<L, S>& w)
-                    : first_(w.first_), rest_(w.rest_), init_(true),
-                    iter_(rest_.begin()) {}
+                    : data_(w.Data()), size_(w.Size()), pos_(0) {}
 
-                bool Done() const {
-                    if (init_) return first_ == 0;
-                    else return iter_ == rest_.end();
-                }
+                bool Done() const { return pos_ >= size_; }
 
-                const L& Value() const { return init_ ? first_ : *iter_; }
+                const L& Value() const { return data_[pos_]; }
 
-                void Next() {
-                    if (init_) init_ = false;
-                    else  ++iter_;
-                }
+                void Next() { ++pos_; }
 
-                void Reset() {
-                    init_ = true;
-                    iter_ = rest_.begin();
-                }
+                void Reset() { pos_ = 0; }
 
             private:
-                const L &first_;
-                const list<L> &rest_;
-                bool init_;   // in the initialized state?
-                typename list<L>::const_iterator iter_;
+                const L *data_;
+                size_t size_;
+                size_t pos_;   // position of the current label
 
                 DISALLOW_COPY_AND_ASSIGN(CategorialWeightIterator);
         };
@@ -199,28 +293,20 @@ namespace fst {
         class CategorialWeightReverseIterator {
             public:
                 explicit CategorialWeightReverseIterator(const CategorialWeight<L, S>& w)
-                    : first_(w.first_), rest_(w.rest_), fin_(first_ == 0),
-                    iter_(rest_.rbegin()) {}
+                    : data_(w.Data()), size_(w.Size()), pos_(0) {}
 
-                bool Done() const { return fin_; }
+                bool Done() const { return pos_ >= size_; }
 
-                const L& Value() const { return iter_ == rest_.rend() ? first_ : *iter_; }
+                const L& Value() const { return data_[size_ - pos_ - 1]; }
 
-                void Next() {
-                    if (iter_ == rest_.rend()) fin_ = true;
-                    else  ++iter_;
-                }
+                void Next() { ++pos_; }
 
-                void Reset() {
-                    fin_ = false;
-                    iter_ = rest_.rbegin();
-                }
+                void Reset() { pos_ = 0; }
 
             private:
-                const L &first_;
-                const list<L> &rest_;
-                bool fin_;   // in the final state?
-                typename list<L>::const_reverse_iterator iter_;
+                const L *data_;
+                size_t size_;
+                size_t pos_;   // number of labels already traversed
 
                 DISALLOW_COPY_AND_ASSIGN(CategorialWeightReverseIterator);
         };
@@ -232,13 +318,20 @@ namespace fst {
     template <typename L, CategorialType S>
         inline istream &CategorialWeight<L, S>::Read(istream &strm) {
             Clear();
-            int32 size;
+            int32 size = 0;
             ReadType(strm, &size);
-            for (int i = 0; i < size; ++i) {
-                L label;
-                ReadType(strm, &label);
-                PushBack(label);
+            if (size < 0)
+                strm.setstate(std::ios::failbit);
+            // the storage grows with the labels actually read, so that a
+            // corrupt or truncated stream does not allocate its announced size
+            size_t pos = 0;
+            while (strm && pos < static_cast<size_t>(size)) {
+                size_t n = std::min<size_t>(size - pos, std::max<size_t>(pos, 1 << 14));
+                strm.read(reinterpret_cast<char *>(Resize(pos + n) + pos), n * sizeof(L));
+                pos += n;
             }
+            if (!strm)
+                Clear();
             return strm;
         }
 
@@ -246,11 +339,7 @@ namespace fst {
         inline ostream &CategorialWeight<L, S>::Write(ostream &strm) const {
             int32 size =  Size();
             WriteType(strm, size);
-            for (CategorialWeightIterator<L, S> iter(*this); !iter.Done(); iter.Next()) {
-                L label = iter.Value();
-                WriteType(strm, label);
-            }
-            return strm;
+            return strm.write(reinterpret_cast<const char *>(Data()), size * sizeof(L));
         }
 
     template <typename L, CategorialType S>
@@ -265,46 +354,22 @@ namespace fst {
         inline typename CategorialWeight<L, S>::ReverseWeight
         CategorialWeight<L, S>::Reverse() const {
             ReverseWeight rw;
-            for (CategorialWeightIterator<L, S> iter(*this); !iter.Done(); iter.Next())
-                rw.PushFront(iter.Value());
+            rw.Reserve(Size());
+            for (CategorialWeightReverseIterator<L, S> iter(*this); !iter.Done(); iter.Next())
+                rw.PushBack(ReverseCategorialLabel(iter.Value()));
             return rw;
         }
 
     template <typename L, CategorialType S>
         inline size_t CategorialWeight<L, S>::Hash() const {
-            size_t h = 0;
-            for (CategorialWeightIterator<L, S> iter(*this); !iter.Done(); iter.Next())
-                h ^= h<<1 ^ iter.Value();
-            return h;
+            return HashLabelString(Data(), size_);
         }
 
-    // NB: This needs to be uncommented only if default fails for this the impl.
-    //
-    // template <typename L, CategorialType S>
-    // inline CategorialWeight<L, S>
-    // &CategorialWeight<L, S>::operator=(const CategorialWeight<L, S> &w) {
-    //   if (this != &w) {
-    //     Clear();
-    //     for (CategorialWeightIterator<L, S> iter(w); !iter.Done(); iter.Next())
-    //       PushBack(iter.Value());
-    //   }
-    //   return *this;
-    // }
-
     template <typename L, CategorialType S>
         inline bool operator==(const CategorialWeight<L, S> &w1,
                 const CategorialWeight<L, S> &w2) {
-            if (w1.Size() != w2.Size())
-                return false;
-
-            CategorialWeightIterator<L, S> iter1(w1);
-            CategorialWeightIterator<L, S> iter2(w2);
-
-            for (; !iter1.Done() ; iter1.Next(), iter2.Next())
-                if (iter1.Value() != iter2.Value())
-                    return false;
-
-            return true;
+            return w1.size_ == w2.size_ &&
+                FindLabelMismatch(w1.Data(), w2.Data(), w1.size_) == w1.size_;
         }
 
     template <typename L, CategorialType S>
@@ -335,6 +400,7 @@ namespace fst {
                     if (iter.Value() == kCategorialLeftBracket) { strm << '<'; needSeparator = false; }
                     else if (iter.Value() == kCategorialRightBracket) { strm << '>'; needSeparator = false; }
                     else if (iter.Value() == kCategorialLeftDiv) { strm << '\\'; needSeparator = false; }
+                    else if (iter.Value() == kCategorialRightDiv) { strm << '/'; needSeparator = false; }
                     else {
                         if (needSeparator)
                             strm << kCategorialSeparator;
@@ -397,18 +463,14 @@ namespace fst {
             if (w2 == CategorialWeight<L, CATEGORIAL_LEFT>::Zero())
                 return w1;
 
-            CategorialWeightIterator<L, CATEGORIAL_LEFT> iter1(w1);
-            CategorialWeightIterator<L, CATEGORIAL_LEFT> iter2(w2);
-            for (; !iter1.Done() && !iter2.Done(); iter1.Next(), iter2.Next()) {
-                if(iter1.Value() < iter2.Value()) return w1;
-                else if(iter1.Value() > iter2.Value()) return w2;
-            }
-            if(!iter2.Done()) return w1;
+            if(CompareLabelStrings(w1.Labels(), w1.Size(), w2.Labels(), w2.Size()) < 0) return w1;
             return w2;
         }
 
 
-    // Longest common suffix for right categorial semiring.
+    // Longest common suffix for right categorial semiring. Strings are
+    // compared from their last label, the mirror of the left Plus, so that
+    // Plus distributes over Times on the right.
     template <typename L>  inline CategorialWeight<L, CATEGORIAL_RIGHT>
         Plus(const CategorialWeight<L, CATEGORIAL_RIGHT> &w1,
                 const CategorialWeight<L, CATEGORIAL_RIGHT> &w2) {
@@ -417,17 +479,22 @@ namespace fst {
             if (w2 == CategorialWeight<L, CATEGORIAL_RIGHT>::Zero())
                 return w1;
 
-            CategorialWeightIterator<L, CATEGORIAL_RIGHT> iter1(w1);
-            CategorialWeightIterator<L, CATEGORIAL_RIGHT> iter2(w2);
-            for (; !iter1.Done() && !iter2.Done(); iter1.Next(), iter2.Next()) {
-                if(iter1.Value() < iter2.Value()) return w1;
-                else if(iter1.Value() > iter2.Value()) return w2;
-            }
-            if(!iter2.Done()) return w1;
+            if(CompareLabelStringsBackwards(w1.Labels(), w1.Size(), w2.Labels(), w2.Size()) < 0) return w1;
             return w2;
         }
 
 
+    // Order of the left and right Plus above: negative, zero or positive as
+    // w1 is before, equal to or after w2.
+    template <typename L, CategorialType S>
+        inline int CompareCategorial(const CategorialWeight<L, S> &w1,
+                const CategorialWeight<L, S> &w2) {
+            if (S == CATEGORIAL_RIGHT || S == CATEGORIAL_RIGHT_RESTRICT)
+                return CompareLabelStringsBackwards(w1.Labels(), w1.Size(), w2.Labels(), w2.Size());
+            return CompareLabelStrings(w1.Labels(), w1.Size(), w2.Labels(), w2.Size());
+        }
+
+
     template <typename L, CategorialType S>
         inline CategorialWeight<L, S> Times(const CategorialWeight<L, S> &w1,
                 const CategorialWeight<L, S> &w2) {
@@ -435,6 +502,7 @@ namespace fst {
                 return CategorialWeight<L, S>::Zero();
 
             CategorialWeight<L, S> prod(w1);
+            prod.Reserve(w1.Size() + w2.Size());
             if(w1.Size() > 0) {
                 //prod.PushFront(kCategorialLeftBracket);
                 //prod.PushBack(kCategorialRightBracket);
@@ -470,6 +538,7 @@ namespace fst {
 
             if(w1 == w2) return CategorialWeight<L, S>::One();
             CategorialWeight<L, S> div;
+            div.Reserve(w1.Size() + w2.Size() + 3);
             CategorialWeightIterator<L, S> iter1(w1);
             CategorialWeightIterator<L, S> iter2(w2);
             bool needsBrackets = false;
@@ -499,53 +568,53 @@ namespace fst {
         }
 
 
-    // Right division in the right categorial semiring.
-    template <typename L> inline CategorialWeight<L, CATEGORIAL_RIGHT>
-        Divide(const CategorialWeight<L, CATEGORIAL_RIGHT> &w1,
-                const CategorialWeight<L, CATEGORIAL_RIGHT> &w2,
+    // Right division, the mirror of the left one: "w1/w2", where the
+    // divisor is bracketed if it holds a right division itself. Reverse()
+    // maps it to the left division of the reverses.
+    template <typename L, CategorialType S> inline CategorialWeight<L, S>
+        RightDivide(const CategorialWeight<L, S> &w1,
+                const CategorialWeight<L, S> &w2,
                 DivideType typ) {
 
-            //if (typ != DIVIDE_RIGHT)
+            if (typ != DIVIDE_RIGHT)
                 LOG(FATAL) << "CategorialWeight::Divide: only right division is defined "
-                    << "for the right categorial semiring";
+                    << "for the " << CategorialWeight<L, S>::Type() << " semiring";
 
-            if (w2 == CategorialWeight<L, CATEGORIAL_RIGHT>::Zero())
-                return CategorialWeight<L, CATEGORIAL_RIGHT>(kCategorialBad);
-            else if (w1 == CategorialWeight<L, CATEGORIAL_RIGHT>::Zero())
-                return CategorialWeight<L, CATEGORIAL_RIGHT>::Zero();
-
-            CategorialWeight<L, CATEGORIAL_RIGHT> div;
-            CategorialWeightReverseIterator<L, CATEGORIAL_RIGHT> iter(w1);
-            for (int i = 0; !iter.Done(); iter.Next(), ++i) {
-                if (i >= w2.Size())
-                    div.PushFront(iter.Value());
-            }
+            if (w2 == CategorialWeight<L, S>::Zero())
+                return CategorialWeight<L, S>(kCategorialBad);
+            else if (w1 == CategorialWeight<L, S>::Zero())
+                return CategorialWeight<L, S>::Zero();
+
+            if(w1 == w2) return CategorialWeight<L, S>::One();
+            const L *labels2 = w2.Labels();
+            bool needsBrackets = std::find(labels2, labels2 + w2.Size(),
+                    static_cast<L>(kCategorialRightDiv)) != labels2 + w2.Size();
+            CategorialWeight<L, S> div(w1);
+            div.Reserve(w1.Size() + w2.Size() + 3);
+            div.PushBack(kCategorialRightDiv);
+            if(needsBrackets) div.PushBack(kCategorialLeftBracket);
+            for (CategorialWeightIterator<L, S> iter(w2); !iter.Done(); iter.Next())
+                div.PushBack(iter.Value());
+            if(needsBrackets) div.PushBack(kCategorialRightBracket);
             return div;
         }
 
 
+    // Right division in the right categorial semiring.
+    template <typename L> inline CategorialWeight<L, CATEGORIAL_RIGHT>
+        Divide(const CategorialWeight<L, CATEGORIAL_RIGHT> &w1,
+                const CategorialWeight<L, CATEGORIAL_RIGHT> &w2,
+                DivideType typ) {
+            return RightDivide(w1, w2, typ);
+        }
+
+
     // Right division in the right restricted categorial semiring.
     template <typename L> inline CategorialWeight<L, CATEGORIAL_RIGHT_RESTRICT>
         Divide(const CategorialWeight<L, CATEGORIAL_RIGHT_RESTRICT> &w1,
                 const CategorialWeight<L, CATEGORIAL_RIGHT_RESTRICT> &w2,
                 DivideType typ) {
-
-            //if (typ != DIVIDE_RIGHT)
-                LOG(FATAL) << "CategorialWeight::Divide: only right division is defined "
-                    << "for the right restricted categorial semiring";
-
-            if (w2 == CategorialWeight<L, CATEGORIAL_RIGHT_RESTRICT>::Zero())
-                return CategorialWeight<L, CATEGORIAL_RIGHT_RESTRICT>(kCategorialBad);
-            else if (w1 == CategorialWeight<L, CATEGORIAL_RIGHT_RESTRICT>::Zero())
-                return CategorialWeight<L, CATEGORIAL_RIGHT_RESTRICT>::Zero();
-
-            CategorialWeight<L, CATEGORIAL_RIGHT_RESTRICT> div;
-            CategorialWeightReverseIterator<L, CATEGORIAL_RIGHT_RESTRICT> iter(w1);
-            for (int i = 0; !iter.Done(); iter.Next(), ++i) {
-                if (i >= w2.Size())
-                    div.PushFront(iter.Value());
-            }
-            return div;
+            return RightDivide(w1, w2, typ);
         }
 
 }  // namespace fst
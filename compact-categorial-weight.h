@@ -0,0 +1,217 @@
+// compact-categorial-weight.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Categorial weight with a compact binary encoding, for caching TCLex
+// lattices on disk: the number of labels and the number of bytes as
+// varints, then the labels as zigzag varints (tags and special labels
+// mostly take one byte instead of four). The bytes of a weight are read and
+// written in a single block. The weight type differs from the plain one, so
+// files of both kinds are not mixed up.
+
+#ifndef FST_LIB_COMPACT_CATEGORIAL_WEIGHT_H__
+#define FST_LIB_COMPACT_CATEGORIAL_WEIGHT_H__
+
+#include <algorithm>
+#include <string>
+
+#include "categorial-weight.h"
+
+namespace fst {
+
+    // Varints hold 7 bits per byte, low bits first. Returns the number of
+    // bytes written (at most 10).
+    inline size_t WriteCategorialVarint(uint64 value, char *buffer) {
+        size_t n = 0;
+        for (; value >= 0x80; value >>= 7)
+            buffer[n++] = static_cast<char>(value | 0x80);
+        buffer[n++] = static_cast<char>(value);
+        return n;
+    }
+
+    // Returns the number of bytes used, 0 if the buffer ends before the value.
+    inline size_t ReadCategorialVarint(const char *buffer, size_t size, uint64 *value) {
+        *value = 0;
+        for (size_t n = 0; n < size && n < 10; ++n) {
+            uint64 byte = static_cast<unsigned char>(buffer[n]);
+            *value |= (byte & 0x7f) << (7 * n);
+            if (!(byte & 0x80))
+                return n + 1;
+        }
+        return 0;
+    }
+
+    inline istream &ReadCategorialVarint(istream &strm, uint64 *value) {
+        *value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            int byte = strm.get();
+            if (byte == EOF)
+                break;
+            *value |= static_cast<uint64>(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return strm;
+        }
+        strm.setstate(std::ios::failbit);
+        return strm;
+    }
+
+    // Zigzag coding, so that small labels of either sign give short varints.
+    inline uint64 ZigzagEncode(int64 value) {
+        return (static_cast<uint64>(value) << 1) ^ static_cast<uint64>(value >> 63);
+    }
+
+    inline int64 ZigzagDecode(uint64 value) {
+        return static_cast<int64>(value >> 1) ^ -static_cast<int64>(value & 1);
+    }
+
+
+    // Same semiring as CategorialWeight<L, S>, only the binary I/O and the
+    // type differ.
+    template <typename L, CategorialType S = CATEGORIAL_LEFT>
+        class CompactCategorialWeight : public CategorialWeight<L, S> {
+            public:
+                typedef CategorialWeight<L, S> Base;
+                typedef CompactCategorialWeight<L, REVERSE_CATEGORIAL_TYPE(S)> ReverseWeight;
+
+                CompactCategorialWeight() {}
+
+                CompactCategorialWeight(const Base &w) : Base(w) {}
+
+                CompactCategorialWeight(Base &&w) : Base(std::move(w)) {}
+
+                template <typename Iter>
+                    CompactCategorialWeight(const Iter &begin, const Iter &end) : Base(begin, end) {}
+
+                explicit CompactCategorialWeight(L l) : Base(l) {}
+
+                static const CompactCategorialWeight<L, S> &Zero() {
+                    static const CompactCategorialWeight<L, S> zero(Base::Zero());
+                    return zero;
+                }
+
+                static const CompactCategorialWeight<L, S> &One() {
+                    static const CompactCategorialWeight<L, S> one(Base::One());
+                    return one;
+                }
+
+                static const string &Type() {
+                    static const string type = Base::Type() + "_compact";
+                    return type;
+                }
+
+                istream &Read(istream &strm);
+
+                ostream &Write(ostream &strm) const;
+
+                CompactCategorialWeight<L, S> Quantize(float delta = kDelta) const {
+                    return *this;
+                }
+
+                ReverseWeight Reverse() const {
+                    return ReverseWeight(Base::Reverse());
+                }
+
+            private:
+                // Encoding buffer, reused across weights of the calling thread.
+                static string &Buffer() {
+                    static thread_local string buffer;
+                    return buffer;
+                }
+        };
+
+    template <typename L, CategorialType S>
+        inline istream &CompactCategorialWeight<L, S>::Read(istream &strm) {
+            this->Clear();
+            uint64 size = 0, bytes = 0;
+            if (!ReadCategorialVarint(strm, &size) || !ReadCategorialVarint(strm, &bytes))
+                return strm;
+            // every label takes 1 to 10 bytes: other sizes come from a
+            // corrupt stream, and must not be allocated
+            if (bytes < size || bytes > 10 * size) {
+                strm.setstate(std::ios::failbit);
+                return strm;
+            }
+            if (size == 0)
+                return strm;
+            // the buffer grows with the bytes actually read, so that a
+            // truncated stream does not allocate its announced size
+            string &buffer = Buffer();
+            buffer.clear();
+            while (strm && buffer.size() < bytes) {
+                size_t pos = buffer.size();
+                buffer.resize(pos + std::min<uint64>(bytes - pos, std::max<size_t>(pos, 1 << 16)));
+                strm.read(&buffer[pos], buffer.size() - pos);
+            }
+            if (!strm)
+                return strm;
+            L *labels = this->Resize(size);
+            size_t pos = 0;
+            for (uint64 i = 0; strm && i < size; ++i) {
+                uint64 value;
+                size_t n = ReadCategorialVarint(buffer.data() + pos, bytes - pos, &value);
+                if (!n)
+                    strm.setstate(std::ios::failbit);
+                labels[i] = static_cast<L>(ZigzagDecode(value));
+                pos += n;
+            }
+            if (!strm)
+                this->Clear();
+            return strm;
+        }
+
+    template <typename L, CategorialType S>
+        inline ostream &CompactCategorialWeight<L, S>::Write(ostream &strm) const {
+            const L *labels = this->Labels();
+            size_t size = this->Size();
+            string &buffer = Buffer();
+            buffer.resize(10 * size);
+            size_t bytes = 0;
+            for (size_t i = 0; i < size; ++i)
+                bytes += WriteCategorialVarint(ZigzagEncode(labels[i]), &buffer[bytes]);
+            char header[20];
+            size_t n = WriteCategorialVarint(size, header);
+            n += WriteCategorialVarint(bytes, header + n);
+            strm.write(header, n);
+            return strm.write(buffer.data(), bytes);
+        }
+
+
+    template <typename L, CategorialType S>  inline CompactCategorialWeight<L, S>
+        Plus(const CompactCategorialWeight<L, S> &w1,
+                const CompactCategorialWeight<L, S> &w2) {
+            typedef CategorialWeight<L, S> Base;
+            return Plus(static_cast<const Base &>(w1), static_cast<const Base &>(w2));
+        }
+
+    template <typename L, CategorialType S>  inline CompactCategorialWeight<L, S>
+        Times(const CompactCategorialWeight<L, S> &w1,
+                const CompactCategorialWeight<L, S> &w2) {
+            typedef CategorialWeight<L, S> Base;
+            return Times(static_cast<const Base &>(w1), static_cast<const Base &>(w2));
+        }
+
+    template <typename L, CategorialType S>  inline CompactCategorialWeight<L, S>
+        Divide(const CompactCategorialWeight<L, S> &w1,
+                const CompactCategorialWeight<L, S> &w2,
+                DivideType typ) {
+            typedef CategorialWeight<L, S> Base;
+            return Divide(static_cast<const Base &>(w1), static_cast<const Base &>(w2), typ);
+        }
+
+}  // namespace fst
+
+#endif  // FST_LIB_COMPACT_CATEGORIAL_WEIGHT_H__
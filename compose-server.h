@@ -0,0 +1,387 @@
+// compose-server.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Long-running mode of the compose tools: the model is loaded and prepared
+// once, then requests (binary fsts) are composed with it on a pool of
+// threads. Requests come either as a stream of fsts on stdin, answered in
+// the same order on stdout, or one per connection on a Unix domain socket.
+// Each request is timed on stderr.
+//
+// OpenFst before 1.6 counts the references to fst and symbol table
+// implementations without atomics, and compositions copy both, so threads
+// must not copy a shared model: the model is loaded once, and each worker
+// composes with its own SharedFst view of it, which copies without
+// counting references to the model.
+
+#ifndef FST_UTILS_COMPOSE_SERVER_H__
+#define FST_UTILS_COMPOSE_SERVER_H__
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <utility>
+
+#include <fst/fstlib.h>
+
+#include "parallel.h"
+
+namespace fst {
+
+    // Labels of the "from" table mapped to the labels of the same symbols
+    // in the "to" table. Symbols unknown to "to" get a label that matches
+    // nothing; labels which are not in "from" are kept.
+    inline vector<int64> LabelMap(const SymbolTable &from, const SymbolTable &to) {
+        vector<int64> labels(from.AvailableKey());
+        for (size_t i = 0; i < labels.size(); ++i) labels[i] = i;
+        int64 unknown = to.AvailableKey();
+        for (SymbolTableIterator siter(from); !siter.Done(); siter.Next()) {
+            if (siter.Value() < 0 || siter.Value() >= (int64) labels.size()) continue;
+            int64 label = to.Find(siter.Symbol());
+            labels[siter.Value()] = label != -1 ? label : unknown;
+        }
+        return labels;
+    }
+
+    // Applies a label map to the output labels of an fst.
+    template <class Arc>
+        void MapOutputLabels(const vector<int64> &labels, MutableFst<Arc> *fst) {
+            for (StateIterator< MutableFst<Arc> > siter(*fst); !siter.Done(); siter.Next()) {
+                for (MutableArcIterator< MutableFst<Arc> > aiter(fst, siter.Value()); !aiter.Done(); aiter.Next()) {
+                    Arc arc = aiter.Value();
+                    if (arc.olabel >= 0 && arc.olabel < (int64) labels.size()) {
+                        arc.olabel = labels[arc.olabel];
+                        aiter.SetValue(arc);
+                    }
+                }
+            }
+        }
+
+    // Copy of a symbol table which shares nothing with it.
+    inline SymbolTable *DeepCopy(const SymbolTable &symbols) {
+        SymbolTable *copy = new SymbolTable(symbols.Name());
+        for (SymbolTableIterator siter(symbols); !siter.Done(); siter.Next())
+            copy->AddSymbol(siter.Symbol(), siter.Value());
+        return copy;
+    }
+
+    // Read-only view of an expanded fst, for the workers of a server which
+    // compose with the same model: copies of a view point to the fst
+    // without counting references to it, and share the symbol tables of
+    // the view, which are its own. Threads may then compose with the model
+    // at the same time as long as each uses its own view. The fst must not
+    // change and must outlive the views; its properties are computed when a
+    // view is made from it, so views are made by one thread, before serving.
+    template <class A>
+        class SharedFst : public ExpandedFst<A> {
+            public:
+                typedef A Arc;
+                typedef typename A::StateId StateId;
+                typedef typename A::Weight Weight;
+
+                explicit SharedFst(const ExpandedFst<A> &fst)
+                    : fst_(&fst), properties_(fst.Properties(kFstProperties, true)),
+                    isymbols_(fst.InputSymbols() ? DeepCopy(*fst.InputSymbols()) : NULL),
+                    osymbols_(fst.OutputSymbols() ? DeepCopy(*fst.OutputSymbols()) : NULL) {}
+
+                SharedFst(const SharedFst<A> &fst)
+                    : fst_(fst.fst_), properties_(fst.properties_),
+                    isymbols_(fst.isymbols_ ? fst.isymbols_->Copy() : NULL),
+                    osymbols_(fst.osymbols_ ? fst.osymbols_->Copy() : NULL) {}
+
+                virtual ~SharedFst() {
+                    delete isymbols_;
+                    delete osymbols_;
+                }
+
+                virtual StateId Start() const { return fst_->Start(); }
+                virtual Weight Final(StateId s) const { return fst_->Final(s); }
+                virtual StateId NumStates() const { return fst_->NumStates(); }
+                virtual size_t NumArcs(StateId s) const { return fst_->NumArcs(s); }
+                virtual size_t NumInputEpsilons(StateId s) const { return fst_->NumInputEpsilons(s); }
+                virtual size_t NumOutputEpsilons(StateId s) const { return fst_->NumOutputEpsilons(s); }
+
+                // known without testing: testing would store them in the fst
+                virtual uint64 Properties(uint64 mask, bool test) const { return properties_ & mask; }
+
+                virtual const string &Type() const {
+                    static const string type = "shared";
+                    return type;
+                }
+
+                virtual SharedFst<A> *Copy(bool safe = false) const { return new SharedFst<A>(*this); }
+
+                virtual const SymbolTable *InputSymbols() const { return isymbols_; }
+                virtual const SymbolTable *OutputSymbols() const { return osymbols_; }
+
+                virtual void InitStateIterator(StateIteratorData<A> *data) const { fst_->InitStateIterator(data); }
+                virtual void InitArcIterator(StateId s, ArcIteratorData<A> *data) const { fst_->InitArcIterator(s, data); }
+
+            private:
+                const ExpandedFst<A> *fst_;
+                uint64 properties_;
+                SymbolTable *isymbols_;
+                SymbolTable *osymbols_;
+
+                void operator=(const SharedFst<A> &);
+        };
+
+    typedef SharedFst<StdArc> StdSharedFst;
+
+    // Size of a model, which the workers share, on stderr: about the memory
+    // of its states and arcs in a VectorFst, and the symbols which each
+    // worker copies.
+    template <class Arc>
+        void ReportModel(const ExpandedFst<Arc> &fst, int num_workers) {
+            size_t num_arcs = 0;
+            for (StateIterator< ExpandedFst<Arc> > siter(fst); !siter.Done(); siter.Next())
+                num_arcs += fst.NumArcs(siter.Value());
+            size_t state_bytes = sizeof(typename Arc::Weight) + 2 * sizeof(size_t) + sizeof(vector<Arc>) + sizeof(void *);
+            double megabytes = (fst.NumStates() * state_bytes + num_arcs * sizeof(Arc)) / (1024.0 * 1024.0);
+            size_t num_symbols = (fst.InputSymbols() ? fst.InputSymbols()->NumSymbols() : 0)
+                + (fst.OutputSymbols() ? fst.OutputSymbols()->NumSymbols() : 0);
+            std::cerr << "model: " << fst.NumStates() << " states, " << num_arcs << " arcs, " << megabytes
+                << " MB shared by " << num_workers << " threads, " << num_symbols << " symbols copied per thread\n";
+        }
+
+    // Buffered stream over a file descriptor (the connections of the server).
+    class FdStreamBuf : public std::streambuf {
+        public:
+            explicit FdStreamBuf(int fd) : fd_(fd) {
+                setg(input_, input_, input_);
+                setp(output_, output_ + sizeof(output_));
+            }
+
+            ~FdStreamBuf() { sync(); }
+
+        protected:
+            int_type underflow() {
+                ssize_t count;
+                do {
+                    count = read(fd_, input_, sizeof(input_));
+                } while (count < 0 && errno == EINTR);
+                if (count <= 0) return traits_type::eof();
+                setg(input_, input_, input_ + count);
+                return traits_type::to_int_type(*gptr());
+            }
+
+            int_type overflow(int_type c) {
+                if (sync() == -1) return traits_type::eof();
+                if (!traits_type::eq_int_type(c, traits_type::eof())) {
+                    *pptr() = traits_type::to_char_type(c);
+                    pbump(1);
+                }
+                return traits_type::not_eof(c);
+            }
+
+            int sync() {
+                for (char *data = pbase(); data < pptr(); ) {
+                    ssize_t count = write(fd_, data, pptr() - data);
+                    if (count < 0 && errno == EINTR) continue;
+                    if (count <= 0) return -1;
+                    data += count;
+                }
+                setp(output_, output_ + sizeof(output_));
+                return 0;
+            }
+
+        private:
+            int fd_;
+            char input_[1 << 16];
+            char output_[1 << 16];
+
+            DISALLOW_COPY_AND_ASSIGN(FdStreamBuf);
+    };
+
+    struct ComposeServerOptions {
+        int threads;
+        std::string socket_path;    // serve stdin/stdout if empty
+        int timeout;                // seconds a connection may wait to send or receive, none if <= 0
+
+        ComposeServerOptions() : threads(1), timeout(60) {}
+
+        int NumWorkers() const { return threads > 1 ? threads : 1; }
+    };
+
+    // Serves compositions until the end of stdin (or forever on a socket).
+    // compose(int worker, const StdVectorFst &input, StdVectorFst *output)
+    // is called concurrently from several threads and returns false on
+    // failure, in which case an empty fst is returned. worker is in
+    // [0, opts.NumWorkers()), and concurrent calls get different ones, so
+    // that each can use its own view of the model.
+    template <class F>
+        class ComposeServer {
+            public:
+                ComposeServer(const ComposeServerOptions &opts, F compose)
+                    : opts_(opts), compose_(compose), next_id_(0), next_output_(0), answered_(opts.NumWorkers()) {}
+
+                int Run() {
+                    // a client which leaves before its answer is written
+                    // makes write() fail with EPIPE instead of killing the server
+                    signal(SIGPIPE, SIG_IGN);
+                    return opts_.socket_path != "" ? ServeSocket() : ServeStream();
+                }
+
+            private:
+                // Requests are read from stdin by the main thread, composed
+                // by the pool, and written by whichever worker completes
+                // the next one in input order.
+                int ServeStream() {
+                    std::ios_base::sync_with_stdio(false);
+                    int status = 0;
+                    {
+                        ThreadPool pool(opts_.NumWorkers());
+                        while (std::cin.peek() != EOF) {
+                            size_t id = next_id_++;
+                            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                            StdVectorFst *input = StdVectorFst::Read(std::cin, FstReadOptions("standard input"));
+                            if (!input) {
+                                std::cerr << "error: cannot read request " << id << "\n";
+                                status = 1;
+                                break;
+                            }
+                            pool.Schedule([this, input, id, start](int worker) {
+                                StdVectorFst *output = new StdVectorFst();
+                                bool ok = compose_(worker, *input, output);
+                                if (!ok) output->DeleteStates();
+                                Report(id, start, *input, *output, ok);
+                                delete input;
+                                // answers may share symbol tables with the view of
+                                // the model of the worker which composed them, so
+                                // that worker deletes them, outside of the lock
+                                vector<StdVectorFst *> answered;
+                                {
+                                    std::lock_guard<std::mutex> lock(output_mutex_);
+                                    pending_[id] = std::make_pair(worker, output);
+                                    for (std::map<size_t, std::pair<int, StdVectorFst *> >::iterator next = pending_.find(next_output_);
+                                            next != pending_.end(); next = pending_.find(next_output_)) {
+                                        next->second.second->Write(std::cout, FstWriteOptions("standard output"));
+                                        std::cout.flush();
+                                        answered_[next->second.first].push_back(next->second.second);
+                                        pending_.erase(next);
+                                        ++next_output_;
+                                    }
+                                    answered.swap(answered_[worker]);
+                                }
+                                for (size_t i = 0; i < answered.size(); ++i) delete answered[i];
+                            });
+                        }
+                    }
+                    // the workers are done
+                    for (size_t worker = 0; worker < answered_.size(); ++worker) {
+                        for (size_t i = 0; i < answered_[worker].size(); ++i) delete answered_[worker][i];
+                        answered_[worker].clear();
+                    }
+                    return status;
+                }
+
+                // One request per connection, read and answered by a worker.
+                int ServeSocket() {
+                    int server = socket(AF_UNIX, SOCK_STREAM, 0);
+                    struct sockaddr_un address;
+                    memset(&address, 0, sizeof(address));
+                    address.sun_family = AF_UNIX;
+                    if (server < 0 || opts_.socket_path.size() >= sizeof(address.sun_path)) {
+                        std::cerr << "error: cannot create socket " << opts_.socket_path << "\n";
+                        return 1;
+                    }
+                    strncpy(address.sun_path, opts_.socket_path.c_str(), sizeof(address.sun_path) - 1);
+                    unlink(opts_.socket_path.c_str());
+                    if (bind(server, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(server, 64) < 0) {
+                        std::cerr << "error: cannot listen on " << opts_.socket_path << ": " << strerror(errno) << "\n";
+                        close(server);
+                        return 1;
+                    }
+                    ThreadPool pool(opts_.NumWorkers());
+                    while (true) {
+                        int connection = accept(server, NULL, NULL);
+                        if (connection < 0) {
+                            if (errno == EINTR) continue;
+                            std::cerr << "error: accept failed: " << strerror(errno) << "\n";
+                            break;
+                        }
+                        // an idle client only holds its thread until the timeout
+                        if (opts_.timeout > 0) {
+                            struct timeval timeout;
+                            timeout.tv_sec = opts_.timeout;
+                            timeout.tv_usec = 0;
+                            setsockopt(connection, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+                            setsockopt(connection, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                        }
+                        size_t id = next_id_++;
+                        pool.Schedule([this, connection, id](int worker) {
+                            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                            FdStreamBuf buffer(connection);
+                            std::iostream strm(&buffer);
+                            StdVectorFst *input = StdVectorFst::Read(strm, FstReadOptions(opts_.socket_path));
+                            if (input) {
+                                StdVectorFst output;
+                                bool ok = compose_(worker, *input, &output);
+                                if (!ok) output.DeleteStates();
+                                Report(id, start, *input, output, ok);
+                                output.Write(strm, FstWriteOptions(opts_.socket_path));
+                                strm.flush();
+                                delete input;
+                            }
+                            close(connection);
+                        });
+                    }
+                    close(server);
+                    return 1;
+                }
+
+                void Report(size_t id, std::chrono::steady_clock::time_point start,
+                        const StdVectorFst &input, const StdVectorFst &output, bool ok) {
+                    double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+                    std::ostringstream report;
+                    report << id << "\t" << milliseconds << " ms\t" << input.NumStates() << " -> " << output.NumStates() << " states";
+                    if (!ok) report << "\terror";
+                    report << "\n";
+                    std::lock_guard<std::mutex> lock(stderr_mutex_);
+                    std::cerr << report.str();
+                }
+
+                ComposeServerOptions opts_;
+                F compose_;
+                size_t next_id_;
+                size_t next_output_;                            // next request to answer (stream)
+                std::map<size_t, std::pair<int, StdVectorFst *> > pending_;     // worker and answer, not written yet (stream)
+                vector<vector<StdVectorFst *> > answered_;      // written, to be deleted by each worker (stream)
+                std::mutex output_mutex_;
+                std::mutex stderr_mutex_;
+        };
+
+    template <class F>
+        int ServeCompositions(const ComposeServerOptions &opts, F compose) {
+            ComposeServer<F> server(opts, compose);
+            return server.Run();
+        }
+
+}  // namespace fst
+
+#endif  // FST_UTILS_COMPOSE_SERVER_H__
@@ -16,94 +16,177 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <sstream>
-#include <list>
+#include <algorithm>
 #include <fst/fstlib.h>
+#include <fst/extensions/far/far.h>
 
-int main(int argc, char** argv) {
-    bool is_transducer = false;
-    if(argc == 2 && std::string(argv[1]) == "-t") {
-        is_transducer = true;
-    } else if(argc != 1) {
-        std::cerr << "usage: " << argv[0] << " [-t]\n";
+#include "parallel.h"
+#include "text-compiler.h"
+#include "text-reader.h"
+
+/* an fst of a keyed stream: key line, then lines of the fst up to a blank line */
+struct KeyedFst {
+    std::string key;
+    const char *begin;
+    const char *end;
+    int line_offset;    /* lines before the fst */
+};
+
+/* next fst of a keyed stream starting at *current, false at the end */
+bool NextKeyedFst(const char **current, const char *end, int *line_num, KeyedFst *keyed) {
+    const char *line_end;
+    fst::TextToken token;
+    while(true) {
+        line_end = static_cast<const char*>(memchr(*current, '\n', end - *current));
+        if(line_end == NULL) return false;
+        (*line_num)++;
+        size_t num_tokens = fst::SplitTextLine(*current, line_end, &token, 1);
+        *current = line_end + 1;
+        if(num_tokens > 0) break;
+    }
+    const char *key_end = line_end;
+    while(key_end > token.data && fst::IsTextSpace(key_end[-1])) key_end--;
+    keyed->key.assign(token.data, key_end - token.data);
+    keyed->begin = *current;
+    keyed->line_offset = *line_num;
+    while(true) {
+        line_end = static_cast<const char*>(memchr(*current, '\n', end - *current));
+        if(line_end == NULL) {
+            *current = end;
+            break;
+        }
+        fst::TextToken first;
+        if(fst::SplitTextLine(*current, line_end, &first, 1) == 0) break;
+        (*line_num)++;
+        *current = line_end + 1;
+    }
+    keyed->end = *current;
+    return true;
+}
+
+/* archive mode: compiles each fst of a keyed stream and writes it to an
+ * archive under its key, fsts being compiled on several threads a batch
+ * at a time. Each fst has its own symbol tables, or symbols are shared by
+ * all of them: the fsts then have no symbol tables and the shared ones are
+ * written to <prefix>.isyms and <prefix>.osyms (transducers) at the end;
+ * like chunks, the fsts are compiled with local names and merged in input
+ * order so that symbol ids do not depend on the number of threads. */
+int CompileArchive(const char *begin, const char *end, bool is_transducer, int threads,
+        const std::string &output_name, const std::string &shared_prefix) {
+    fst::FarWriter<fst::StdArc> *writer = fst::FarWriter<fst::StdArc>::Create(output_name);
+    if(!writer) {
+        std::cerr << "error: cannot create archive " << output_name << "\n";
         return 1;
     }
-    fst::SymbolTable states("states");
-    fst::SymbolTable isyms("input");
-    fst::SymbolTable osyms("output");
-    isyms.AddSymbol("<eps>");
-    osyms.AddSymbol("<eps>");
-    fst::StdVectorFst automaton;
+    fst::SymbolNames shared;
+    bool share = shared_prefix != "";
+    const char *current = begin;
     int line_num = 0;
-    while(!std::cin.eof()) {
-        line_num++;
-        std::string line;
-        std::getline(std::cin, line);
-        std::vector<std::string> tokens;
-        std::istringstream tokenizer(line);
-        while(1) {
-            std::string token;
-            if(!(tokenizer >> token)) break;
-            tokens.push_back(token);
-        }
-        if(std::cin.eof()) break;
-        int64 from_state = -1, to_state = -1, in_symbol = -1, out_symbol = -1;
-        double weight = 0;
-        if(tokens.size() == 0) {
-            std::cerr << "error: empty line in automaton, line " << line_num << "\n";
-            return 1;
-        } else {
-            from_state = states.Find(tokens[0]);
-            if(from_state == -1) {
-                from_state = automaton.AddState();
-                states.AddSymbol(tokens[0], from_state);
+    const size_t batch_size = 4 * threads;
+    while(current < end) {
+        std::vector<KeyedFst> batch;
+        KeyedFst keyed;
+        while(batch.size() < batch_size && NextKeyedFst(&current, end, &line_num, &keyed)) batch.push_back(keyed);
+        if(batch.empty()) break;
+        std::vector<std::string> errors(batch.size());
+        std::vector<int> lines(batch.size());
+        std::vector<fst::StdVectorFst> results(batch.size());
+        std::vector<fst::ChunkBuilder> chunks(share ? batch.size() : 0);
+        fst::ParallelFor(batch.size(), threads, [&](size_t i) {
+            if(share) {
+                lines[i] = fst::CompileLines(batch[i].begin, batch[i].end, is_transducer, &chunks[i], &errors[i]);
+                return;
+            }
+            fst::SymbolNames names;
+            fst::FstBuilder builder(&names);
+            lines[i] = fst::CompileLines(batch[i].begin, batch[i].end, is_transducer, &builder, &errors[i]);
+            if(builder.automaton.NumStates() > 0) builder.automaton.SetStart(0);
+            fst::SetSymbols(names, is_transducer, &builder.automaton);
+            results[i] = builder.automaton;
+        });
+        for(size_t i = 0; i < batch.size(); i++) {
+            if(errors[i] != "") {
+                std::cerr << "error: " << errors[i] << ", line " << batch[i].line_offset + lines[i] << " (" << batch[i].key << ")\n";
+                delete writer;
+                return 1;
             }
-            if(tokens.size() <= 2) {
-                if(tokens.size() == 2 && !(std::istringstream(tokens[1]) >> weight)) {
-                    std::cerr << "error: weight not a valid number, line " << line_num << "\n";
-                    return 1;
-                }
-                automaton.SetFinal(from_state, weight);
+            if(share) {
+                fst::FstBuilder builder(&shared);
+                fst::MergeChunk(chunks[i], &builder);
+                if(builder.automaton.NumStates() > 0) builder.automaton.SetStart(0);
+                writer->Add(batch[i].key, builder.automaton);
             } else {
-                to_state = states.Find(tokens[1]);
-                if(to_state == -1) {
-                    to_state = automaton.AddState();
-                    states.AddSymbol(tokens[1], to_state);
-                }
-                in_symbol = isyms.AddSymbol(tokens[2]);
-                if(is_transducer) {
-                    if(tokens.size() < 4) {
-                        std::cerr << "error: missing output symbol in transducer, line " << line_num << "\n";
-                        return 1;
-                    }
-                    out_symbol = osyms.AddSymbol(tokens[3]);
-                    if(tokens.size() == 5 && !(std::istringstream(tokens[4]) >> weight)) {
-                        std::cerr << "error: weight not a valid number, line " << line_num << "\n";
-                        return 1;
-                    }
-                    if(tokens.size() > 5) {
-                        std::cerr << "error: too many fields in transudcer, line " << line_num << "\n";
-                        return 1;
-                    }
-                } else {
-                    out_symbol = in_symbol;
-                    if(tokens.size() == 4 && !(std::istringstream(tokens[3]) >> weight)) {
-                        std::cerr << "error: weight not a valid number, line " << line_num << "\n";
-                        return 1;
-                    }
-                    if(tokens.size() > 4) {
-                        std::cerr << "error: too many fields in acceptor, line " << line_num << "\n";
-                        return 1;
-                    }
-                }
-                automaton.AddArc(from_state, fst::StdArc(in_symbol, out_symbol, weight, to_state));
+                writer->Add(batch[i].key, results[i]);
             }
         }
     }
-    automaton.SetStart(0);
-    automaton.SetInputSymbols(&isyms);
-    if(is_transducer) automaton.SetOutputSymbols(&osyms);
-    else automaton.SetOutputSymbols(&isyms);
-    automaton.Write("");
+    delete writer;
+    if(share) {
+        fst::SymbolTable isymbols("input");
+        fst::FillSymbols(shared.isyms, &isymbols);
+        if(!isymbols.WriteText(shared_prefix + ".isyms")) {
+            std::cerr << "error: cannot write " << shared_prefix << ".isyms\n";
+            return 1;
+        }
+        if(is_transducer) {
+            fst::SymbolTable osymbols("output");
+            fst::FillSymbols(shared.osyms, &osymbols);
+            if(!osymbols.WriteText(shared_prefix + ".osyms")) {
+                std::cerr << "error: cannot write " << shared_prefix << ".osyms\n";
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    bool is_transducer = false;
+    int threads = 1;
+    std::string far_name;
+    std::string shared_prefix;
+    bool usage = false;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "-t") {
+            is_transducer = true;
+        } else if(arg == "-j" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+            if(threads < 1) usage = true;
+        } else if(arg == "--far" && i + 1 < argc) {
+            far_name = argv[++i];
+        } else if(arg == "--shared-symbols" && i + 1 < argc) {
+            shared_prefix = argv[++i];
+        } else {
+            usage = true;
+        }
+    }
+    if(shared_prefix != "" && far_name == "") usage = true;
+    if(usage) {
+        std::cerr << "usage: " << argv[0] << " [-t] [-j <threads>]\n"
+            << "       " << argv[0] << " [-t] [-j <threads>] [--shared-symbols <prefix>] --far <output.far>\n";
+        return 1;
+    }
+    /* the whole input is mapped and names point into it */
+    fst::TextInput input(0);
+    if(input.Error()) {
+        std::cerr << "error: cannot read input\n";
+        return 1;
+    }
+    const char *begin = input.Data(), *end = input.Data() + input.Size();
+    if(far_name != "") return CompileArchive(begin, end, is_transducer, threads, far_name, shared_prefix);
+
+    fst::SymbolNames names;
+    fst::FstBuilder builder(&names);
+    std::string error;
+    int line_num = threads > 1 ? fst::CompileChunks(begin, end, is_transducer, threads, &builder, &error)
+        : fst::CompileLines(begin, end, is_transducer, &builder, &error);
+    if(error != "") {
+        std::cerr << "error: " << error << ", line " << line_num << "\n";
+        return 1;
+    }
+    builder.automaton.SetStart(0);
+    fst::SetSymbols(names, is_transducer, &builder.automaton);
+    builder.automaton.Write("");
     return 0;
 }
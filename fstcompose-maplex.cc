@@ -15,25 +15,82 @@
 
 #include <fst/fstlib.h>
 
+#include "compose-server.h"
+
 using namespace fst;
 
+/* composes fst1 (the small side) with the model after mapping its output
+ * labels to the input labels of the model, which is only read */
+void ComposeMapped(StdVectorFst *input1, const StdFst &model, StdVectorFst *composed) {
+    MapOutputLabels(LabelMap(*(input1->OutputSymbols()), *(model.InputSymbols())), input1);
+    input1->SetOutputSymbols(model.InputSymbols());
+    ArcSort(input1, StdOLabelCompare());
+    Compose(*input1, model, composed);
+}
+
 int main(int argc, char** argv) {
-    if(argc != 3) {
-        std::cerr << "usage: " << argv[0] << " <fst1> <fst2>\n";
+    bool serve = false;
+    ComposeServerOptions server_opts;
+    vector<std::string> inputs;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--serve") {
+            serve = true;
+        } else if(arg == "--socket" && i + 1 < argc) {
+            serve = true;
+            server_opts.socket_path = argv[++i];
+        } else if(arg == "--threads" && i + 1 < argc) {
+            server_opts.threads = atoi(argv[++i]);
+        } else if(arg == "--timeout" && i + 1 < argc) {
+            server_opts.timeout = atoi(argv[++i]);
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if(inputs.size() != (serve ? 1 : 2)) {
+        std::cerr << "usage: " << argv[0] << " <fst1> <fst2>\n"
+            << "       " << argv[0] << " --serve [--socket <path>] [--threads <n>] [--timeout <seconds>] <fst2>\n";
         return 1;
     }
-    StdVectorFst *input1 = StdVectorFst::Read(argv[1]);
-    StdVectorFst *input2 = StdVectorFst::Read(argv[2]);
-    bool relabel;
-    SymbolTable *symbolMap = MergeSymbolTable(*(input1->OutputSymbols()), *(input2->InputSymbols()), &relabel);
-    Relabel(input1, NULL, symbolMap);
-    Relabel(input2, symbolMap, NULL);
-    input1->SetOutputSymbols(symbolMap);
-    ArcSort(input1, StdOLabelCompare());
-    input2->SetInputSymbols(symbolMap);
-    delete symbolMap;
+    if(serve) {
+        /* the model is loaded once and shared by the workers, each with its
+         * own view of it; it is used as read if it is expanded and sorted */
+        StdFst *input = StdFst::Read(inputs[0]);
+        if(!input) return 1;
+        const StdExpandedFst *model = NULL;
+        if(input->Properties(kExpanded, false) && input->Properties(kILabelSorted, true)) {
+            model = static_cast<const StdExpandedFst *>(input);
+        } else {
+            StdVectorFst *sorted = new StdVectorFst(*input);
+            delete input;
+            ArcSort(sorted, StdILabelCompare());
+            model = sorted;
+        }
+        ReportModel(*model, server_opts.NumWorkers());
+        vector<StdSharedFst *> models;
+        for(int t = 0; t < server_opts.NumWorkers(); t++)
+            models.push_back(new StdSharedFst(*model));
+        return ServeCompositions(server_opts, [&models](int worker, const StdVectorFst &request, StdVectorFst *composed) -> bool {
+            const StdSharedFst &model = *models[worker];
+            if(!request.OutputSymbols() || !model.InputSymbols()) return false;
+            StdVectorFst input1(request);
+            ComposeMapped(&input1, model, composed);
+            return true;
+        });
+    }
+
+    /* fst2 is only read; if it is not known to be sorted on input labels,
+     * states are sorted lazily as composition reaches them */
+    StdVectorFst *input1 = StdVectorFst::Read(inputs[0]);
+    StdFst *input2 = StdFst::Read(inputs[1]);
+    if(!input1 || !input2) return 1;
     StdVectorFst composed;
-    Compose(*input1, *input2, &composed);
+    if(input2->Properties(kILabelSorted, false)) {
+        ComposeMapped(input1, *input2, &composed);
+    } else {
+        ArcSortFst<StdArc, StdILabelCompare> sorted(*input2, StdILabelCompare());
+        ComposeMapped(input1, sorted, &composed);
+    }
     composed.Write("");
     delete input1;
     delete input2;
@@ -15,84 +15,194 @@
 
 #include <fst/fstlib.h>
 
+#include "compose-server.h"
+#include "lazy-kbest.h"
+#include "special-matcher.h"
+
 // inspired by http://code.google.com/p/pyopenfst/source/browse/opfst_beamsearch.cc
 
 using namespace std;
 
-template <class M>
-class SpecialMatcher: public fst::RhoMatcher< fst::SigmaMatcher< fst::PhiMatcher< M > > >
-{
-    public:
-        typedef typename M::FST FST;
-        typedef typename M::Arc Arc;
-        typedef typename Arc::StateId StateId;
-        typedef typename Arc::Label Label;
-        typedef typename Arc::Weight Weight;
-
-        SpecialMatcher(const SpecialMatcher<M> &matcher, bool safe = false)
-            : fst::RhoMatcher< fst::SigmaMatcher< fst::PhiMatcher< M > > >(matcher, safe)
-        {}
-
-        virtual SpecialMatcher<M> *Copy(bool safe = false) const {
-            return new SpecialMatcher<M>(*this, safe);
-        }
-
-        virtual ~SpecialMatcher() {
-            delete matcher_;
+/* n best paths of a lazy fst, as output by ShortestPath(), found by a
+ * Dijkstra search which only expands the states reached by paths better
+ * than the n-th one */
+void BestPaths(const fst::StdFst &input, int n, fst::StdVectorFst *output) {
+    output->DeleteStates();
+    output->SetInputSymbols(input.InputSymbols());
+    output->SetOutputSymbols(input.OutputSymbols());
+    fst::LazyKBestOptions opts(n);
+    opts.heuristic = false;
+    fst::LazyKBest<fst::StdArc> nbest(input, opts);
+    vector<fst::StdArc> path;
+    float weight;
+    while(nbest.Next(&path, &weight)) {
+        if(output->Start() == fst::kNoStateId) output->SetStart(output->AddState());
+        fst::StdArc::StateId state = output->Start();
+        for(size_t i = 0; i < path.size(); i++) {
+            fst::StdArc::StateId next = output->AddState();
+            output->AddArc(state, fst::StdArc(path[i].ilabel, path[i].olabel, path[i].weight, next));
+            state = next;
         }
+        output->SetFinal(state, input.Final(path.empty() ? input.Start() : path.back().nextstate));
+    }
+}
 
-        SpecialMatcher(const FST &fst,
-                fst::MatchType match_type, int64 rho = -3, int64 sigma = -2, int64 phi = -1)
-            :           fst::RhoMatcher< fst::SigmaMatcher< fst::PhiMatcher< M > > >
-                        (fst, match_type, rho, fst::MATCHER_REWRITE_ALWAYS,
-                         new fst::SigmaMatcher< fst::PhiMatcher< M> >
-                         (fst, match_type, sigma, fst::MATCHER_REWRITE_ALWAYS,
-                          new fst::PhiMatcher< M >
-                          (fst, match_type, phi, fst::MATCHER_REWRITE_ALWAYS)))
-    {}
-
+const char *const kSpecialNames[3] = {"<rho>", "<sigma>", "<phi>"};
+
+/* model side of the compositions: labels of the special symbols of the
+ * model (kNoLabel for those it does not have) and a matcher with these
+ * labels, which is copied for each composition */
+struct SpecialsModel {
+    const fst::StdExpandedFst *transducer;
+    const fst::StdPhiClosure *closure;  // may be NULL
+    int64 specials[3];                  // <rho>, <sigma>, <phi>
+    fst::StdSpecialMatcher *matcher;
+    fst::StdSharedFst *owned;           // transducer, if owned
+
+    SpecialsModel(const fst::StdVectorFst &model, const fst::StdPhiClosure *phi_closure)
+        : transducer(&model), closure(phi_closure), owned(NULL) {
+        for(int i = 0; i < 3; i++)
+            specials[i] = model.InputSymbols() ? model.InputSymbols()->Find(kSpecialNames[i]) : fst::kNoLabel;
+        matcher = new fst::StdSpecialMatcher(model, fst::MATCH_INPUT, specials[0], specials[1], specials[2], closure);
+    }
 
-        M *matcher_;
+    /* the same model on a view of its transducer, for a worker, which is
+     * then owned; the prepared matcher table and the closure are shared */
+    SpecialsModel(const SpecialsModel &model, fst::StdSharedFst *view)
+        : transducer(view), closure(model.closure), owned(view) {
+        for(int i = 0; i < 3; i++) specials[i] = model.specials[i];
+        matcher = new fst::StdSpecialMatcher(*view, *model.matcher);
+    }
 
+    ~SpecialsModel() {
+        delete matcher;
+        delete owned;
+    }
 };
 
-
-int main(int argc, char** argv) {
-    if(argc != 3) {
-        cerr << "usage: " << argv[0] << " <input1> <input2>\n";
-        return 1;
+/* composes fst1 with the model, which is only read, after mapping the
+ * output labels of fst1 to the input labels of the model; specials that
+ * only fst1 knows get labels unused by the model; if nbest > 0, only the
+ * nbest best paths of the composition are computed */
+void ComposeSpecials(fst::StdVectorFst *input1, const SpecialsModel &model, int nbest, fst::StdVectorFst *output) {
+    const fst::SymbolTable &from = *(input1->OutputSymbols());
+    const fst::SymbolTable &to = *(model.transducer->InputSymbols());
+    vector<int64> labels = fst::LabelMap(from, to);
+    int64 specials[3];
+    int64 next = to.AvailableKey() + 1;
+    for(int i = 0; i < 3; i++) {
+        specials[i] = model.specials[i];
+        int64 label = from.Find(kSpecialNames[i]);
+        if(specials[i] == fst::kNoLabel && label != -1) {
+            specials[i] = next++;
+            if(label < (int64) labels.size()) labels[label] = specials[i];
+        }
     }
-    fst::StdVectorFst* input1 = fst::StdVectorFst::Read(argv[1]);
-    fst::StdVectorFst* input2 = fst::StdVectorFst::Read(argv[2]);
+    fst::MapOutputLabels(labels, input1);
+    input1->SetOutputSymbols(model.transducer->InputSymbols());
+    fst::ArcSort(input1, fst::StdOLabelCompare());
 
-    bool relabel;
-    fst::SymbolTable *symbolMap = fst::MergeSymbolTable(*(input1->OutputSymbols()), *(input2->InputSymbols()), &relabel);
+    /* only an fst with special arcs requires matching with them */
+    int64 specials1[3] = {fst::kNoLabel, fst::kNoLabel, fst::kNoLabel};
+    for(fst::StateIterator<fst::StdVectorFst> siter(*input1); !siter.Done(); siter.Next()) {
+        for(fst::ArcIterator<fst::StdVectorFst> aiter(*input1, siter.Value()); !aiter.Done(); aiter.Next()) {
+            for(int i = 0; i < 3; i++)
+                if(specials[i] != fst::kNoLabel && aiter.Value().olabel == specials[i]) specials1[i] = specials[i];
+        }
+    }
 
-    int64 rho = symbolMap->Find("<rho>");
-    int64 sigma = symbolMap->Find("<sigma>");
-    int64 phi = symbolMap->Find("<phi>");
+    /* the matcher of the model serves, unless fst1 uses specials that the
+     * model does not have */
+    bool unknown = false;
+    for(int i = 0; i < 3; i++)
+        if(specials1[i] != model.specials[i] && specials1[i] != fst::kNoLabel) unknown = true;
 
-    fst::Relabel(input1, NULL, symbolMap);
-    fst::Relabel(input2, symbolMap, NULL);
+    fst::ComposeFstOptions <fst::StdArc, fst::StdSpecialMatcher> opts;
 
-    input1->SetOutputSymbols(symbolMap);
-    input2->SetInputSymbols(symbolMap);
+    opts.matcher1 = new fst::StdSpecialMatcher(*input1, fst::MATCH_OUTPUT, specials1[0], specials1[1], specials1[2]);
+    opts.matcher2 = unknown ? new fst::StdSpecialMatcher(*model.transducer, fst::MATCH_INPUT, specials[0], specials[1], specials[2], model.closure)
+        : model.matcher->Copy();
 
-    fst::ArcSort(input1, fst::StdOLabelCompare());
-    fst::ArcSort(input2, fst::StdILabelCompare());
+    fst::StdComposeFst composed(*input1, *model.transducer, opts);
 
-    typedef SpecialMatcher< fst::SortedMatcher<fst::StdFst> > StdSpecialMatcher;
+    if(nbest > 0) {
+        BestPaths(composed, nbest, output);
+    } else {
+        *output = composed;
+        fst::Connect(output);
+    }
+}
 
-    fst::ComposeFstOptions <fst::StdArc, StdSpecialMatcher> opts;
+int main(int argc, char** argv) {
+    bool serve = false;
+    double closure_size = 0;
+    int nbest = 0;
+    fst::ComposeServerOptions server_opts;
+    vector<string> inputs;
+    for(int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if(arg == "--serve") {
+            serve = true;
+        } else if(arg == "--socket" && i + 1 < argc) {
+            serve = true;
+            server_opts.socket_path = argv[++i];
+        } else if(arg == "--threads" && i + 1 < argc) {
+            server_opts.threads = atoi(argv[++i]);
+        } else if(arg == "--timeout" && i + 1 < argc) {
+            server_opts.timeout = atoi(argv[++i]);
+        } else if(arg == "--phi-closure" && i + 1 < argc) {
+            closure_size = atof(argv[++i]);
+        } else if(arg == "--nbest" && i + 1 < argc) {
+            nbest = atoi(argv[++i]);
+        } else {
+            inputs.push_back(arg);
+        }
+    }
+    if(inputs.size() != (serve ? 1 : 2)) {
+        cerr << "usage: " << argv[0] << " [--phi-closure <megabytes>] [--nbest <n>] <input1> <input2>\n"
+            << "       " << argv[0] << " --serve [--socket <path>] [--threads <n>] [--timeout <seconds>] [--phi-closure <megabytes>] [--nbest <n>] <input2>\n";
+        return 1;
+    }
+    fst::StdVectorFst* input2 = fst::StdVectorFst::Read(inputs.back());
+    if(!input2) return 1;
+    fst::ArcSort(input2, fst::StdILabelCompare());
 
-    opts.matcher1 = new StdSpecialMatcher(*input1, fst::MATCH_OUTPUT, rho, sigma, phi);
-    opts.matcher2 = new StdSpecialMatcher(*input2, fst::MATCH_INPUT, rho, sigma, phi);
+    /* phi arcs of the model are resolved in advance for the states which
+     * fit in the memory budget, the others follow them at composition */
+    fst::StdPhiClosure *closure = NULL;
+    int64 phi = input2->InputSymbols() ? input2->InputSymbols()->Find("<phi>") : -1;
+    if(closure_size > 0 && phi != -1) {
+        closure = new fst::StdPhiClosure(*input2, fst::MATCH_INPUT, phi, (size_t) (closure_size * 1024 * 1024));
+        cerr << "phi closure: " << closure->NumTables() << " states, " << closure->NumBytes() / (1024.0 * 1024.0) << " MB\n";
+    }
 
-    fst::StdComposeFst composed(*input1, *input2, opts);
+    SpecialsModel model(*input2, closure);
+
+    if(serve) {
+        /* the special arcs of the model are found once; each worker has its
+         * own view of the model, which shares them, the closure tables and
+         * the transducer */
+        model.matcher->Prepare();
+        fst::ReportModel(*input2, server_opts.NumWorkers());
+        vector<SpecialsModel *> workers;
+        for(int t = 0; t < server_opts.NumWorkers(); t++)
+            workers.push_back(new SpecialsModel(model, new fst::StdSharedFst(*input2)));
+        return fst::ServeCompositions(server_opts, [&workers, nbest](int worker, const fst::StdVectorFst &request, fst::StdVectorFst *output) -> bool {
+            const SpecialsModel &model = *workers[worker];
+            if(!request.OutputSymbols() || !model.transducer->InputSymbols()) return false;
+            fst::StdVectorFst input1(request);
+            ComposeSpecials(&input1, model, nbest, output);
+            return true;
+        });
+    }
 
-    fst::StdVectorFst output(composed);
-    fst::Connect(&output);
+    fst::StdVectorFst* input1 = fst::StdVectorFst::Read(inputs[0]);
+    if(!input1) return 1;
+    fst::StdVectorFst output;
+    ComposeSpecials(input1, model, nbest, &output);
     output.Write("");
 
-    delete symbolMap;
+    delete closure;
+    delete input1;
+    delete input2;
 }
@@ -13,7 +13,20 @@
 // Copyright 2012 Aix-Marseille Univ.
 // Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
 
+#include <chrono>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
 #include <fst/fstlib.h>
+#include <fst/extensions/far/far.h>
+
+#include "categorial-weight.h"
+#include "compact-categorial-weight.h"
+#include "interned-categorial-weight.h"
+#include "label-kernels.h"
+#include "packed-tclex-weight.h"
+#include "parallel.h"
+#include "parallel-determinize.h"
 
 namespace fst {
 
@@ -24,93 +37,34 @@ namespace fst {
      * Word Lattices usingCategorial and Lexicographic Semirings", by I.
      * Shafran et al, ASRU 2011
      *
-     * We use string weights as a base class and override plus and divide
-     * operator (should not be used with other string weight operations)
-     */
-    typedef StringWeight<int, STRING_LEFT> CategorialWeight;
-    typedef StringWeightIterator<CategorialWeight> CategorialWeightIterator;
-    typedef LexicographicWeight<TropicalWeight, CategorialWeight> TCLexWeight;
-    typedef LexicographicArc<TropicalWeight, CategorialWeight> TCLexArc;
-    typedef VectorFst<TCLexArc> TCLexFst;
-
-    /* define extra negative symbols to encode categorial weight special symbols */
-    const int kCategorialLeftBracket = -3;
-    const int kCategorialRightBracket = -4;
-    const int kCategorialLeftDiv = -5;
-
-    /* override the plus operator
-     * w1 + w2 = 
-     *      w1 if w1 <L w2 (lexicographic order on strings)
-     *      w2 else
-     */
-    template <> inline CategorialWeight Plus(const CategorialWeight &w1, const CategorialWeight &w2) {
-        if (w1 == CategorialWeight::Zero())
-            return w2;
-        if (w2 == CategorialWeight::Zero())
-            return w1;
-        CategorialWeightIterator iter1(w1);
-        CategorialWeightIterator iter2(w2);
-        for (; !iter1.Done() && !iter2.Done(); iter1.Next(), iter2.Next()) {
-            if(iter1.Value() < iter2.Value()) return w1;
-            else if(iter1.Value() > iter2.Value()) return w2;
-        }
-        if(!iter2.Done()) return w1;
-        return w2;
-    }
-
-    /* override the divide operator
-     * w1 / w2 = w2 "/" w1 (concatenation with "backslash" symbol)
-     * note: 
-     *      w1 / 0 = bad
-     *      0 / w2 = 0
-     *      w1 / w1 = One
-     *      do we need: (w1 "/" w2) * w1 = w2 ???
+     * The categorial weight representation is a template parameter: either
+     * CategorialWeight (label array) or InternedCategorialWeight (handle to
+     * a pooled string, constant time equality and hashing). The algorithms
+     * below are templated on the arc so that they also accept PackedTCLexArc
+     * (8-byte weights, trivially copyable arcs).
      */
-    template <> inline CategorialWeight Divide(const CategorialWeight &w1, const CategorialWeight &w2, DivideType typ) {
-        if (typ != DIVIDE_LEFT)
-            LOG(FATAL) << "CategorialWeight::Divide: only left division is defined "
-                << "for the " << CategorialWeight::Type() << " semiring";
-
-        if (w2 == CategorialWeight::Zero())
-            return CategorialWeight(kStringBad);
-        else if (w1 == CategorialWeight::Zero())
-            return CategorialWeight::Zero();
-
-        if(w1 == w2) return CategorialWeight::One();
-        CategorialWeight div;
-        CategorialWeightIterator iter1(w1);
-        CategorialWeightIterator iter2(w2);
-        bool needsBrackets = false;
-        for (; !iter2.Done(); iter2.Next()) {
-            if(iter2.Value() == kCategorialLeftDiv) {
-                needsBrackets = true;
-                break;
-            }
-        }
-        iter2.Reset();
-        if(needsBrackets) div.PushBack(kCategorialLeftBracket);
-        for (; !iter2.Done(); iter2.Next()) {
-            div.PushBack(iter2.Value());
-        }
-        if(needsBrackets) div.PushBack(kCategorialRightBracket);
-        div.PushBack(kCategorialLeftDiv);
-        for (; !iter1.Done(); iter1.Next()) {
-            div.PushBack(iter1.Value());
-        }
-        return div;
-    }
+    template <class C = CategorialWeight<int> >
+        using TCLexWeight = LexicographicWeight<TropicalWeight, C>;
+    template <class C = CategorialWeight<int> >
+        using TCLexArc = LexicographicArc<TropicalWeight, C>;
+    template <class C = CategorialWeight<int> >
+        using TCLexFst = VectorFst<TCLexArc<C> >;
 
-    /* Categorial semiring has the path property
+    /* categorial component of a TCLex weight
      */
-    template <> uint64 CategorialWeight::Properties() {
-        return kLeftSemiring | kIdempotent | kPath;
-    }
+    template <class W> struct TCLexCategorial {
+        typedef typename W::Categorial Type; // packed weights
+    };
+    template <class C> struct TCLexCategorial<LexicographicWeight<TropicalWeight, C> > {
+        typedef C Type;
+    };
 
     /* override the lexicographic weight in order to use a different ordering
      * <w1,w2> + <w3,w4> =
      *     <w1,w2> if w1 < w3 else
      *     <w3,w4> if w1 > w3 else
-     *     <w1,w2> if w2 <L w4 else (where <L is the lexicographic order over tag strings)
+     *     <w1,w2> if w2 <L w4 else (where <L is the lexicographic order over tag strings,
+     *                                read from their end in the right categorial semiring)
      *     <w3,w4>
      * here:
      * w + v =
@@ -119,30 +73,30 @@ namespace fst {
      *     w if w.value2 <L v.value2 else
      *     v
      */
-    template <> inline TCLexWeight Plus(const TCLexWeight &w, const TCLexWeight &v) {
+    template <class C> inline TCLexWeight<C> Plus(const TCLexWeight<C> &w, const TCLexWeight<C> &v) {
         NaturalLess<TropicalWeight> less1;
         if (less1(w.Value1(), v.Value1())) return w;
         if (less1(v.Value1(), w.Value1())) return v;
-        CategorialWeightIterator iter1(w.Value2());
-        CategorialWeightIterator iter2(v.Value2());
-        for (; !iter1.Done() && !iter2.Done(); iter1.Next(), iter2.Next()) {
-            if(iter1.Value() < iter2.Value()) return w;
-            else if(iter1.Value() > iter2.Value()) return v;
-        }
-        if(!iter2.Done()) return w;
+        const C &w2 = w.Value2();
+        const C &v2 = v.Value2();
+        if (w2 == v2) return v;  // a handle comparison for interned weights
+        if(CompareCategorial(w2, v2) < 0) return w;
         return v;
     }
 
     /* map a standard transducer to the TCLex semiring
     */
+    template <class A>
     struct ToTCLexMapper {
         typedef StdArc FromArc;
-        typedef TCLexArc ToArc;
-        TCLexArc operator()(const StdArc &arc) {
+        typedef A ToArc;
+        typedef typename A::Weight Weight;
+        typedef typename TCLexCategorial<Weight>::Type Categorial;
+        ToArc operator()(const StdArc &arc) {
             if(arc.weight == TropicalWeight::Zero()) {
-                return TCLexArc(arc.ilabel, arc.ilabel, TCLexWeight::Zero(), arc.nextstate);
+                return ToArc(arc.ilabel, arc.ilabel, Weight::Zero(), arc.nextstate);
             }
-            return TCLexArc(arc.ilabel, arc.ilabel, TCLexWeight(arc.weight, CategorialWeight(arc.olabel)), arc.nextstate);
+            return ToArc(arc.ilabel, arc.ilabel, Weight(arc.weight, Categorial(arc.olabel)), arc.nextstate);
         }
         MapFinalAction FinalAction() const { return MAP_NO_SUPERFINAL; }
         MapSymbolsAction InputSymbolsAction() const { return MAP_COPY_SYMBOLS; }
@@ -150,172 +104,592 @@ namespace fst {
         uint64 Properties(uint64 props) const { return props; }
     };
 
-    /* map TCLex fst to tropical semiring and generate symbol table
+    /* Expand the categorial weights of a determinized TCLex fst into output
+     * labels.
+     *
+     * A simple categorial string (without division) outputs its first
+     * label. A string "x1\x2\...\xk\y" (where xi can be a bracketed string)
+     * spans the k arcs which carry xk, ..., x1 and precede it on the path:
+     * these k+1 arcs output the labels of y, padded with epsilons or
+     * followed by epsilon input arcs when lengths differ. This is the
+     * transduction obtained by composing with a decoder over the string
+     * representation of the weights; it is computed here as a lazy product
+     * of the fst with the implicit decoder, on label sequences.
      */
-    class FromTCLexMapper {
-        SymbolTable &symbols;
+    template <class A>
+    class TCLexDecoder {
         public:
-        typedef TCLexArc FromArc;
-        typedef StdArc ToArc;
-        FromTCLexMapper(SymbolTable& syms) : symbols(syms) {
-            symbols.AddSymbol("<eps>", 0);
+        typedef A Arc;
+        typedef typename Arc::StateId StateId;
+        typedef typename TCLexCategorial<typename Arc::Weight>::Type Categorial;
+
+        explicit TCLexDecoder(const ExpandedFst<Arc> &fst) : fst_(fst) {
+            arc_symbols_.resize(fst_.NumStates());
+            for(StateId state = 0; state < fst_.NumStates(); state++) {
+                for(ArcIterator<ExpandedFst<Arc> > aiter(fst_, state); !aiter.Done(); aiter.Next()) {
+                    typename Categorial::Iterator iter(aiter.Value().weight.Value2());
+                    vector<int> labels;
+                    for(; !iter.Done(); iter.Next()) labels.push_back(iter.Value());
+                    arc_symbols_[state].push_back(AddSymbol(labels));
+                }
+            }
+            chains_by_input_.resize(symbols_.size());
+            for(size_t id = 0; id < symbols_.size(); id++) {
+                if(!symbols_[id].simple) AddChain(id);
+            }
         }
-        StdArc operator()(const TCLexArc &arc) {
-            int64 id = 0; // by default, it's a final state, so output label must be 0
-            if(arc.nextstate != kNoStateId) { // else
-                CategorialWeightIterator iter(arc.weight.Value2()); // serialize categorial weight
-                std::ostringstream label;
-                bool needSeparator = false;
-                for(; !iter.Done(); iter.Next()) {
-                    int value = iter.Value();
-                    if (value == kCategorialLeftBracket) {
-                        label << '<';
-                        needSeparator = false;
-                    } else if (value == kCategorialRightBracket) {
-                        label << '>';
-                        needSeparator = false;
-                    } else if (value == kCategorialLeftDiv) {
-                        label << '\\';
-                        needSeparator = false;
-                    } else {
-                        if(needSeparator) label << "_";
-                        label << value;
-                        needSeparator = true;
+
+        void Decode(StdVectorFst *result) {
+            result->DeleteStates();
+            result->SetInputSymbols(fst_.InputSymbols());
+            if(fst_.Start() == kNoStateId) return;
+            states_.clear();
+            queue_.clear();
+            result->SetStart(FindState(result, DecoderState(fst_.Start(), -1, 0)));
+            for(size_t next = 0; next < queue_.size(); next++) {
+                DecoderState current = queue_[next];
+                StdArc::StateId from = states_[current];
+                const Chain *chain = current.chain >= 0 ? &chains_[current.chain] : 0;
+                if(chain && current.position >= chain->inputs.size()) {
+                    // epsilon input arcs after the last input of a chain
+                    result->AddArc(from, StdArc(0, chain->outputs[current.position], TropicalWeight::One(),
+                                FindState(result, NextState(current.state, current.chain, current.position))));
+                    continue;
+                }
+                if(!chain) result->SetFinal(from, fst_.Final(current.state).Value1());
+                size_t arc_index = 0;
+                for(ArcIterator<ExpandedFst<Arc> > aiter(fst_, current.state); !aiter.Done(); aiter.Next(), arc_index++) {
+                    const Arc &arc = aiter.Value();
+                    int symbol = arc_symbols_[current.state][arc_index];
+                    if(chain) {
+                        if(chain->inputs[current.position] == symbol)
+                            AddChainArc(result, from, arc, current.chain, current.position);
+                        continue;
                     }
+                    if(symbols_[symbol].simple) {
+                        result->AddArc(from, StdArc(arc.ilabel, symbols_[symbol].output, arc.weight.Value1(),
+                                    FindState(result, DecoderState(arc.nextstate, -1, 0))));
+                    }
+                    const vector<int> &chains = chains_by_input_[symbol];
+                    for(size_t i = 0; i < chains.size(); i++)
+                        AddChainArc(result, from, arc, chains[i], 0);
                 }
-                id = symbols.AddSymbol(label.str());
             }
-            return StdArc(arc.ilabel, id, arc.weight.Value1(), arc.nextstate);
+            Connect(result);
         }
-        MapFinalAction FinalAction() const { return MAP_NO_SUPERFINAL; }
-        MapSymbolsAction InputSymbolsAction() const { return MAP_COPY_SYMBOLS; }
-        MapSymbolsAction OutputSymbolsAction() const { return MAP_NOOP_SYMBOLS; }
-        uint64 Properties(uint64 props) const { return props; }
-    };
 
-    /* Utility methods to tackle serialized TCLex weights
-     */
-    bool IsSimple(const std::string &input) {
-        if(string::npos != input.find_first_of("\\<>")) return false;
-        return true;
-    }
+        private:
+        struct Symbol {
+            vector<int> labels;
+            bool simple;   // no division
+            int output;    // output label of simple strings
+        };
 
-    void SplitOnUnderscores(const std::string &input, std::vector<std::string>& tokens) {
-        size_t start = 0;
-        size_t end = 0;
-        while(end < input.length()) {
-            start = end;
-            while(end < input.length() && input[end] != '_') {
-                end++;
+        // Sequence of symbols consumed by a string with divisions, and the
+        // labels it outputs.
+        struct Chain {
+            vector<int> inputs;
+            vector<int> outputs;
+            size_t length;
+        };
+
+        // Position in the product of the fst and the implicit decoder.
+        struct DecoderState {
+            StateId state;
+            int chain;        // -1 if not inside a chain
+            size_t position;  // number of chain steps already done
+            DecoderState(StateId s, int c, size_t p) : state(s), chain(c), position(p) {}
+            bool operator==(const DecoderState &other) const {
+                return state == other.state && chain == other.chain && position == other.position;
             }
-            tokens.push_back(input.substr(start, end - start));
-            end++;
+        };
+
+        struct DecoderStateHash {
+            size_t operator()(const DecoderState &s) const {
+                return (static_cast<size_t>(s.state) * 7853) ^ (static_cast<size_t>(s.chain) * 7867) ^ s.position;
+            }
+        };
+
+        struct LabelsHash {
+            size_t operator()(const vector<int> &labels) const {
+                return HashLabelString(labels.data(), labels.size());
+            }
+        };
+
+        static bool IsSpecial(int label) {
+            return label == kCategorialLeftBracket || label == kCategorialRightBracket || label == kCategorialLeftDiv;
+        }
+
+        int AddSymbol(const vector<int> &labels) {
+            typename std::unordered_map<vector<int>, int, LabelsHash>::iterator found = symbol_ids_.find(labels);
+            if(found != symbol_ids_.end()) return found->second;
+            Symbol symbol;
+            symbol.labels = labels;
+            symbol.simple = std::find_if(labels.begin(), labels.end(), IsSpecial) == labels.end();
+            symbol.output = labels.empty() ? 0 : labels[0];
+            symbols_.push_back(symbol);
+            symbol_ids_[labels] = symbols_.size() - 1;
+            return symbols_.size() - 1;
         }
-    }
 
-    void SplitOnSlashes(const std::string &input, std::vector<std::string>& tokens) {
-        size_t start = 0;
-        size_t end = 0;
-        while(end < input.length()) {
-            start = end;
-            if(input[end] == '<') {
-                int num = 1;
-                while(num > 0 && end < input.length() - 1) {
+        // Splits on top-level divisions and removes brackets around divisors.
+        // A trailing empty part is dropped.
+        static void SplitOnDivisions(const vector<int> &labels, vector<vector<int> > &parts) {
+            size_t start = 0;
+            size_t end = 0;
+            while(end < labels.size()) {
+                start = end;
+                if(labels[end] == kCategorialLeftBracket) {
+                    int num = 1;
+                    while(num > 0 && end < labels.size() - 1) {
+                        end++;
+                        if(labels[end] == kCategorialRightBracket) num--;
+                        else if(labels[end] == kCategorialLeftBracket) num++;
+                    }
+                }
+                while(end < labels.size() && labels[end] != kCategorialLeftDiv) {
                     end++;
-                    if(input[end] == '>') num--;
-                    else if(input[end] == '<') num++;
                 }
-            }
-            while(end < input.length() && input[end] != '\\') {
+                if(labels[start] == kCategorialLeftBracket)
+                    parts.push_back(vector<int>(labels.begin() + start + 1, labels.begin() + end - 1));
+                else
+                    parts.push_back(vector<int>(labels.begin() + start, labels.begin() + end));
                 end++;
             }
-            if(input[start] == '<')
-                tokens.push_back(input.substr(start + 1, end - start - 2));
-            else
-                tokens.push_back(input.substr(start, end - start));
-            end++;
         }
-    }
 
-    /* Generate a transducer that when composed with the determinized automaton will
-     * result in the final output (by decomposing the weights)
+        void AddChain(int id) {
+            vector<vector<int> > parts;
+            SplitOnDivisions(symbols_[id].labels, parts);
+            Chain chain;
+            chain.outputs = parts.back();
+            parts.pop_back();
+            for(size_t i = parts.size(); i > 0; i--) {
+                typename std::unordered_map<vector<int>, int, LabelsHash>::const_iterator found = symbol_ids_.find(parts[i - 1]);
+                if(found == symbol_ids_.end()) return; // never on an arc, the chain cannot match
+                chain.inputs.push_back(found->second);
+            }
+            chain.inputs.push_back(id);
+            chain.length = std::max(chain.inputs.size(), chain.outputs.size());
+            chains_by_input_[chain.inputs[0]].push_back(chains_.size());
+            chains_.push_back(chain);
+        }
+
+        DecoderState NextState(StateId state, int chain, size_t position) const {
+            if(position + 1 == chains_[chain].length) return DecoderState(state, -1, 0);
+            return DecoderState(state, chain, position + 1);
+        }
+
+        void AddChainArc(StdVectorFst *result, StdArc::StateId from, const Arc &arc, int chain, size_t position) {
+            const vector<int> &outputs = chains_[chain].outputs;
+            int olabel = position < outputs.size() ? outputs[position] : 0;
+            result->AddArc(from, StdArc(arc.ilabel, olabel, arc.weight.Value1(),
+                        FindState(result, NextState(arc.nextstate, chain, position))));
+        }
+
+        StdArc::StateId FindState(StdVectorFst *result, const DecoderState &state) {
+            typename std::unordered_map<DecoderState, StdArc::StateId, DecoderStateHash>::iterator found = states_.find(state);
+            if(found != states_.end()) return found->second;
+            StdArc::StateId id = result->AddState();
+            states_[state] = id;
+            queue_.push_back(state);
+            return id;
+        }
+
+        const ExpandedFst<Arc> &fst_;
+        vector<vector<int> > arc_symbols_;                   // symbol of each arc
+        vector<Symbol> symbols_;                             // distinct categorial strings
+        std::unordered_map<vector<int>, int, LabelsHash> symbol_ids_;
+        vector<Chain> chains_;
+        vector<vector<int> > chains_by_input_;               // chains starting with each symbol
+        std::unordered_map<DecoderState, StdArc::StateId, DecoderStateHash> states_;
+        vector<DecoderState> queue_;
+    };
+
+    /* Options of the TCLex determinization. Limits are disabled by default,
+     * which runs the exact, unbounded Determinize().
      */
-    void BuildPathDecoder(StdVectorFst& output, const SymbolTable& TCLexSymbols) {
-        output.AddState();
-        output.SetStart(0);
-        output.SetFinal(0, TropicalWeight::One());
-        SymbolTableIterator iter(TCLexSymbols);
-        for(; !iter.Done(); iter.Next()) {
-            if(iter.Value() == 0) continue; // skip epsilon
-            std::string symbol = iter.Symbol();
-            if(IsSimple(symbol)) {
-                int64 label = atoi(symbol.c_str());
-                output.AddArc(0, StdArc(iter.Value(), label, 0, 0));
-            } else {
-                std::vector<std::string> arcsInput;
-                std::vector<std::string> arcsOutput;
-                SplitOnSlashes(symbol, arcsInput);
-                SplitOnUnderscores(arcsInput.back(), arcsOutput);
-                arcsInput.pop_back();
-                reverse(arcsInput.begin(), arcsInput.end());
-                arcsInput.push_back(symbol);
-                size_t max = arcsInput.size();
-                if(max < arcsOutput.size()) max = arcsOutput.size();
-                int fromState = 0, nextState = 0;
-                for(size_t i = 0; i < max; i++) {
-                    int64 ilabel = 0;
-                    int64 olabel = 0;
-                    if(i < arcsInput.size()) ilabel = TCLexSymbols.Find(arcsInput[i]);
-                    if(i < arcsOutput.size()) olabel = atoi(arcsOutput[i].c_str());
-                    if(i == max - 1) {
-                        nextState = 0;
-                    } else {
-                        nextState = output.NumStates();
-                        output.AddState();
+    struct TCLexDeterminizeOptions {
+        bool interned;          // use InternedCategorialWeight
+        bool packed;            // use PackedTCLexArc
+        float beam;             // prune input paths worse than best + beam (< 0: no pruning)
+        int64 max_states;       // maximum number of determinized states (< 0: no limit)
+        size_t max_residual;    // drop arcs with longer categorial weights (0: no limit)
+        bool reverse;           // determinize the reversed lattice first
+        bool auto_reverse;      // reverse when the lattice branches less backwards
+        std::string tclex_out;  // also save the determinized TCLex fst (compact weights) to this file
+        int threads;            // threads of the subset construction of one lattice
+
+        TCLexDeterminizeOptions() : interned(false), packed(false), beam(-1), max_states(-1), max_residual(0),
+            reverse(false), auto_reverse(false), threads(1) {}
+
+        bool Bounded() const { return max_states >= 0 || max_residual > 0; }
+    };
+
+    /* What was removed to respect the limits of TCLexDeterminizeOptions
+     */
+    struct TCLexPruneStats {
+        int64 beam_arcs;        // input arcs removed by the beam
+        int64 pruned_states;    // determinized states not created because of max_states
+        int64 residual_arcs;    // determinized arcs removed because of max_residual
+        bool best_path;         // nothing survived, only the best path was kept
+
+        TCLexPruneStats() : beam_arcs(0), pruned_states(0), residual_arcs(0), best_path(false) {}
+    };
+
+    /* Determinization with bounded memory: states of the lazy DeterminizeFst
+     * are expanded best first (by tropical distance from the start), no new
+     * state is created past max_states, and arcs whose categorial weight
+     * (which carries the residual of the subset) is longer than max_residual
+     * are dropped. The best paths are thus kept when the subset construction
+     * blows up; dead ends are trimmed by Connect().
+     */
+    template <class Arc>
+    void BoundedDeterminize(const Fst<Arc> &ifst, MutableFst<Arc> *ofst,
+            const TCLexDeterminizeOptions &opts, TCLexPruneStats *stats) {
+        typedef typename Arc::StateId StateId;
+        typedef std::pair<float, StateId> Entry; // distance from start, lazy state
+
+        DeterminizeFst<Arc> lazy(ifst);
+        ofst->DeleteStates();
+        ofst->SetInputSymbols(ifst.InputSymbols());
+        ofst->SetOutputSymbols(ifst.OutputSymbols());
+        StateId start = lazy.Start();
+        if(start == kNoStateId) return;
+
+        std::unordered_map<StateId, StateId> ids;      // lazy state -> output state
+        std::unordered_map<StateId, float> distance;
+        std::unordered_set<StateId> expanded;
+        std::unordered_set<StateId> pruned;
+        std::priority_queue<Entry, vector<Entry>, std::greater<Entry> > queue;
+
+        ids[start] = ofst->AddState();
+        ofst->SetStart(ids[start]);
+        distance[start] = 0;
+        queue.push(Entry(0, start));
+        while(!queue.empty()) {
+            Entry top = queue.top();
+            queue.pop();
+            StateId state = top.second;
+            if(top.first > distance[state] || !expanded.insert(state).second) continue;
+            ofst->SetFinal(ids[state], lazy.Final(state));
+            for(ArcIterator<DeterminizeFst<Arc> > aiter(lazy, state); !aiter.Done(); aiter.Next()) {
+                const Arc &arc = aiter.Value();
+                if(opts.max_residual > 0 && arc.weight.Value2().Size() > opts.max_residual) {
+                    stats->residual_arcs++;
+                    continue;
+                }
+                float next_distance = top.first + arc.weight.Value1().Value();
+                typename std::unordered_map<StateId, StateId>::iterator found = ids.find(arc.nextstate);
+                if(found == ids.end()) {
+                    if(opts.max_states >= 0 && ofst->NumStates() >= opts.max_states) {
+                        pruned.insert(arc.nextstate);
+                        continue;
                     }
-                    output.AddArc(fromState, StdArc(ilabel, olabel, 0, nextState));
-                    fromState = nextState;
+                    found = ids.insert(std::make_pair(arc.nextstate, ofst->AddState())).first;
+                    distance[arc.nextstate] = next_distance;
+                    queue.push(Entry(next_distance, arc.nextstate));
+                } else if(next_distance < distance[arc.nextstate]) {
+                    distance[arc.nextstate] = next_distance;
+                    queue.push(Entry(next_distance, arc.nextstate));
                 }
+                ofst->AddArc(ids[state], Arc(arc.ilabel, arc.olabel, arc.weight, found->second));
             }
         }
-        ArcSort(&output, ILabelCompare<StdArc>()); // ready for composition
+        stats->pruned_states += pruned.size();
+        Connect(ofst);
     }
 
 }
 
 using namespace fst;
 
-int main(int argc, char** argv) {
-    // read transducer from stdin
-    StdVectorFst *input = StdVectorFst::Read("");
+int64 CountArcs(const StdVectorFst &fst) {
+    int64 num_arcs = 0;
+    for(int64 state = 0; state < fst.NumStates(); state++)
+        num_arcs += fst.NumArcs(state);
+    return num_arcs;
+}
 
-    // for determinization, we need an epsilon-free fst
-    if(input->Properties(kEpsilons, true)) RmEpsilon(input);
+template <class Arc>
+void DeterminizeTCLex(const StdVectorFst &input, const TCLexDeterminizeOptions &opts,
+        StdVectorFst *result, TCLexPruneStats *stats) {
+    // prune input paths out of the beam of the best path
+    StdVectorFst pruned;
+    const StdVectorFst *source = &input;
+    if(opts.beam >= 0) {
+        Prune(input, &pruned, opts.beam);
+        stats->beam_arcs += CountArcs(input) - CountArcs(pruned);
+        source = &pruned;
+    }
 
     // convert olabel+weights to TCLex weights
-    TCLexFst converted;
-    ArcMap(*input, &converted, ToTCLexMapper());
+    VectorFst<Arc> converted;
+    ArcMap(*source, &converted, ToTCLexMapper<Arc>());
 
     // determinize
-    TCLexFst determinized;
-    Determinize(converted, &determinized);
-
-    // map from TCLex semiring to tropical with string representation as output
-    SymbolTable symbols("tclex");
-    FromTCLexMapper mapper(symbols);
-    StdVectorFst back_to_syms;
-    ArcMap(determinized, &back_to_syms, &mapper);
-
-    // create decoder for string representation of TCLex weights
-    StdVectorFst decoder;
-    BuildPathDecoder(decoder, symbols);
-    
-    // compose to generate final automaton 
+    VectorFst<Arc> determinized;
+    if(opts.Bounded()) BoundedDeterminize<Arc>(converted, &determinized, opts, stats);
+    else if(opts.threads > 1) ParallelDeterminize(converted, &determinized, opts.threads);
+    else Determinize(converted, &determinized);
+
+    // if limits removed every path, keep the best one which is deterministic
+    if(determinized.Start() == kNoStateId && source->Start() != kNoStateId) {
+        StdVectorFst best;
+        ShortestPath(*source, &best, 1);
+        ArcMap(best, &converted, ToTCLexMapper<Arc>());
+        Determinize(converted, &determinized);
+        stats->best_path = true;
+    }
+
+    // cache the determinized lattice before decoding
+    if(!opts.tclex_out.empty()) {
+        determinized.SetOutputSymbols(input.OutputSymbols());
+        determinized.Write(opts.tclex_out);
+    }
+
+    // expand TCLex weights to output labels in the tropical semiring
+    TCLexDecoder<Arc> decoder(determinized);
+    decoder.Decode(result);
+    result->SetOutputSymbols(input.OutputSymbols());
+}
+
+/* Nondeterminism of an epsilon-free lattice read forwards or backwards:
+ * number of arcs leaving (resp. entering) a state with an input label
+ * already seen there. Backwards, the final states are also the targets of
+ * the super-initial state added by Reverse().
+ */
+bool BranchesLessBackwards(const StdVectorFst &fst) {
+    int64 forward = 0, backward = -1;
+    std::unordered_set<uint64> entering;
+    for(StdArc::StateId state = 0; state < fst.NumStates(); state++) {
+        std::unordered_set<StdArc::Label> leaving;
+        for(ArcIterator<StdVectorFst> aiter(fst, state); !aiter.Done(); aiter.Next()) {
+            const StdArc &arc = aiter.Value();
+            if(!leaving.insert(arc.ilabel).second) forward++;
+            uint64 key = (static_cast<uint64>(arc.nextstate) << 32) | static_cast<uint32>(arc.ilabel);
+            if(!entering.insert(key).second) backward++;
+        }
+        if(fst.Final(state) != TropicalWeight::Zero()) backward++;
+    }
+    return backward < forward;
+}
+
+void DeterminizeForward(const StdVectorFst &input, const TCLexDeterminizeOptions &opts,
+        StdVectorFst *result, TCLexPruneStats *stats) {
+    if(!opts.tclex_out.empty()) {
+        DeterminizeTCLex<TCLexArc<CompactCategorialWeight<int> > >(input, opts, result, stats);
+    } else if(opts.threads > 1 && !opts.Bounded()) {
+        // the string pool of interned weights is per thread
+        DeterminizeTCLex<TCLexArc<CategorialWeight<int> > >(input, opts, result, stats);
+    } else if(opts.packed) {
+        DeterminizeTCLex<PackedTCLexArc<int> >(input, opts, result, stats);
+    } else if(opts.interned) {
+        DeterminizeTCLex<TCLexArc<InternedCategorialWeight<int> > >(input, opts, result, stats);
+    } else {
+        DeterminizeTCLex<TCLexArc<CategorialWeight<int> > >(input, opts, result, stats);
+    }
+    // the result only holds labels: release the strings of this lattice
+    if(opts.packed || opts.interned) CategorialStringPool<int>::Pool().Clear();
+}
+
+/* Determinization in the right (tropical, categorial) semiring, which
+ * merges shared suffixes: the subset construction runs on the reversed
+ * lattice, with tag strings kept in the order of the original paths and
+ * factored on the right. The result has a single tag string per word
+ * sequence and is deterministic when read backwards (not forwards).
+ * Plain categorial weights are used; the subsets are expanded on
+ * opts.threads threads.
+ */
+void DeterminizeReverse(const StdVectorFst &input, const TCLexDeterminizeOptions &opts,
+        StdVectorFst *result, TCLexPruneStats *stats) {
+    typedef TCLexArc<CategorialWeight<int, CATEGORIAL_RIGHT> > RightArc;
+    typedef TCLexArc<CategorialWeight<int> > LeftArc;
+
+    StdVectorFst pruned;
+    const StdVectorFst *source = &input;
+    if(opts.beam >= 0) {
+        Prune(input, &pruned, opts.beam);
+        stats->beam_arcs += CountArcs(input) - CountArcs(pruned);
+        source = &pruned;
+    }
+    StdVectorFst reversed;
+    Reverse(*source, &reversed);
+    RmEpsilon(&reversed);
+    VectorFst<RightArc> converted;
+    ArcMap(reversed, &converted, ToTCLexMapper<RightArc>());
+    VectorFst<RightArc> determinized;
+    ParallelDeterminize(converted, &determinized, std::max(opts.threads, 1));
+
+    // reversed strings read in the order of the reversed lattice, with
+    // right divisions turned into left ones, which the decoder expands
+    VectorFst<LeftArc> backward;
+    ArcMap(determinized, &backward, ReverseWeightMapper<RightArc, LeftArc>());
+    StdVectorFst decoded;
+    TCLexDecoder<LeftArc> decoder(backward);
+    decoder.Decode(&decoded);
+    Reverse(decoded, result);
+    RmEpsilon(result);
+    result->SetOutputSymbols(input.OutputSymbols());
+}
+
+/* Determinize one lattice with the categorial representation from the
+ * options, or in the right semiring when reversing.
+ * Returns true if the lattice was determinized in reverse.
+ */
+bool DeterminizeLattice(StdVectorFst *input, const TCLexDeterminizeOptions &opts,
+        StdVectorFst *result, TCLexPruneStats *stats) {
+    // for determinization, we need an epsilon-free fst
+    if(input->Properties(kEpsilons, true)) RmEpsilon(input);
+
+    bool reverse = opts.reverse || (opts.auto_reverse && BranchesLessBackwards(*input));
+    if(!reverse) {
+        DeterminizeForward(*input, opts, result, stats);
+        return false;
+    }
+    DeterminizeReverse(*input, opts, result, stats);
+    return true;
+}
+
+void PrintPruneStats(const TCLexPruneStats &stats) {
+    std::cerr << "pruned: " << stats.beam_arcs << " input arcs (beam), "
+        << stats.pruned_states << " states (max-states), "
+        << stats.residual_arcs << " arcs (max-residual)";
+    if(stats.best_path) std::cerr << ", kept best path only";
+}
+
+/* Batch mode: determinize every lattice of an archive on a pool of worker
+ * threads and write the results in input order, reporting per-lattice wall
+ * time and number of states on stderr.
+ */
+int DeterminizeArchive(const std::string &input_name, const std::string &output_name,
+        const TCLexDeterminizeOptions &opts, int jobs) {
+    FarReader<StdArc> *reader = FarReader<StdArc>::Open(input_name);
+    if(!reader) {
+        std::cerr << "error: cannot read archive " << input_name << "\n";
+        return 1;
+    }
+    FarWriter<StdArc> *writer = FarWriter<StdArc>::Create(output_name);
+    if(!writer) {
+        std::cerr << "error: cannot create archive " << output_name << "\n";
+        delete reader;
+        return 1;
+    }
+
+    // lattices are read by batches to bound memory
+    const size_t batch_size = 4 * std::max(jobs, 1);
+    while(!reader->Done()) {
+        vector<std::string> keys;
+        vector<StdVectorFst *> lattices;
+        for(; !reader->Done() && keys.size() < batch_size; reader->Next()) {
+            keys.push_back(reader->GetKey());
+            lattices.push_back(new StdVectorFst(reader->GetFst()));
+        }
+        vector<StdVectorFst> results(lattices.size());
+        vector<TCLexPruneStats> stats(lattices.size());
+        vector<int64> states_in(lattices.size());
+        vector<double> milliseconds(lattices.size());
+        vector<bool> reversed(lattices.size());
+        ParallelFor(lattices.size(), jobs, [&](size_t i) {
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            states_in[i] = lattices[i]->NumStates();
+            reversed[i] = DeterminizeLattice(lattices[i], opts, &results[i], &stats[i]);
+            delete lattices[i];
+            milliseconds[i] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        });
+        for(size_t i = 0; i < results.size(); i++) {
+            writer->Add(keys[i], results[i]);
+            std::cerr << keys[i] << "\t" << milliseconds[i] << " ms\t"
+                << states_in[i] << " -> " << results[i].NumStates() << " states";
+            if(reversed[i]) std::cerr << " (reverse)";
+            if(opts.beam >= 0 || opts.Bounded()) {
+                std::cerr << "\t";
+                PrintPruneStats(stats[i]);
+            }
+            std::cerr << "\n";
+        }
+    }
+    delete writer;
+    delete reader;
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    TCLexDeterminizeOptions opts;
+    int jobs = 1;
+    vector<std::string> archives;
+    std::string tclex_in;
+    bool usage = false;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--interned") {
+            opts.interned = true;
+        } else if(arg == "--packed") {
+            opts.packed = true;
+        } else if(arg == "--beam" && i + 1 < argc) {
+            opts.beam = atof(argv[++i]);
+        } else if(arg == "--max-states" && i + 1 < argc) {
+            opts.max_states = atoll(argv[++i]);
+        } else if(arg == "--max-residual" && i + 1 < argc) {
+            opts.max_residual = atoi(argv[++i]);
+        } else if(arg == "--reverse") {
+            opts.reverse = true;
+        } else if(arg == "--auto-reverse") {
+            opts.auto_reverse = true;
+        } else if(arg == "--tclex-out" && i + 1 < argc) {
+            opts.tclex_out = argv[++i];
+        } else if(arg == "--tclex-in" && i + 1 < argc) {
+            tclex_in = argv[++i];
+        } else if(arg == "--threads" && i + 1 < argc) {
+            opts.threads = atoi(argv[++i]);
+        } else if(arg == "--jobs" && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if(arg.size() > 0 && arg[0] != '-') {
+            archives.push_back(arg);
+        } else {
+            usage = true;
+        }
+    }
+    // the limits and the saved lattice belong to the forward determinization
+    bool reverse_conflict = (opts.reverse || opts.auto_reverse) && (opts.Bounded() || !opts.tclex_out.empty());
+    if(usage || reverse_conflict || (archives.size() != 0 && archives.size() != 2) ||
+            (archives.size() > 0 && (!opts.tclex_out.empty() || !tclex_in.empty()))) {
+        std::cerr << "usage: cat <fst> | " << argv[0] << " [options]\n"
+            << "       " << argv[0] << " [options] [--jobs <n>] <input.far> <output.far>\n"
+            << "options: [--interned] [--packed] [--beam <weight>] [--max-states <n>] [--max-residual <length>]\n"
+            << "         [--reverse] [--auto-reverse] [--tclex-out <file>] [--threads <n>]\n"
+            << "       " << argv[0] << " --tclex-in <file>\n"
+            << "--reverse and --auto-reverse cannot be used with --max-states, --max-residual or --tclex-out\n";
+        return 1;
+    }
+    if(archives.size() == 2) return DeterminizeArchive(archives[0], archives[1], opts, jobs);
+
+    // decode a determinized lattice saved with --tclex-out
+    if(!tclex_in.empty()) {
+        typedef TCLexArc<CompactCategorialWeight<int> > CompactArc;
+        VectorFst<CompactArc> *determinized = VectorFst<CompactArc>::Read(tclex_in);
+        if(!determinized) return 1;
+        StdVectorFst result;
+        TCLexDecoder<CompactArc> decoder(*determinized);
+        decoder.Decode(&result);
+        result.SetOutputSymbols(determinized->OutputSymbols());
+        delete determinized;
+        result.Write("");
+        return 0;
+    }
+
+    // read transducer from stdin
+    StdVectorFst *input = StdVectorFst::Read("");
+
     StdVectorFst result;
-    Compose(back_to_syms, decoder, &result);
-    result.SetOutputSymbols(input->OutputSymbols());
+    TCLexPruneStats stats;
+    DeterminizeLattice(input, opts, &result, &stats);
+
+    if(opts.beam >= 0 || opts.Bounded()) {
+        PrintPruneStats(stats);
+        std::cerr << "\n";
+    }
 
     // write result to stdout
     result.Write("");
 }
-
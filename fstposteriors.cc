@@ -1,27 +1,236 @@
 #include <iostream>
 #include <vector>
+#include <map>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <limits>
 #include <fst/fstlib.h>
+#include <fst/extensions/far/far.h>
 
-int main(int argc, char** argv) {
-    fst::StdVectorFst* old = fst::StdVectorFst::Read("");
-    fst::VectorFst<fst::LogArc> input;
-    fst::Map(*old, &input, fst::StdToLogMapper());
-    int numStates = input.NumStates();
+#include "parallel.h"
+#include "posteriors.h"
+#include "text-writer.h"
+
+bool ByDecreasingPosterior(const std::pair<int, double> &a, const std::pair<int, double> &b) {
+    return a.second > b.second;
+}
+
+/* one line per position, with label:posterior pairs by decreasing posterior */
+void WriteSausageText(const fst::Sausage &sausage, const fst::SymbolTable *symbols) {
+    fst::SymbolStrings strings(symbols);
+    fst::TextWriter writer(std::cout);
+    for(size_t bin = 0; bin < sausage.size(); bin++) {
+        std::vector<std::pair<int, double> > entries(sausage[bin].begin(), sausage[bin].end());
+        std::sort(entries.begin(), entries.end(), ByDecreasingPosterior);
+        for(size_t i = 0; i < entries.size(); i++) {
+            if(i > 0) writer.Append(' ');
+            writer.AppendSymbol(strings, entries[i].first).Append(':').AppendDouble(entries[i].second);
+        }
+        writer.Append('\n');
+    }
+}
+
+/* linear fst with one arc per label of each position, weighted by -log(posterior) */
+void WriteSausageFst(const fst::Sausage &sausage, const fst::SymbolTable *symbols) {
+    fst::StdVectorFst output;
+    output.SetStart(output.AddState());
+    for(size_t bin = 0; bin < sausage.size(); bin++) {
+        int next = output.AddState();
+        for(std::map<int, double>::const_iterator i = sausage[bin].begin(); i != sausage[bin].end(); i++)
+            output.AddArc(bin, fst::StdArc(i->first, i->first, -log(i->second), next));
+    }
+    output.SetFinal(output.NumStates() - 1, fst::TropicalWeight::One());
+    output.SetInputSymbols(symbols);
+    output.SetOutputSymbols(symbols);
+    output.Write("");
+}
+
+/* minimum Bayes risk hypothesis and its expected number of word errors */
+struct MbrResult {
+    std::vector<int> labels;
+    double error;
+    MbrResult() : error(0) {}
+};
+
+/* confusion network approximation: best label of each position */
+void SausageMbr(const fst::Sausage &sausage, MbrResult *result) {
+    for(size_t bin = 0; bin < sausage.size(); bin++) {
+        std::map<int, double>::const_iterator best = sausage[bin].begin();
+        for(std::map<int, double>::const_iterator i = sausage[bin].begin(); i != sausage[bin].end(); i++)
+            if(i->second > best->second) best = i;
+        if(best == sausage[bin].end()) continue;
+        if(best->first != 0) result->labels.push_back(best->first);
+        result->error += 1 - best->second;
+    }
+}
+
+/* path of the lattice (arcs holding posteriors) which maximizes the sum of
+ * 2 * posterior - 1 over its words, i.e. minimizes its expected number of
+ * errors against the lattice: length + expected length - 2 * sum(posteriors)
+ */
+void PathMbr(const fst::StdVectorFst &lattice, const std::vector<int> &order, MbrResult *result) {
+    const double infinity = std::numeric_limits<double>::infinity();
+    int numStates = lattice.NumStates();
+    std::vector<double> score(numStates, -infinity);
+    std::vector<int> previousState(numStates, -1);
+    std::vector<int> previousLabel(numStates, 0);
+    double expectedLength = 0;
+    score[lattice.Start()] = 0;
+    int best = -1;
+    double bestScore = -infinity;
+    for(int i = 0; i < numStates; i++) {
+        int state = order[i];
+        if(score[state] == -infinity) continue;
+        if(lattice.Final(state) != fst::TropicalWeight::Zero() && score[state] > bestScore) {
+            best = state;
+            bestScore = score[state];
+        }
+        for(fst::ArcIterator<fst::StdVectorFst> aiter(lattice, state); !aiter.Done(); aiter.Next()) {
+            const fst::StdArc &arc = aiter.Value();
+            double posterior = arc.weight.Value();
+            if(arc.ilabel != 0) expectedLength += posterior;
+            double next = score[state] + (arc.ilabel != 0 ? 2 * posterior - 1 : 0);
+            if(next > score[arc.nextstate]) {
+                score[arc.nextstate] = next;
+                previousState[arc.nextstate] = state;
+                previousLabel[arc.nextstate] = arc.ilabel;
+            }
+        }
+    }
+    if(best == -1) return;
+    for(int state = best; previousState[state] != -1; state = previousState[state])
+        if(previousLabel[state] != 0) result->labels.push_back(previousLabel[state]);
+    std::reverse(result->labels.begin(), result->labels.end());
+    result->error = expectedLength - bestScore;
+}
 
-    std::vector<fst::LogArc::Weight> alpha(numStates, 0);
-    std::vector<fst::LogArc::Weight> beta(numStates, 0);
+/* posteriors then MBR hypothesis of a lattice; false if it has cycles */
+bool DecodeMbr(fst::StdVectorFst *lattice, const std::string &mode, MbrResult *result) {
+    if(lattice->Start() == fst::kNoStateId) return true;
+    std::vector<int> order;
+    if(!fst::TopologicalOrder(*lattice, &order)) return false;
+    fst::Sausage sausage;
+    fst::AcyclicPosteriors(lattice, order, mode == "sausage" ? &sausage : NULL);
+    if(mode == "sausage") SausageMbr(sausage, result);
+    else PathMbr(*lattice, order, result);
+    return true;
+}
+
+/* expected error, then words */
+void WriteMbr(const MbrResult &result, const fst::SymbolStrings &symbols, fst::TextWriter *writer) {
+    writer->AppendDouble(result.error);
+    for(size_t i = 0; i < result.labels.size(); i++)
+        writer->Append(' ').AppendSymbol(symbols, result.labels[i]);
+}
+
+/* batch mode: MBR hypothesis of every lattice of an archive, computed on a
+ * pool of threads and printed as key<tab>error words, in input order; the
+ * symbols are copied again only when a lattice has a different table
+ */
+int DecodeArchive(const std::string &inputName, const std::string &mode, int jobs) {
+    fst::FarReader<fst::StdArc> *reader = fst::FarReader<fst::StdArc>::Open(inputName);
+    if(!reader) {
+        std::cerr << "error: cannot read archive " << inputName << "\n";
+        return 1;
+    }
+    const size_t batchSize = 4 * std::max(jobs, 1);
+    fst::TextWriter writer(std::cout);
+    fst::SymbolStrings *strings = NULL;
+    std::string checksum;       // of the symbols of strings
+    while(!reader->Done()) {
+        std::vector<std::string> keys;
+        std::vector<fst::StdVectorFst *> lattices;
+        for(; !reader->Done() && keys.size() < batchSize; reader->Next()) {
+            keys.push_back(reader->GetKey());
+            lattices.push_back(new fst::StdVectorFst(reader->GetFst()));
+        }
+        std::vector<MbrResult> results(lattices.size());
+        std::vector<char> decoded(lattices.size());
+        fst::ParallelFor(lattices.size(), jobs, [&](size_t i) {
+            decoded[i] = DecodeMbr(lattices[i], mode, &results[i]);
+            if(lattices[i]->InputSymbols()) lattices[i]->InputSymbols()->LabeledCheckSum();
+        });
+        for(size_t i = 0; i < lattices.size(); i++) {
+            writer.Append(keys[i]).Append('\t');
+            if(decoded[i]) {
+                const fst::SymbolTable *symbols = lattices[i]->InputSymbols();
+                std::string sum = symbols != NULL ? symbols->LabeledCheckSum() : "";
+                if(strings == NULL || sum != checksum) {
+                    delete strings;
+                    strings = new fst::SymbolStrings(symbols);
+                    checksum = sum;
+                }
+                WriteMbr(results[i], *strings, &writer);
+            } else {
+                writer.Append("error: cyclic lattice");
+            }
+            writer.Append('\n');
+            delete lattices[i];
+        }
+    }
+    delete strings;
+    delete reader;
+    return 0;
+}
 
-    fst::ShortestDistance<fst::LogArc>(input, &alpha, false);
-    fst::ShortestDistance<fst::LogArc>(input, &beta, true);
+int main(int argc, char** argv) {
+    std::string sausageFormat;
+    std::string mbr;
+    int jobs = 1;
+    std::vector<std::string> archives;
+    bool usage = false;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--sausage" && i + 1 < argc) {
+            sausageFormat = argv[++i];
+            if(sausageFormat != "text" && sausageFormat != "fst") usage = true;
+        } else if(arg == "--mbr" && i + 1 < argc) {
+            mbr = argv[++i];
+            if(mbr != "path" && mbr != "sausage") usage = true;
+        } else if(arg == "--jobs" && i + 1 < argc) {
+            jobs = atoi(argv[++i]);
+        } else if(arg.size() > 0 && arg[0] != '-') {
+            archives.push_back(arg);
+        } else {
+            usage = true;
+        }
+    }
+    if(usage || (sausageFormat != "" && mbr != "") || archives.size() > 1 || (archives.size() == 1 && mbr == "")) {
+        std::cerr << "usage: cat <fst> | " << argv[0] << " [--sausage text|fst | --mbr path|sausage]\n"
+            << "       " << argv[0] << " --mbr path|sausage [--jobs <n>] <input.far>\n";
+        return 1;
+    }
+    if(archives.size() == 1) return DecodeArchive(archives[0], mbr, jobs);
 
-    for(int64 state = 0; state < numStates; state++) {
-        for(fst::MutableArcIterator<fst::VectorFst<fst::LogArc> > aiter(&input, state); !aiter.Done(); aiter.Next()) {
-            const fst::LogArc &arc = aiter.Value();
-            double posterior = exp(-(alpha[state].Value() + arc.weight.Value() + beta[arc.nextstate].Value() - beta[input.Start()].Value()));
-            aiter.SetValue(fst::LogArc(arc.ilabel, arc.olabel, posterior, arc.nextstate));
+    fst::StdVectorFst* old = fst::StdVectorFst::Read("");
+    if(mbr != "") {
+        MbrResult result;
+        if(!DecodeMbr(old, mbr, &result)) {
+            std::cerr << "error: MBR decoding requires an acyclic lattice\n";
+            return 1;
+        }
+        fst::SymbolStrings strings(old->InputSymbols());
+        fst::TextWriter writer(std::cout);
+        WriteMbr(result, strings, &writer);
+        writer.Append('\n');
+        delete old;
+        return 0;
+    }
+    fst::Sausage sausage;
+    if(old->Start() != fst::kNoStateId) {
+        std::vector<int> order;
+        if(fst::TopologicalOrder(*old, &order)) {
+            fst::AcyclicPosteriors(old, order, sausageFormat != "" ? &sausage : NULL);
+        } else if(sausageFormat != "") {
+            std::cerr << "error: confusion networks require an acyclic lattice\n";
+            return 1;
+        } else {
+            fst::CyclicPosteriors(old);
         }
     }
-    fst::Map(input, old, fst::LogToStdMapper());
-    old->Write("");
+    if(sausageFormat == "text") WriteSausageText(sausage, old->InputSymbols());
+    else if(sausageFormat == "fst") WriteSausageFst(sausage, old->InputSymbols());
+    else old->Write("");
     delete old;
 }
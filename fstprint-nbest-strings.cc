@@ -2,66 +2,62 @@
 #include <iostream>
 #include <sstream>
 
+#include "lazy-kbest.h"
+#include "text-writer.h"
+
+void PrintArc(const fst::StdArc &arc, const fst::SymbolStrings &inputSymbols, const fst::SymbolStrings &outputSymbols, fst::TextWriter &writer) {
+    if(arc.olabel == 0) return;
+    writer.Append(' ');
+    if(arc.ilabel != arc.olabel) writer.AppendSymbol(inputSymbols, arc.ilabel).Append('/');
+    writer.AppendSymbol(outputSymbols, arc.olabel);
+}
+
 int main(int argc, char** argv) {
-    if(argc != 2) {
-        std::cerr << "usage: cat <fst> | " << argv[0] << " <n>\n";
+    fst::LazyKBestOptions opts;
+    int n = 0;
+    int numArgs = 0;
+    for(int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if(arg == "--beam" && i + 1 < argc) {
+            opts.beam = atof(argv[++i]);
+        } else if(arg == "--unique") {
+            opts.unique = true;
+        } else if(arg == "--max-memory" && i + 1 < argc) {
+            opts.max_memory = (size_t) (atof(argv[++i]) * 1024 * 1024);
+        } else {
+            std::stringstream reader(arg);
+            reader >> n;
+            numArgs++;
+        }
+    }
+    if(numArgs != 1) {
+        std::cerr << "usage: cat <fst> | " << argv[0] << " [--beam <weight>] [--unique] [--max-memory <megabytes>] <n>\n";
         return 1;
     }
-    int n;
-    std::stringstream reader(argv[1]);
-    reader >> n;
     if(n < 1) {
         std::cerr << "error: invalid n = " << n << "\n";
         return 2;
     }
     fst::StdVectorFst* input = fst::StdVectorFst::Read("");
-    fst::StdVectorFst result;
-    fst::ShortestPath(*input, &result, n);
-    fst::Push(&result, fst::REWEIGHT_TO_INITIAL);
-    const fst::SymbolTable* outputSymbols = result.OutputSymbols();
-    const fst::SymbolTable* inputSymbols = result.InputSymbols();
+    fst::SymbolStrings outputSymbols(input->OutputSymbols());
+    fst::SymbolStrings inputSymbols(input->InputSymbols());
 
-    for(fst::ArcIterator<fst::StdVectorFst> aiter(result, result.Start()); !aiter.Done(); aiter.Next()) {
-        const fst::StdArc& path = aiter.Value();
-        int64 state = path.nextstate;
-        std::cout << path.weight;
-        if(path.ilabel == path.olabel) {
-            if(path.olabel != 0) {
-                if(outputSymbols) std::cout << " " << outputSymbols->Find(path.olabel);
-                else std::cout << " " << path.olabel;
-            }
-        } else {
-            if(path.olabel != 0) {
-                if(inputSymbols) std::cout << " " << inputSymbols->Find(path.ilabel);
-                else std::cout << " " << path.ilabel;
-                if(outputSymbols) std::cout << "/" << outputSymbols->Find(path.olabel);
-                else std::cout << "/" << path.olabel;
-            }
-        }
-        while(result.Final(state) == fst::StdArc::Weight::Zero()) {
-            fst::ArcIterator<fst::StdVectorFst> nextIter(result, state);
-            if(nextIter.Done()) {
-                break;
-                // this should not happen
-            }
-            const fst::StdArc arc = nextIter.Value();
-            if(arc.ilabel == arc.olabel) {
-                if(arc.olabel != 0) {
-                    if(outputSymbols) std::cout << " " << outputSymbols->Find(arc.olabel);
-                    else std::cout << " " << arc.olabel;
-                }
-            } else {
-                if(arc.olabel != 0) {
-                    if(inputSymbols) std::cout << " " << inputSymbols->Find(arc.ilabel);
-                    else std::cout << " " << arc.ilabel;
-                    if(outputSymbols) std::cout << "/" << outputSymbols->Find(arc.olabel);
-                    else std::cout << "/" << arc.olabel;
-                }
-            }
-            state = arc.nextstate;
-        }
-        std::cout << "\n";
+    // paths are buffered and written in large blocks, except for the first
+    // one which is written as soon as it is found
+    opts.k = n;
+    fst::LazyKBest<fst::StdArc> nbest(*input, opts);
+    fst::TextWriter writer(std::cout);
+    std::vector<fst::StdArc> path;
+    float weight;
+    for(int count = 0; nbest.Next(&path, &weight); count++) {
+        writer.AppendWeight(weight);
+        for(size_t i = 0; i < path.size(); i++)
+            PrintArc(path[i], inputSymbols, outputSymbols, writer);
+        writer.Append('\n');
+        if(count == 0) writer.Flush();
     }
-
-
+    writer.Flush();
+    if(nbest.MemoryLimitReached())
+        std::cerr << "warning: memory limit reached, stopped before " << n << " paths\n";
+    delete input;
 }
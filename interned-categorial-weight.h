@@ -0,0 +1,416 @@
+// interned-categorial-weight.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Hash-consed categorial weights: each distinct string is stored once in a
+// pool and a weight is a 32-bit handle to it, so that equality is a handle
+// comparison and hashing returns a cached value.
+
+#ifndef FST_LIB_INTERNED_CATEGORIAL_WEIGHT_H__
+#define FST_LIB_INTERNED_CATEGORIAL_WEIGHT_H__
+
+#include <string>
+#include <vector>
+
+#include "categorial-weight.h"
+
+namespace fst {
+
+    // Pool of distinct label strings. Strings are concatenated in a single
+    // label vector and looked up through an open addressing hash table.
+    //
+    // There is one pool per thread: handles must not cross threads, and
+    // Clear() invalidates every handle except those of One() and Zero().
+    template <typename L>
+        class CategorialStringPool {
+            public:
+                static const uint32 kOne = 0;    // id of the empty string
+                static const uint32 kZero = 1;   // id of the infinite string
+
+                CategorialStringPool() { Clear(); }
+
+                // Pool of the calling thread.
+                static CategorialStringPool<L> &Pool() {
+                    static thread_local CategorialStringPool<L> pool;
+                    return pool;
+                }
+
+                // Returns the id of a string, adding it to the pool if needed.
+                uint32 FindOrAdd(const L *labels, size_t size) {
+                    size_t hash = HashLabels(labels, size);
+                    size_t mask = buckets_.size() - 1;
+                    size_t bucket = hash & mask;
+                    for (; buckets_[bucket] != kNoId; bucket = (bucket + 1) & mask) {
+                        uint32 id = buckets_[bucket];
+                        if (hashes_[id] == hash && Size(id) == size &&
+                                FindLabelMismatch(labels, Labels(id), size) == size)
+                            return id;
+                    }
+                    uint32 id = hashes_.size();
+                    labels_.insert(labels_.end(), labels, labels + size);
+                    offsets_.push_back(labels_.size());
+                    hashes_.push_back(hash);
+                    buckets_[bucket] = id;
+                    if (2 * hashes_.size() > buckets_.size())
+                        Rehash(2 * buckets_.size());
+                    return id;
+                }
+
+                const L *Labels(uint32 id) const { return labels_.data() + offsets_[id]; }
+
+                size_t Size(uint32 id) const { return offsets_[id + 1] - offsets_[id]; }
+
+                size_t Hash(uint32 id) const { return hashes_[id]; }
+
+                size_t NumStrings() const { return hashes_.size(); }
+
+                // Drops all strings but the empty and infinite ones.
+                void Clear() {
+                    labels_.clear();
+                    offsets_.assign(1, 0);
+                    hashes_.clear();
+                    buckets_.assign(kInitialBuckets, kNoId);
+                    L infinity = kCategorialInfinity;
+                    FindOrAdd(0, 0);
+                    FindOrAdd(&infinity, 1);
+                }
+
+                // Same function as CategorialWeight::Hash().
+                static size_t HashLabels(const L *labels, size_t size) {
+                    return HashLabelString(labels, size);
+                }
+
+            private:
+                static const uint32 kNoId = 0xffffffff;
+                static const size_t kInitialBuckets = 1024;
+
+                void Rehash(size_t num_buckets) {
+                    buckets_.assign(num_buckets, kNoId);
+                    size_t mask = num_buckets - 1;
+                    for (uint32 id = 0; id < hashes_.size(); ++id) {
+                        size_t bucket = hashes_[id] & mask;
+                        while (buckets_[bucket] != kNoId)
+                            bucket = (bucket + 1) & mask;
+                        buckets_[bucket] = id;
+                    }
+                }
+
+                vector<L> labels_;         // concatenated strings
+                vector<size_t> offsets_;   // string i is [offsets_[i], offsets_[i + 1])
+                vector<size_t> hashes_;    // cached hash of each string
+                vector<uint32> buckets_;   // hash table of string ids
+
+                DISALLOW_COPY_AND_ASSIGN(CategorialStringPool);
+        };
+
+    template <typename L> const uint32 CategorialStringPool<L>::kOne;
+    template <typename L> const uint32 CategorialStringPool<L>::kZero;
+    template <typename L> const uint32 CategorialStringPool<L>::kNoId;
+    template <typename L> const size_t CategorialStringPool<L>::kInitialBuckets;
+
+    template <typename L, CategorialType S = CATEGORIAL_LEFT>
+        class InternedCategorialWeight;
+
+    template <typename L, CategorialType S = CATEGORIAL_LEFT>
+        class InternedCategorialWeightIterator;
+
+
+    // Categorial semiring over pooled strings. Behaves as
+    // CategorialWeight<L, S> and uses the same binary representation.
+    template <typename L, CategorialType S>
+        class InternedCategorialWeight {
+            public:
+                typedef L Label;
+                typedef InternedCategorialWeight<L, REVERSE_CATEGORIAL_TYPE(S)> ReverseWeight;
+                typedef InternedCategorialWeightIterator<L, S> Iterator;
+                typedef CategorialStringPool<L> Pool;
+
+                InternedCategorialWeight() : id_(Pool::kOne) {}
+
+                template <typename Iter>
+                    InternedCategorialWeight(const Iter &begin, const Iter &end) {
+                        vector<L> &labels = Scratch();
+                        labels.clear();
+                        for (Iter iter = begin; iter != end; ++iter)
+                            if (!labels.empty() || *iter)
+                                labels.push_back(*iter);
+                        id_ = Intern(labels);
+                    }
+
+                explicit InternedCategorialWeight(L l) {
+                    id_ = l ? Pool::Pool().FindOrAdd(&l, 1) : Pool::kOne;
+                }
+
+                static const InternedCategorialWeight<L, S> &Zero() {
+                    static const InternedCategorialWeight<L, S> zero(Pool::kZero, true);
+                    return zero;
+                }
+
+                static const InternedCategorialWeight<L, S> &One() {
+                    static const InternedCategorialWeight<L, S> one;
+                    return one;
+                }
+
+                static const string &Type() { return CategorialWeight<L, S>::Type(); }
+
+                static uint64 Properties() { return CategorialWeight<L, S>::Properties(); }
+
+                bool Member() const {
+                    return Size() != 1 || Labels()[0] != kCategorialBad;
+                }
+
+                istream &Read(istream &strm);
+
+                ostream &Write(ostream &strm) const;
+
+                size_t Hash() const { return Pool::Pool().Hash(id_); }
+
+                InternedCategorialWeight<L, S> Quantize(float delta = kDelta) const {
+                    return *this;
+                }
+
+                ReverseWeight Reverse() const;
+
+                size_t Size() const { return Pool::Pool().Size(id_); }
+
+                const L *Labels() const { return Pool::Pool().Labels(id_); }
+
+                // Handle of the string in the pool of the current thread.
+                uint32 Id() const { return id_; }
+
+                // Weight of a handle returned by Id().
+                static InternedCategorialWeight<L, S> FromId(uint32 id) {
+                    return InternedCategorialWeight<L, S>(id, true);
+                }
+
+                // Interns a label sequence; as with CategorialWeight, it must
+                // not start with an epsilon label.
+                static InternedCategorialWeight<L, S> FromLabels(const vector<L> &labels) {
+                    return InternedCategorialWeight<L, S>(Intern(labels), true);
+                }
+
+                // Per-thread buffer used to build strings before interning.
+                static vector<L> &Scratch() {
+                    static thread_local vector<L> scratch;
+                    return scratch;
+                }
+
+            private:
+                InternedCategorialWeight(uint32 id, bool) : id_(id) {}
+
+                static uint32 Intern(const vector<L> &labels) {
+                    return Pool::Pool().FindOrAdd(labels.data(), labels.size());
+                }
+
+                uint32 id_;   // string handle
+        };
+
+
+    // Traverses string in forward direction.
+    template <typename L, CategorialType S>
+        class InternedCategorialWeightIterator {
+            public:
+                explicit InternedCategorialWeightIterator(const InternedCategorialWeight<L, S>& w)
+                    : data_(w.Labels()), size_(w.Size()), pos_(0) {}
+
+                bool Done() const { return pos_ >= size_; }
+
+                const L& Value() const { return data_[pos_]; }
+
+                void Next() { ++pos_; }
+
+                void Reset() { pos_ = 0; }
+
+            private:
+                const L *data_;
+                size_t size_;
+                size_t pos_;   // position of the current label
+
+                DISALLOW_COPY_AND_ASSIGN(InternedCategorialWeightIterator);
+        };
+
+
+    template <typename L, CategorialType S>
+        inline istream &InternedCategorialWeight<L, S>::Read(istream &strm) {
+            CategorialWeight<L, S> w;
+            w.Read(strm);
+            vector<L> &labels = Scratch();
+            labels.clear();
+            for (CategorialWeightIterator<L, S> iter(w); !iter.Done(); iter.Next())
+                labels.push_back(iter.Value());
+            id_ = Intern(labels);
+            return strm;
+        }
+
+    template <typename L, CategorialType S>
+        inline ostream &InternedCategorialWeight<L, S>::Write(ostream &strm) const {
+            int32 size =  Size();
+            WriteType(strm, size);
+            const L *labels = Labels();
+            for (int i = 0; i < size; ++i)
+                WriteType(strm, labels[i]);
+            return strm;
+        }
+
+    template <typename L, CategorialType S>
+        inline typename InternedCategorialWeight<L, S>::ReverseWeight
+        InternedCategorialWeight<L, S>::Reverse() const {
+            vector<L> labels(Labels(), Labels() + Size());
+            std::reverse(labels.begin(), labels.end());
+            std::transform(labels.begin(), labels.end(), labels.begin(), ReverseCategorialLabel<L>);
+            return ReverseWeight(labels.begin(), labels.end());
+        }
+
+    template <typename L, CategorialType S>
+        inline bool operator==(const InternedCategorialWeight<L, S> &w1,
+                const InternedCategorialWeight<L, S> &w2) {
+            return w1.Id() == w2.Id();
+        }
+
+    template <typename L, CategorialType S>
+        inline bool operator!=(const InternedCategorialWeight<L, S> &w1,
+                const InternedCategorialWeight<L, S> &w2) {
+            return w1.Id() != w2.Id();
+        }
+
+    template <typename L, CategorialType S>
+        inline bool ApproxEqual(const InternedCategorialWeight<L, S> &w1,
+                const InternedCategorialWeight<L, S> &w2,
+                float delta = kDelta) {
+            return w1 == w2;
+        }
+
+    template <typename L, CategorialType S>
+        inline ostream &operator<<(ostream &strm, const InternedCategorialWeight<L, S> &w) {
+            return strm << CategorialWeight<L, S>(w.Labels(), w.Labels() + w.Size());
+        }
+
+    template <typename L, CategorialType S>
+        inline istream &operator>>(istream &strm, InternedCategorialWeight<L, S> &w) {
+            CategorialWeight<L, S> cw;
+            strm >> cw;
+            vector<L> labels;
+            for (CategorialWeightIterator<L, S> iter(cw); !iter.Done(); iter.Next())
+                labels.push_back(iter.Value());
+            w = InternedCategorialWeight<L, S>::FromLabels(labels);
+            return strm;
+        }
+
+
+    // Default is for the restricted left and right semirings.
+    template <typename L, CategorialType S>  inline InternedCategorialWeight<L, S>
+        Plus(const InternedCategorialWeight<L, S> &w1,
+                const InternedCategorialWeight<L, S> &w2) {
+            if (w1 == InternedCategorialWeight<L, S>::Zero())
+                return w2;
+            if (w2 == InternedCategorialWeight<L, S>::Zero())
+                return w1;
+
+            if (w1 != w2)
+                LOG(FATAL) << "InternedCategorialWeight::Plus: unequal arguments "
+                    << "(non-functional FST?)";
+
+            return w1;
+        }
+
+
+    // Order of the left and right Plus, see CompareCategorial() in
+    // categorial-weight.h.
+    template <typename L, CategorialType S>
+        inline int CompareCategorial(const InternedCategorialWeight<L, S> &w1,
+                const InternedCategorialWeight<L, S> &w2) {
+            if (S == CATEGORIAL_RIGHT || S == CATEGORIAL_RIGHT_RESTRICT)
+                return CompareLabelStringsBackwards(w1.Labels(), w1.Size(), w2.Labels(), w2.Size());
+            return CompareLabelStrings(w1.Labels(), w1.Size(), w2.Labels(), w2.Size());
+        }
+
+    // Lexicographic minimum of two pooled strings, as in the left and right
+    // categorial Plus of categorial-weight.h.
+    template <typename L, CategorialType S>  inline const InternedCategorialWeight<L, S> &
+        InternedCategorialMin(const InternedCategorialWeight<L, S> &w1,
+                const InternedCategorialWeight<L, S> &w2) {
+            if (w1 == w2 || w2 == InternedCategorialWeight<L, S>::Zero())
+                return w1;
+            if (w1 == InternedCategorialWeight<L, S>::Zero())
+                return w2;
+
+            if(CompareCategorial(w1, w2) < 0) return w1;
+            return w2;
+        }
+
+    template <typename L>  inline InternedCategorialWeight<L, CATEGORIAL_LEFT>
+        Plus(const InternedCategorialWeight<L, CATEGORIAL_LEFT> &w1,
+                const InternedCategorialWeight<L, CATEGORIAL_LEFT> &w2) {
+            return InternedCategorialMin(w1, w2);
+        }
+
+    template <typename L>  inline InternedCategorialWeight<L, CATEGORIAL_RIGHT>
+        Plus(const InternedCategorialWeight<L, CATEGORIAL_RIGHT> &w1,
+                const InternedCategorialWeight<L, CATEGORIAL_RIGHT> &w2) {
+            return InternedCategorialMin(w1, w2);
+        }
+
+
+    template <typename L, CategorialType S>
+        inline InternedCategorialWeight<L, S> Times(const InternedCategorialWeight<L, S> &w1,
+                const InternedCategorialWeight<L, S> &w2) {
+            if (w1 == InternedCategorialWeight<L, S>::Zero() || w2 == InternedCategorialWeight<L, S>::Zero())
+                return InternedCategorialWeight<L, S>::Zero();
+            if (w2 == InternedCategorialWeight<L, S>::One())
+                return w1;
+            if (w1 == InternedCategorialWeight<L, S>::One())
+                return w2;
+
+            vector<L> &labels = InternedCategorialWeight<L, S>::Scratch();
+            labels.assign(w1.Labels(), w1.Labels() + w1.Size());
+            labels.insert(labels.end(), w2.Labels(), w2.Labels() + w2.Size());
+            return InternedCategorialWeight<L, S>::FromLabels(labels);
+        }
+
+
+    // Left division, see Divide() in categorial-weight.h.
+    template <typename L, CategorialType S> inline InternedCategorialWeight<L, S>
+        Divide(const InternedCategorialWeight<L, S> &w1,
+                const InternedCategorialWeight<L, S> &w2,
+                DivideType typ) {
+
+            if (typ != DIVIDE_LEFT)
+                LOG(FATAL) << "InternedCategorialWeight::Divide: only left division is defined "
+                    << "for the " << InternedCategorialWeight<L, S>::Type() << " semiring";
+
+            if (w2 == InternedCategorialWeight<L, S>::Zero())
+                return InternedCategorialWeight<L, S>(kCategorialBad);
+            else if (w1 == InternedCategorialWeight<L, S>::Zero())
+                return InternedCategorialWeight<L, S>::Zero();
+
+            if(w1 == w2) return InternedCategorialWeight<L, S>::One();
+            const L *labels2 = w2.Labels();
+            bool needsBrackets = std::find(labels2, labels2 + w2.Size(),
+                    static_cast<L>(kCategorialLeftDiv)) != labels2 + w2.Size();
+            vector<L> &div = InternedCategorialWeight<L, S>::Scratch();
+            div.clear();
+            if(needsBrackets) div.push_back(kCategorialLeftBracket);
+            div.insert(div.end(), labels2, labels2 + w2.Size());
+            if(needsBrackets) div.push_back(kCategorialRightBracket);
+            div.push_back(kCategorialLeftDiv);
+            div.insert(div.end(), w1.Labels(), w1.Labels() + w1.Size());
+            return InternedCategorialWeight<L, S>::FromLabels(div);
+        }
+
+}  // namespace fst
+
+#endif  // FST_LIB_INTERNED_CATEGORIAL_WEIGHT_H__
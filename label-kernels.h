@@ -0,0 +1,212 @@
+// label-kernels.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Comparison and hashing of label strings. For 32-bit labels, SSE4.1 and
+// AVX2 versions are selected at run time according to the CPU, with a
+// scalar fallback computing the same results.
+
+#ifndef FST_LIB_LABEL_KERNELS_H__
+#define FST_LIB_LABEL_KERNELS_H__
+
+#include <algorithm>
+#include <stdint.h>
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FST_LABEL_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace fst {
+
+    namespace internal {
+
+        // The hash interleaves labels over 8 lanes of 32-bit multiplicative
+        // hashes (label i goes to lane i % 8), which maps to one AVX2
+        // register or two SSE registers; lanes are then combined.
+        const uint32_t kLabelHashLanes = 8;
+        const uint32_t kLabelHashMultiplier = 0x9e3779b1U;
+
+        inline size_t CombineLabelHashLanes(const uint32_t *lanes, size_t size) {
+            size_t h = size;
+            for (uint32_t j = 0; j < kLabelHashLanes; ++j)
+                h = h * 1000003 ^ lanes[j];
+            return h;
+        }
+
+        template <typename L>
+            inline size_t HashLabelStringScalar(const L *labels, size_t size) {
+                uint32_t lanes[kLabelHashLanes] = {0, 0, 0, 0, 0, 0, 0, 0};
+                for (size_t i = 0; i < size; ++i) {
+                    uint32_t &lane = lanes[i % kLabelHashLanes];
+                    lane = lane * kLabelHashMultiplier + static_cast<uint32_t>(labels[i]);
+                }
+                return CombineLabelHashLanes(lanes, size);
+            }
+
+        template <typename L>
+            inline size_t FindLabelMismatchScalar(const L *a, const L *b, size_t size) {
+                size_t i = 0;
+                while (i < size && a[i] == b[i])
+                    ++i;
+                return i;
+            }
+
+        typedef size_t (*FindLabelMismatchFunction)(const int32_t *, const int32_t *, size_t);
+        typedef size_t (*HashLabelStringFunction)(const int32_t *, size_t);
+
+#ifdef FST_LABEL_KERNELS_X86
+        __attribute__((target("sse4.1")))
+            inline size_t FindLabelMismatchSse4(const int32_t *a, const int32_t *b, size_t size) {
+                size_t i = 0;
+                for (; i + 4 <= size; i += 4) {
+                    __m128i eq = _mm_cmpeq_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i *>(a + i)),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(b + i)));
+                    int mask = _mm_movemask_ps(_mm_castsi128_ps(eq));
+                    if (mask != 0xf)
+                        return i + __builtin_ctz(~mask);
+                }
+                return i + FindLabelMismatchScalar(a + i, b + i, size - i);
+            }
+
+        __attribute__((target("avx2")))
+            inline size_t FindLabelMismatchAvx2(const int32_t *a, const int32_t *b, size_t size) {
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    __m256i eq = _mm256_cmpeq_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i)),
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + i)));
+                    int mask = _mm256_movemask_ps(_mm256_castsi256_ps(eq));
+                    if (mask != 0xff)
+                        return i + __builtin_ctz(~mask);
+                }
+                return i + FindLabelMismatchScalar(a + i, b + i, size - i);
+            }
+
+        __attribute__((target("sse4.1")))
+            inline size_t HashLabelStringSse4(const int32_t *labels, size_t size) {
+                __m128i low = _mm_setzero_si128();
+                __m128i high = _mm_setzero_si128();
+                const __m128i multiplier = _mm_set1_epi32(kLabelHashMultiplier);
+                size_t i = 0;
+                for (; i + kLabelHashLanes <= size; i += kLabelHashLanes) {
+                    low = _mm_add_epi32(_mm_mullo_epi32(low, multiplier),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(labels + i)));
+                    high = _mm_add_epi32(_mm_mullo_epi32(high, multiplier),
+                            _mm_loadu_si128(reinterpret_cast<const __m128i *>(labels + i + 4)));
+                }
+                uint32_t lanes[kLabelHashLanes];
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes), low);
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(lanes + 4), high);
+                for (; i < size; ++i) {
+                    uint32_t &lane = lanes[i % kLabelHashLanes];
+                    lane = lane * kLabelHashMultiplier + static_cast<uint32_t>(labels[i]);
+                }
+                return CombineLabelHashLanes(lanes, size);
+            }
+
+        __attribute__((target("avx2")))
+            inline size_t HashLabelStringAvx2(const int32_t *labels, size_t size) {
+                __m256i h = _mm256_setzero_si256();
+                const __m256i multiplier = _mm256_set1_epi32(kLabelHashMultiplier);
+                size_t i = 0;
+                for (; i + kLabelHashLanes <= size; i += kLabelHashLanes) {
+                    h = _mm256_add_epi32(_mm256_mullo_epi32(h, multiplier),
+                            _mm256_loadu_si256(reinterpret_cast<const __m256i *>(labels + i)));
+                }
+                uint32_t lanes[kLabelHashLanes];
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(lanes), h);
+                for (; i < size; ++i) {
+                    uint32_t &lane = lanes[i % kLabelHashLanes];
+                    lane = lane * kLabelHashMultiplier + static_cast<uint32_t>(labels[i]);
+                }
+                return CombineLabelHashLanes(lanes, size);
+            }
+#endif  // FST_LABEL_KERNELS_X86
+
+        inline FindLabelMismatchFunction SelectFindLabelMismatch() {
+#ifdef FST_LABEL_KERNELS_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return FindLabelMismatchAvx2;
+            if (__builtin_cpu_supports("sse4.1")) return FindLabelMismatchSse4;
+#endif
+            return FindLabelMismatchScalar<int32_t>;
+        }
+
+        inline HashLabelStringFunction SelectHashLabelString() {
+#ifdef FST_LABEL_KERNELS_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2")) return HashLabelStringAvx2;
+            if (__builtin_cpu_supports("sse4.1")) return HashLabelStringSse4;
+#endif
+            return HashLabelStringScalar<int32_t>;
+        }
+
+    }  // namespace internal
+
+    // Index of the first position where two strings of the given size differ
+    // (size if they are equal).
+    template <typename L>
+        inline size_t FindLabelMismatch(const L *a, const L *b, size_t size) {
+            return internal::FindLabelMismatchScalar(a, b, size);
+        }
+
+    inline size_t FindLabelMismatch(const int32_t *a, const int32_t *b, size_t size) {
+        if (size < 8)  // typical tag strings, not worth a call through a pointer
+            return internal::FindLabelMismatchScalar(a, b, size);
+        static const internal::FindLabelMismatchFunction function = internal::SelectFindLabelMismatch();
+        return function(a, b, size);
+    }
+
+    // Hash of a label string; the same value whatever the implementation.
+    template <typename L>
+        inline size_t HashLabelString(const L *labels, size_t size) {
+            return internal::HashLabelStringScalar(labels, size);
+        }
+
+    inline size_t HashLabelString(const int32_t *labels, size_t size) {
+        if (size < internal::kLabelHashLanes)
+            return internal::HashLabelStringScalar(labels, size);
+        static const internal::HashLabelStringFunction function = internal::SelectHashLabelString();
+        return function(labels, size);
+    }
+
+    // Lexicographic comparison of label strings, where a proper prefix comes
+    // first: negative, zero or positive as a is before, equal to or after b.
+    template <typename L>
+        inline int CompareLabelStrings(const L *a, size_t size_a, const L *b, size_t size_b) {
+            size_t size = std::min(size_a, size_b);
+            size_t i = FindLabelMismatch(a, b, size);
+            if (i < size)
+                return a[i] < b[i] ? -1 : 1;
+            return size_a < size_b ? -1 : (size_a > size_b ? 1 : 0);
+        }
+
+    // Same comparison on strings read from their last label, where a proper
+    // suffix comes first.
+    template <typename L>
+        inline int CompareLabelStringsBackwards(const L *a, size_t size_a, const L *b, size_t size_b) {
+            size_t size = std::min(size_a, size_b);
+            for (size_t i = 1; i <= size; ++i)
+                if (a[size_a - i] != b[size_b - i])
+                    return a[size_a - i] < b[size_b - i] ? -1 : 1;
+            return size_a < size_b ? -1 : (size_a > size_b ? 1 : 0);
+        }
+
+}  // namespace fst
+
+#endif  // FST_LIB_LABEL_KERNELS_H__
@@ -0,0 +1,219 @@
+// lazy-kbest.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Enumeration of the k shortest paths of a tropical fst, one at a time and
+// by increasing weight, without building the n-best fst. Paths are grown
+// best first (A*) with the exact distance to the final states as
+// heuristic, so each path comes out after about as many steps as it has
+// arcs; as in ShortestPath(), a state is expanded at most k times.
+//
+// Without the heuristic, the search is a Dijkstra which never visits the
+// whole fst: only states reached by partial paths better than the k-th
+// path are expanded, so that the k best paths of a lazy fst (such as a
+// composition) are found without building it. Weights must then be
+// non-negative (as -log probabilities are).
+//
+// In unique mode, paths with the same label string (epsilons removed) are
+// given once, without determinizing: prefixes are stored once in a trie,
+// and a partial path is dropped when a better one reached the same state
+// with the same prefix. A state is then expanded for at most k distinct
+// prefixes.
+
+#ifndef FST_UTILS_LAZY_KBEST_H__
+#define FST_UTILS_LAZY_KBEST_H__
+
+#include <algorithm>
+#include <queue>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <fst/fstlib.h>
+
+namespace fst {
+
+    struct LazyKBestOptions {
+        int k;                  // number of paths
+        float beam;             // stop at paths worse than the best by more than beam (< 0: no limit)
+        bool unique;            // skip paths with the same label string as a previous one
+        size_t max_memory;      // stop when partial paths take more bytes (0: no limit)
+        bool heuristic;         // guide the search with the distance to the final states (computed on the whole fst)
+
+        LazyKBestOptions(int n = 1) : k(n), beam(-1), unique(false), max_memory(0), heuristic(true) {}
+    };
+
+    template <class Arc>
+        class LazyKBest {
+            public:
+                typedef typename Arc::StateId StateId;
+                typedef typename Arc::Weight Weight;
+
+                LazyKBest(const Fst<Arc> &fst, const LazyKBestOptions &opts)
+                    : fst_(fst), opts_(opts), count_(0), best_(0), memory_limit_reached_(false) {
+                    if(opts_.heuristic) ShortestDistance(fst_, &distance_, true);
+                    StateId start = fst_.Start();
+                    if(start != kNoStateId && Reachable(start))
+                        queue_.push(Entry(Distance(start), 0, -1, start, false, kEmptyPrefix));
+                }
+
+                // Next path by increasing weight; false when k paths were
+                // given, no other path is within the beam, or the memory
+                // limit was reached.
+                bool Next(vector<Arc> *path, float *weight) {
+                    while(count_ < opts_.k && !queue_.empty()) {
+                        if(opts_.max_memory > 0 && Memory() > opts_.max_memory) {
+                            memory_limit_reached_ = true;
+                            break;
+                        }
+                        Entry entry = queue_.top();
+                        queue_.pop();
+                        if(opts_.beam >= 0 && count_ > 0 && entry.estimate > best_ + opts_.beam) break;
+                        if(entry.final) {
+                            if(opts_.unique && !printed_.insert(entry.prefix).second) continue;
+                            if(count_++ == 0) best_ = entry.estimate;
+                            *weight = entry.estimate;
+                            path->clear();
+                            for(int node = entry.node; node != -1; node = nodes_[node].parent)
+                                path->push_back(nodes_[node].arc);
+                            std::reverse(path->begin(), path->end());
+                            return true;
+                        }
+                        Expand(entry);
+                    }
+                    // nothing else will be returned
+                    queue_ = std::priority_queue<Entry>();
+                    return false;
+                }
+
+                bool MemoryLimitReached() const { return memory_limit_reached_; }
+
+            private:
+                static const int kEmptyPrefix = 0;
+
+                struct Entry {
+                    float estimate;     // weight so far + distance to the final states
+                    float weight;       // weight so far
+                    int node;           // last arc of the partial path
+                    StateId state;
+                    bool final;         // the path ends in state
+                    int prefix;         // label string so far (unique mode)
+                    Entry(float e, float w, int n, StateId s, bool f, int p) : estimate(e), weight(w), node(n), state(s), final(f), prefix(p) {}
+                    bool operator<(const Entry &other) const { return estimate > other.estimate; }
+                };
+
+                // Prefix trie edge: parent prefix and label pair.
+                struct PrefixKey {
+                    int parent;
+                    std::pair<int, int> labels;
+                    bool operator==(const PrefixKey &other) const { return parent == other.parent && labels == other.labels; }
+                };
+
+                struct PrefixKeyHash {
+                    size_t operator()(const PrefixKey &key) const {
+                        return (static_cast<size_t>(key.parent) * 7853) ^ (static_cast<size_t>(key.labels.first) * 7867) ^ key.labels.second;
+                    }
+                };
+
+                struct Node {
+                    int parent;
+                    Arc arc;
+                    Node(int p, const Arc &a) : parent(p), arc(a) {}
+                };
+
+                // Label string of an arc as printed: nothing if the output is
+                // epsilon, the output if input and output are the same.
+                static std::pair<int, int> Key(const Arc &arc) {
+                    if(arc.olabel == 0) return std::pair<int, int>(0, 0);
+                    if(arc.ilabel == arc.olabel) return std::pair<int, int>(arc.olabel, arc.olabel);
+                    return std::pair<int, int>(arc.ilabel, arc.olabel);
+                }
+
+                // Id of the prefix followed by the labels of arc.
+                int Extend(int prefix, const Arc &arc) {
+                    PrefixKey key = {prefix, Key(arc)};
+                    if(key.labels.first == 0 && key.labels.second == 0) return prefix;
+                    typename std::unordered_map<PrefixKey, int, PrefixKeyHash>::iterator found = prefixes_.find(key);
+                    if(found != prefixes_.end()) return found->second;
+                    int id = prefixes_.size() + 1;
+                    prefixes_.insert(std::make_pair(key, id));
+                    return id;
+                }
+
+                void Expand(const Entry &entry) {
+                    if(opts_.unique) {
+                        uint64 visit = (static_cast<uint64>(entry.state) << 32) | static_cast<uint32>(entry.prefix);
+                        if(!visited_.insert(visit).second) return;
+                    }
+                    if((StateId) expansions_.size() <= entry.state) expansions_.resize(entry.state + 1, 0);
+                    if(expansions_[entry.state]++ >= opts_.k) return;
+                    Weight final = fst_.Final(entry.state);
+                    if(final != Weight::Zero()) {
+                        float weight = entry.weight + final.Value();
+                        queue_.push(Entry(weight, weight, entry.node, entry.state, true, entry.prefix));
+                    }
+                    for(ArcIterator<Fst<Arc> > aiter(fst_, entry.state); !aiter.Done(); aiter.Next()) {
+                        const Arc &arc = aiter.Value();
+                        if(!Reachable(arc.nextstate)) continue;
+                        float weight = entry.weight + arc.weight.Value();
+                        int prefix = opts_.unique ? Extend(entry.prefix, arc) : kEmptyPrefix;
+                        nodes_.push_back(Node(entry.node, arc));
+                        queue_.push(Entry(weight + Distance(arc.nextstate), weight, nodes_.size() - 1, arc.nextstate, false, prefix));
+                    }
+                }
+
+                // Whether the final states can be reached from a state (all
+                // states may lead to them without the heuristic).
+                bool Reachable(StateId s) const {
+                    if(!opts_.heuristic) return true;
+                    return s < (StateId) distance_.size() && distance_[s] != Weight::Zero();
+                }
+
+                float Distance(StateId s) const {
+                    return opts_.heuristic ? distance_[s].Value() : 0;
+                }
+
+                // Approximate size of the partial paths (hash tables count
+                // about two pointers per element on top of it).
+                size_t Memory() const {
+                    return nodes_.capacity() * sizeof(Node) + queue_.size() * sizeof(Entry) +
+                        prefixes_.size() * (sizeof(PrefixKey) + sizeof(int) + 2 * sizeof(void *)) +
+                        (visited_.size() + printed_.size()) * (sizeof(uint64) + 2 * sizeof(void *));
+                }
+
+                const Fst<Arc> &fst_;
+                LazyKBestOptions opts_;
+                int count_;
+                float best_;
+                bool memory_limit_reached_;
+                vector<Weight> distance_;       // to the final states
+                vector<int> expansions_;
+                vector<Node> nodes_;            // tree of partial paths
+                std::unordered_map<PrefixKey, int, PrefixKeyHash> prefixes_;   // prefix trie (unique mode)
+                std::unordered_set<uint64> visited_;    // expanded (state, prefix) pairs
+                std::unordered_set<int> printed_;       // label strings already given
+                std::priority_queue<Entry> queue_;
+
+                DISALLOW_COPY_AND_ASSIGN(LazyKBest);
+        };
+
+    template <class Arc>
+        const int LazyKBest<Arc>::kEmptyPrefix;
+
+}  // namespace fst
+
+#endif  // FST_UTILS_LAZY_KBEST_H__
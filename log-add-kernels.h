@@ -0,0 +1,155 @@
+// log-add-kernels.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Log-add of a batch of -log probabilities, as for all the arcs entering
+// or leaving a state in forward-backward. The batch is shifted by its
+// minimum and the exponentials are summed 4 (AVX2) or 8 (AVX-512) at a
+// time with a polynomial exp, selected at run time according to the CPU;
+// the scalar fallback uses exp() and agrees to about 1e-15 (relative).
+
+#ifndef FST_LIB_LOG_ADD_KERNELS_H__
+#define FST_LIB_LOG_ADD_KERNELS_H__
+
+#include <cmath>
+#include <limits>
+#include <stddef.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define FST_LOG_ADD_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+namespace fst {
+
+    namespace internal {
+
+        // Below this, exp() is taken as 0 (exp(-700) ~ 1e-304).
+        const double kLogAddMinExponent = -700.0;
+
+        // sum_i exp(shift - values[i]), where shift <= values[i]
+        inline double SumShiftedExpScalar(const double *values, size_t size, double shift) {
+            double sum = 0;
+            for (size_t i = 0; i < size; ++i) {
+                double x = shift - values[i];
+                if (x >= kLogAddMinExponent)
+                    sum += exp(x);
+            }
+            return sum;
+        }
+
+        typedef double (*SumShiftedExpFunction)(const double *, size_t, double);
+
+#ifdef FST_LOG_ADD_KERNELS_X86
+        // exp(x) = 2^k exp(r), with k = round(x / ln 2) and |r| <= ln(2) / 2;
+        // exp(r) is its Taylor series up to degree 12 (error below 1e-15).
+        const double kExpLn2Hi = 6.93147180369123816490e-01;
+        const double kExpLn2Lo = 1.90821492927058770002e-10;
+        const double kExpLog2e = 1.44269504088896338700e+00;
+        const double kExpCoefficients[13] = {
+            1.0, 1.0, 1.0 / 2, 1.0 / 6, 1.0 / 24, 1.0 / 120, 1.0 / 720, 1.0 / 5040,
+            1.0 / 40320, 1.0 / 362880, 1.0 / 3628800, 1.0 / 39916800, 1.0 / 479001600 };
+
+        __attribute__((target("avx2,fma")))
+            inline __m256d ExpAvx2(__m256d x) {
+                __m256d k = _mm256_round_pd(_mm256_mul_pd(x, _mm256_set1_pd(kExpLog2e)),
+                        _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+                __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(kExpLn2Hi), x);
+                r = _mm256_fnmadd_pd(k, _mm256_set1_pd(kExpLn2Lo), r);
+                __m256d p = _mm256_set1_pd(kExpCoefficients[12]);
+                for (int i = 11; i >= 0; --i)
+                    p = _mm256_fmadd_pd(p, r, _mm256_set1_pd(kExpCoefficients[i]));
+                // 2^k: k + 1023 lands in the low bits of 2^52 + 1023 + k,
+                // from where it is shifted to the exponent
+                __m256i bits = _mm256_castpd_si256(_mm256_add_pd(k, _mm256_set1_pd(4503599627371519.0)));
+                return _mm256_mul_pd(p, _mm256_castsi256_pd(_mm256_slli_epi64(bits, 52)));
+            }
+
+        __attribute__((target("avx2,fma")))
+            inline double SumShiftedExpAvx2(const double *values, size_t size, double shift) {
+                const __m256d shifts = _mm256_set1_pd(shift);
+                const __m256d min_exponent = _mm256_set1_pd(kLogAddMinExponent);
+                __m256d sum = _mm256_setzero_pd();
+                size_t i = 0;
+                for (; i + 4 <= size; i += 4) {
+                    __m256d x = _mm256_sub_pd(shifts, _mm256_loadu_pd(values + i));
+                    __m256d keep = _mm256_cmp_pd(x, min_exponent, _CMP_GE_OQ);
+                    __m256d e = ExpAvx2(_mm256_max_pd(x, min_exponent));
+                    sum = _mm256_add_pd(sum, _mm256_and_pd(e, keep));
+                }
+                double lanes[4];
+                _mm256_storeu_pd(lanes, sum);
+                return lanes[0] + lanes[1] + lanes[2] + lanes[3] + SumShiftedExpScalar(values + i, size - i, shift);
+            }
+
+        // Only zero-masked or merge-masked forms are used: the unmasked
+        // max, roundscale, scalef and reduce intrinsics pass an undefined
+        // vector through, which GCC reports under -Wall.
+        __attribute__((target("avx512f")))
+            inline double SumShiftedExpAvx512(const double *values, size_t size, double shift) {
+                const __m512d shifts = _mm512_set1_pd(shift);
+                const __m512d min_exponent = _mm512_set1_pd(kLogAddMinExponent);
+                __m512d sum = _mm512_setzero_pd();
+                size_t i = 0;
+                for (; i + 8 <= size; i += 8) {
+                    __m512d x = _mm512_sub_pd(shifts, _mm512_loadu_pd(values + i));
+                    __mmask8 keep = _mm512_cmp_pd_mask(x, min_exponent, _CMP_GE_OQ);
+                    // dropped lanes (and NaNs) are computed as exp(0)
+                    x = _mm512_maskz_mov_pd(keep, x);
+                    __m512d k = _mm512_maskz_roundscale_pd(keep, _mm512_mul_pd(x, _mm512_set1_pd(kExpLog2e)),
+                            _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+                    __m512d r = _mm512_fnmadd_pd(k, _mm512_set1_pd(kExpLn2Hi), x);
+                    r = _mm512_fnmadd_pd(k, _mm512_set1_pd(kExpLn2Lo), r);
+                    __m512d p = _mm512_set1_pd(kExpCoefficients[12]);
+                    for (int j = 11; j >= 0; --j)
+                        p = _mm512_fmadd_pd(p, r, _mm512_set1_pd(kExpCoefficients[j]));
+                    sum = _mm512_mask_add_pd(sum, keep, sum, _mm512_maskz_scalef_pd(keep, p, k));
+                }
+                double lanes[8];
+                _mm512_storeu_pd(lanes, sum);
+                return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + (lanes[4] + lanes[5]) + (lanes[6] + lanes[7]) +
+                    SumShiftedExpScalar(values + i, size - i, shift);
+            }
+#endif  // FST_LOG_ADD_KERNELS_X86
+
+        inline SumShiftedExpFunction SelectSumShiftedExp() {
+#ifdef FST_LOG_ADD_KERNELS_X86
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx512f")) return SumShiftedExpAvx512;
+            if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) return SumShiftedExpAvx2;
+#endif
+            return SumShiftedExpScalar;
+        }
+
+    }  // namespace internal
+
+    // -log(sum_i exp(-values[i])); +infinity for an empty batch.
+    inline double LogSum(const double *values, size_t size) {
+        double min = std::numeric_limits<double>::infinity();
+        for (size_t i = 0; i < size; ++i)
+            if (values[i] < min) min = values[i];
+        if (min == std::numeric_limits<double>::infinity())
+            return min;
+        if (size < 4)
+            return min - log(internal::SumShiftedExpScalar(values, size, min));
+        static const internal::SumShiftedExpFunction function = internal::SelectSumShiftedExp();
+        return min - log(function(values, size, min));
+    }
+
+}  // namespace fst
+
+#endif  // FST_LIB_LOG_ADD_KERNELS_H__
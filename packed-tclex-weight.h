@@ -0,0 +1,209 @@
+// packed-tclex-weight.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// (Tropical, Categorial)-lexicographic weight packed in 8 bytes: a float
+// and the handle of an interned categorial string. Weights and arcs are
+// trivially copyable, so that arc vectors are dense and cheap to sort.
+
+#ifndef FST_LIB_PACKED_TCLEX_WEIGHT_H__
+#define FST_LIB_PACKED_TCLEX_WEIGHT_H__
+
+#include <sstream>
+#include <string>
+
+#include <fst/float-weight.h>
+
+#include "interned-categorial-weight.h"
+
+namespace fst {
+
+    template <typename L = int, CategorialType S = CATEGORIAL_LEFT>
+        class PackedTCLexWeight;
+
+    template <typename L, CategorialType S>
+        bool operator==(const PackedTCLexWeight<L, S> &, const PackedTCLexWeight<L, S> &);
+
+
+    // Same semiring as LexicographicWeight<TropicalWeight,
+    // InternedCategorialWeight<L, S> >, with the tag string order used by
+    // fstdeterminize-tc-lex to break ties.
+    template <typename L, CategorialType S>
+        class PackedTCLexWeight {
+            public:
+                typedef InternedCategorialWeight<L, S> Categorial;
+                typedef PackedTCLexWeight<L, REVERSE_CATEGORIAL_TYPE(S)> ReverseWeight;
+
+                friend bool operator==<>(const PackedTCLexWeight<L, S> &,
+                        const PackedTCLexWeight<L, S> &);
+
+                PackedTCLexWeight() {}
+
+                PackedTCLexWeight(const TropicalWeight &w1, const Categorial &w2)
+                    : value1_(w1.Value()), value2_(w2.Id()) {}
+
+                static const PackedTCLexWeight<L, S> &Zero() {
+                    static const PackedTCLexWeight<L, S> zero(TropicalWeight::Zero(), Categorial::Zero());
+                    return zero;
+                }
+
+                static const PackedTCLexWeight<L, S> &One() {
+                    static const PackedTCLexWeight<L, S> one(TropicalWeight::One(), Categorial::One());
+                    return one;
+                }
+
+                static const string &Type() {
+                    static const string type = TropicalWeight::Type() + "_" +
+                        Categorial::Type() + "_packed_lexicographic";
+                    return type;
+                }
+
+                static uint64 Properties() {
+                    return Categorial::Properties() & (kLeftSemiring | kRightSemiring | kIdempotent | kPath);
+                }
+
+                bool Member() const { return Value1().Member() && Value2().Member(); }
+
+                istream &Read(istream &strm) {
+                    TropicalWeight w1;
+                    Categorial w2;
+                    w1.Read(strm);
+                    w2.Read(strm);
+                    *this = PackedTCLexWeight<L, S>(w1, w2);
+                    return strm;
+                }
+
+                ostream &Write(ostream &strm) const {
+                    Value1().Write(strm);
+                    return Value2().Write(strm);
+                }
+
+                size_t Hash() const {
+                    return Value1().Hash() ^ (Value2().Hash() << 5);
+                }
+
+                PackedTCLexWeight<L, S> Quantize(float delta = kDelta) const {
+                    return PackedTCLexWeight<L, S>(Value1().Quantize(delta), Value2());
+                }
+
+                ReverseWeight Reverse() const {
+                    return ReverseWeight(Value1().Reverse(), Value2().Reverse());
+                }
+
+                TropicalWeight Value1() const { return TropicalWeight(value1_); }
+
+                Categorial Value2() const { return Categorial::FromId(value2_); }
+
+            private:
+                float value1_;    // tropical weight
+                uint32 value2_;   // handle of the categorial string
+        };
+
+
+    template <typename L, CategorialType S>
+        inline bool operator==(const PackedTCLexWeight<L, S> &w1,
+                const PackedTCLexWeight<L, S> &w2) {
+            return w1.value2_ == w2.value2_ && w1.Value1() == w2.Value1();
+        }
+
+    template <typename L, CategorialType S>
+        inline bool operator!=(const PackedTCLexWeight<L, S> &w1,
+                const PackedTCLexWeight<L, S> &w2) {
+            return !(w1 == w2);
+        }
+
+    template <typename L, CategorialType S>
+        inline bool ApproxEqual(const PackedTCLexWeight<L, S> &w1,
+                const PackedTCLexWeight<L, S> &w2,
+                float delta = kDelta) {
+            return ApproxEqual(w1.Value1(), w2.Value1(), delta) && w1.Value2() == w2.Value2();
+        }
+
+    template <typename L, CategorialType S>
+        inline ostream &operator<<(ostream &strm, const PackedTCLexWeight<L, S> &w) {
+            return strm << w.Value1() << "," << w.Value2();
+        }
+
+    template <typename L, CategorialType S>
+        inline istream &operator>>(istream &strm, PackedTCLexWeight<L, S> &w) {
+            string s;
+            strm >> s;
+            size_t separator = s.find(',');
+            TropicalWeight w1;
+            typename PackedTCLexWeight<L, S>::Categorial w2;
+            std::istringstream strm1(s.substr(0, separator));
+            strm1 >> w1;
+            if (separator != string::npos) {
+                std::istringstream strm2(s.substr(separator + 1));
+                strm2 >> w2;
+            }
+            w = PackedTCLexWeight<L, S>(w1, w2);
+            return strm;
+        }
+
+
+    // Smallest tropical weight, then smallest tag string (lexicographic
+    // order), as the TCLexWeight Plus of fstdeterminize-tc-lex.
+    template <typename L, CategorialType S> inline PackedTCLexWeight<L, S>
+        Plus(const PackedTCLexWeight<L, S> &w, const PackedTCLexWeight<L, S> &v) {
+            float value1 = w.Value1().Value();
+            float value2 = v.Value1().Value();
+            if (value1 < value2) return w;
+            if (value2 < value1) return v;
+            return InternedCategorialMin(v.Value2(), w.Value2()) == w.Value2() ? w : v;
+        }
+
+    template <typename L, CategorialType S> inline PackedTCLexWeight<L, S>
+        Times(const PackedTCLexWeight<L, S> &w, const PackedTCLexWeight<L, S> &v) {
+            return PackedTCLexWeight<L, S>(Times(w.Value1(), v.Value1()),
+                    Times(w.Value2(), v.Value2()));
+        }
+
+    template <typename L, CategorialType S> inline PackedTCLexWeight<L, S>
+        Divide(const PackedTCLexWeight<L, S> &w, const PackedTCLexWeight<L, S> &v,
+                DivideType typ = DIVIDE_ANY) {
+            return PackedTCLexWeight<L, S>(Divide(w.Value1(), v.Value1(), typ),
+                    Divide(w.Value2(), v.Value2(), typ));
+        }
+
+
+    // Arc with a packed TCLex weight (20 bytes, trivially copyable).
+    template <typename L = int, CategorialType S = CATEGORIAL_LEFT>
+        struct PackedTCLexArc {
+            typedef L Label;
+            typedef PackedTCLexWeight<L, S> Weight;
+            typedef int StateId;
+
+            PackedTCLexArc(Label i, Label o, const Weight& w, StateId s)
+                : ilabel(i), olabel(o), weight(w), nextstate(s) {}
+
+            PackedTCLexArc() {}
+
+            static const string &Type() {
+                static const string type = Weight::Type();
+                return type;
+            }
+
+            Label ilabel;
+            Label olabel;
+            Weight weight;
+            StateId nextstate;
+        };
+
+}  // namespace fst
+
+#endif  // FST_LIB_PACKED_TCLEX_WEIGHT_H__
@@ -0,0 +1,232 @@
+// parallel-determinize.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Weighted subset construction on several threads, for acceptors over a
+// left semiring with the path property (such as the TCLex semiring). The
+// frontier of new subsets is expanded level by level; each level is split
+// between threads, which share a subset-to-state table cut in shards with
+// one lock each. The result is the one of Determinize() up to the
+// numbering of states.
+//
+// Weights of a right semiring which is not also a left one (such as the
+// right categorial semiring) are factored on the right instead: arcs
+// multiply residuals on their left, and residuals are divided by the
+// common weight on the right. Run on a reversed fst whose weights are
+// still in the order of the original paths, this determinizes the
+// original fst from its end (read backwards, its reverse is
+// deterministic).
+//
+// Weights must be safe to use from several threads at once, which is not
+// the case of the interned categorial weights (their pool is per thread).
+
+#ifndef FST_UTILS_PARALLEL_DETERMINIZE_H__
+#define FST_UTILS_PARALLEL_DETERMINIZE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <fst/vector-fst.h>
+
+#include "parallel.h"
+
+namespace fst {
+
+    template <class Arc>
+        class ParallelDeterminizer {
+            public:
+                typedef typename Arc::StateId StateId;
+                typedef typename Arc::Label Label;
+                typedef typename Arc::Weight Weight;
+
+                ParallelDeterminizer(const VectorFst<Arc> &ifst, int num_threads, float delta = kDelta)
+                    : ifst_(ifst), num_threads_(num_threads), delta_(delta),
+                    right_(!(Weight::Properties() & kLeftSemiring)), num_states_(0) {}
+
+                void Determinize(MutableFst<Arc> *ofst) {
+                    ofst->DeleteStates();
+                    ofst->SetInputSymbols(ifst_.InputSymbols());
+                    ofst->SetOutputSymbols(ifst_.OutputSymbols());
+                    if(ifst_.Start() == kNoStateId) return;
+
+                    vector<Task> frontier(1);
+                    frontier[0].subset.push_back(Element(ifst_.Start(), Weight::One()));
+                    frontier[0].state = FindOrAdd(frontier[0].subset, 0);
+                    ofst->SetStart(ofst->AddState());
+
+                    while(!frontier.empty()) {
+                        vector<Expansion> expansions(frontier.size());
+                        // small levels are not worth waking up threads
+                        int num_threads = frontier.size() < kMinParallelLevel ? 1 : num_threads_;
+                        ParallelFor(frontier.size(), num_threads, [&](size_t i) {
+                            Expand(frontier[i].subset, &expansions[i]);
+                        });
+
+                        // states may have been numbered in any order by the threads
+                        while(ofst->NumStates() < num_states_) ofst->AddState();
+                        vector<Task> next;
+                        for(size_t i = 0; i < frontier.size(); i++) {
+                            Expansion &expansion = expansions[i];
+                            ofst->SetFinal(frontier[i].state, expansion.final);
+                            for(size_t j = 0; j < expansion.arcs.size(); j++)
+                                ofst->AddArc(frontier[i].state, expansion.arcs[j]);
+                            std::move(expansion.added.begin(), expansion.added.end(), std::back_inserter(next));
+                        }
+                        frontier.swap(next);
+                    }
+                }
+
+            private:
+                static const size_t kNumShards = 64;
+                static const size_t kMinParallelLevel = 64;
+
+                struct Element {
+                    StateId state;
+                    Weight weight;      // residual weight of the state in the subset
+                    Element(StateId s, const Weight &w) : state(s), weight(w) {}
+                };
+                typedef vector<Element> Subset;
+
+                struct SubsetHash {
+                    size_t operator()(const Subset &subset) const {
+                        size_t h = subset.size();
+                        for(size_t i = 0; i < subset.size(); i++)
+                            h = h * 7853 ^ (subset[i].state * 7867 + subset[i].weight.Hash());
+                        return h;
+                    }
+                };
+
+                struct SubsetEqual {
+                    bool operator()(const Subset &a, const Subset &b) const {
+                        if(a.size() != b.size()) return false;
+                        for(size_t i = 0; i < a.size(); i++)
+                            if(a[i].state != b[i].state || a[i].weight != b[i].weight) return false;
+                        return true;
+                    }
+                };
+
+                struct Shard {
+                    std::mutex mutex;
+                    std::unordered_map<Subset, StateId, SubsetHash, SubsetEqual> ids;
+                };
+
+                struct Task {
+                    StateId state;
+                    Subset subset;
+                };
+
+                struct Expansion {
+                    Weight final;
+                    vector<Arc> arcs;
+                    vector<Task> added;   // subsets which were given a new state
+                };
+
+                // Returns the state of a subset; *added tells whether it is new.
+                StateId FindOrAdd(const Subset &subset, bool *added) {
+                    size_t hash = SubsetHash()(subset);
+                    Shard &shard = shards_[hash % kNumShards];
+                    std::lock_guard<std::mutex> lock(shard.mutex);
+                    typename std::unordered_map<Subset, StateId, SubsetHash, SubsetEqual>::iterator found = shard.ids.find(subset);
+                    if(found != shard.ids.end()) {
+                        if(added) *added = false;
+                        return found->second;
+                    }
+                    StateId state = num_states_++;
+                    shard.ids.insert(std::make_pair(subset, state));
+                    if(added) *added = true;
+                    return state;
+                }
+
+                struct LabeledElement {
+                    Label label;
+                    StateId state;
+                    Weight weight;
+                    bool operator<(const LabeledElement &other) const {
+                        return label < other.label || (label == other.label && state < other.state);
+                    }
+                };
+
+                // Residual extended by the weight of an arc or a final
+                // weight: on its right, or on its left in a right semiring.
+                Weight Extend(const Weight &residual, const Weight &weight) const {
+                    return right_ ? Times(weight, residual) : Times(residual, weight);
+                }
+
+                void Expand(const Subset &subset, Expansion *expansion) {
+                    expansion->final = Weight::Zero();
+                    vector<LabeledElement> elements;
+                    for(size_t i = 0; i < subset.size(); i++) {
+                        const Element &element = subset[i];
+                        expansion->final = Plus(expansion->final, Extend(element.weight, ifst_.Final(element.state)));
+                        for(ArcIterator<VectorFst<Arc> > aiter(ifst_, element.state); !aiter.Done(); aiter.Next()) {
+                            const Arc &arc = aiter.Value();
+                            if(arc.weight == Weight::Zero()) continue;
+                            LabeledElement labeled = {arc.ilabel, arc.nextstate, Extend(element.weight, arc.weight)};
+                            elements.push_back(labeled);
+                        }
+                    }
+                    std::stable_sort(elements.begin(), elements.end());
+
+                    for(size_t begin = 0; begin < elements.size(); ) {
+                        size_t end = begin;
+                        Weight common = Weight::Zero();
+                        Subset next;
+                        for(; end < elements.size() && elements[end].label == elements[begin].label; end++) {
+                            common = Plus(common, elements[end].weight);
+                            if(!next.empty() && next.back().state == elements[end].state)
+                                next.back().weight = Plus(next.back().weight, elements[end].weight);
+                            else
+                                next.push_back(Element(elements[end].state, elements[end].weight));
+                        }
+                        for(size_t i = 0; i < next.size(); i++)
+                            next[i].weight = Divide(next[i].weight, common, right_ ? DIVIDE_RIGHT : DIVIDE_LEFT).Quantize(delta_);
+                        bool added = false;
+                        StateId nextstate = FindOrAdd(next, &added);
+                        expansion->arcs.push_back(Arc(elements[begin].label, elements[begin].label, common, nextstate));
+                        if(added) {
+                            expansion->added.push_back(Task());
+                            expansion->added.back().state = nextstate;
+                            expansion->added.back().subset.swap(next);
+                        }
+                        begin = end;
+                    }
+                }
+
+                const VectorFst<Arc> &ifst_;
+                int num_threads_;
+                float delta_;
+                bool right_;                    // factor weights on the right
+                std::atomic<StateId> num_states_;
+                Shard shards_[kNumShards];
+
+                DISALLOW_COPY_AND_ASSIGN(ParallelDeterminizer);
+        };
+
+    // Determinizes an epsilon-free acceptor on num_threads threads.
+    template <class Arc>
+        void ParallelDeterminize(const VectorFst<Arc> &ifst, MutableFst<Arc> *ofst, int num_threads) {
+            ParallelDeterminizer<Arc> determinizer(ifst, num_threads);
+            determinizer.Determinize(ofst);
+        }
+
+}  // namespace fst
+
+#endif  // FST_UTILS_PARALLEL_DETERMINIZE_H__
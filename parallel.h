@@ -0,0 +1,120 @@
+// parallel.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Minimal thread pool helpers shared by the batch modes of the tools.
+
+#ifndef FST_UTILS_PARALLEL_H__
+#define FST_UTILS_PARALLEL_H__
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace fst {
+
+    // Calls f(i) for every i in [0, n) from num_threads threads. Indices are
+    // handed out one at a time so that uneven items balance; f must be
+    // safe to call concurrently on different indices.
+    template <class F>
+        void ParallelFor(size_t n, int num_threads, F f) {
+            if (num_threads <= 1 || n <= 1) {
+                for (size_t i = 0; i < n; ++i)
+                    f(i);
+                return;
+            }
+            std::atomic<size_t> next(0);
+            std::vector<std::thread> threads;
+            for (int t = 0; t < num_threads && static_cast<size_t>(t) < n; ++t) {
+                threads.push_back(std::thread([&]() {
+                    for (size_t i = next++; i < n; i = next++)
+                        f(i);
+                }));
+            }
+            for (size_t t = 0; t < threads.size(); ++t)
+                threads[t].join();
+        }
+
+    // Fixed set of threads running scheduled tasks in order of submission.
+    // A task is called with the index of the thread which runs it, in
+    // [0, NumThreads()), so that it can use data owned by that thread.
+    // Schedule() blocks while max_pending tasks are waiting, so that a
+    // producer cannot run far ahead of the workers; the destructor runs
+    // the remaining tasks and joins the threads.
+    class ThreadPool {
+        public:
+            explicit ThreadPool(int num_threads, size_t max_pending = 0)
+                : max_pending_(max_pending > 0 ? max_pending : 2 * std::max(num_threads, 1)), done_(false) {
+                for (int t = 0; t < std::max(num_threads, 1); ++t)
+                    threads_.push_back(std::thread([this, t]() { Run(t); }));
+            }
+
+            ~ThreadPool() {
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    done_ = true;
+                }
+                available_.notify_all();
+                for (size_t t = 0; t < threads_.size(); ++t)
+                    threads_[t].join();
+            }
+
+            int NumThreads() const { return threads_.size(); }
+
+            void Schedule(const std::function<void(int)> &task) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                taken_.wait(lock, [this]() { return tasks_.size() < max_pending_; });
+                tasks_.push_back(task);
+                available_.notify_one();
+            }
+
+        private:
+            void Run(int worker) {
+                while (true) {
+                    std::function<void(int)> task;
+                    {
+                        std::unique_lock<std::mutex> lock(mutex_);
+                        available_.wait(lock, [this]() { return done_ || !tasks_.empty(); });
+                        if (tasks_.empty()) return;
+                        task = tasks_.front();
+                        tasks_.pop_front();
+                        taken_.notify_one();
+                    }
+                    task(worker);
+                }
+            }
+
+            size_t max_pending_;
+            bool done_;
+            std::mutex mutex_;
+            std::condition_variable available_;     // a task was added, or done_
+            std::condition_variable taken_;         // a task was removed
+            std::deque<std::function<void(int)> > tasks_;
+            std::vector<std::thread> threads_;
+
+            ThreadPool(const ThreadPool &);
+            void operator=(const ThreadPool &);
+    };
+
+}  // namespace fst
+
+#endif  // FST_UTILS_PARALLEL_H__
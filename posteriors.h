@@ -0,0 +1,177 @@
+// posteriors.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Arc posteriors of lattices whose weights are -log probabilities in the
+// tropical semiring, as computed by fstposteriors: forward-backward in
+// topological order for acyclic lattices, ShortestDistance() in the log
+// semiring otherwise.
+
+#ifndef FST_UTILS_POSTERIORS_H__
+#define FST_UTILS_POSTERIORS_H__
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "log-add-kernels.h"
+
+namespace fst {
+
+    /* topological order of the states (Kahn's algorithm), false if the fst has a cycle */
+    inline bool TopologicalOrder(const StdVectorFst &input, std::vector<int> *order) {
+        int numStates = input.NumStates();
+        std::vector<int> inDegree(numStates, 0);
+        for(int state = 0; state < numStates; state++) {
+            for(ArcIterator<StdVectorFst> aiter(input, state); !aiter.Done(); aiter.Next())
+                inDegree[aiter.Value().nextstate]++;
+        }
+        order->clear();
+        order->reserve(numStates);
+        for(int state = 0; state < numStates; state++)
+            if(inDegree[state] == 0) order->push_back(state);
+        for(size_t i = 0; i < order->size(); i++) {
+            for(ArcIterator<StdVectorFst> aiter(input, (*order)[i]); !aiter.Done(); aiter.Next()) {
+                int next = aiter.Value().nextstate;
+                if(--inDegree[next] == 0) order->push_back(next);
+            }
+        }
+        return (int) order->size() == numStates;
+    }
+
+    /* confusion network: for each position, posterior of each label (0 for
+     * no word at that position)
+     */
+    typedef std::vector<std::map<int, double> > Sausage;
+
+    /* forward-backward directly on the tropical arcs of an acyclic lattice,
+     * visiting states in topological order (no copy, no reversed fst). Each
+     * state sums its incoming (forward) or outgoing (backward) arcs in one
+     * batch, using the incoming arcs stored contiguously per state.
+     * If sausage is not null, arc posteriors are also gathered in bins by the
+     * expected number of words before the source state of the arc, rounded,
+     * but never before the bin following a word which can precede the arc:
+     * a path puts at most one word in each bin, whose mass is then at most 1.
+     */
+    inline void AcyclicPosteriors(StdVectorFst *input, const std::vector<int> &order, Sausage *sausage) {
+        int numStates = input->NumStates();
+
+        // incoming arcs, grouped by destination state
+        std::vector<int> firstIncoming(numStates + 1, 0);
+        for(int state = 0; state < numStates; state++) {
+            for(ArcIterator<StdVectorFst> aiter(*input, state); !aiter.Done(); aiter.Next())
+                firstIncoming[aiter.Value().nextstate + 1]++;
+        }
+        for(int state = 0; state < numStates; state++) firstIncoming[state + 1] += firstIncoming[state];
+        std::vector<int> sources(firstIncoming[numStates]);
+        std::vector<double> weights(firstIncoming[numStates]);
+        std::vector<int> fill(firstIncoming.begin(), firstIncoming.end() - 1);
+        size_t maxArcs = 1;
+        for(int state = 0; state < numStates; state++) {
+            for(ArcIterator<StdVectorFst> aiter(*input, state); !aiter.Done(); aiter.Next()) {
+                const StdArc &arc = aiter.Value();
+                sources[fill[arc.nextstate]] = state;
+                weights[fill[arc.nextstate]++] = arc.weight.Value();
+            }
+            maxArcs = std::max(maxArcs, input->NumArcs(state) + 1);
+        }
+        for(int state = 0; state < numStates; state++)
+            maxArcs = std::max(maxArcs, (size_t) (firstIncoming[state + 1] - firstIncoming[state] + 1));
+
+        std::vector<double> alpha(numStates);
+        std::vector<double> beta(numStates);
+        std::vector<double> batch(maxArcs);
+        for(int i = 0; i < numStates; i++) {
+            int state = order[i];
+            size_t size = 0;
+            if(state == input->Start()) batch[size++] = 0;
+            for(int arc = firstIncoming[state]; arc < firstIncoming[state + 1]; arc++)
+                batch[size++] = alpha[sources[arc]] + weights[arc];
+            alpha[state] = LogSum(batch.data(), size);
+        }
+        for(int i = numStates - 1; i >= 0; i--) {
+            int state = order[i];
+            size_t size = 0;
+            batch[size++] = input->Final(state).Value();
+            for(ArcIterator<StdVectorFst> aiter(*input, state); !aiter.Done(); aiter.Next()) {
+                const StdArc &arc = aiter.Value();
+                batch[size++] = arc.weight.Value() + beta[arc.nextstate];
+            }
+            beta[state] = LogSum(batch.data(), size);
+        }
+
+        double total = beta[input->Start()];
+        std::vector<double> position(numStates, 0);     // expected number of words before a state
+        std::vector<double> occupancy(numStates, 0);    // posterior of the state
+        std::vector<size_t> firstBin(numStates, 0);     // bin after the words which can precede a state
+        for(int i = 0; i < numStates; i++) {
+            int state = order[i];
+            if(occupancy[state] > 0) position[state] /= occupancy[state];
+            size_t bin = std::max(firstBin[state], (size_t) floor(position[state] + 0.5));
+            for(MutableArcIterator<StdVectorFst> aiter(input, state); !aiter.Done(); aiter.Next()) {
+                const StdArc &arc = aiter.Value();
+                double posterior = exp(-(alpha[state] + arc.weight.Value() + beta[arc.nextstate] - total));
+                if(sausage != NULL && posterior > 0) {
+                    occupancy[arc.nextstate] += posterior;
+                    position[arc.nextstate] += posterior * (position[state] + (arc.ilabel != 0 ? 1 : 0));
+                    firstBin[arc.nextstate] = std::max(firstBin[arc.nextstate], bin + (arc.ilabel != 0 ? 1 : 0));
+                    if(arc.ilabel != 0) {
+                        if(bin >= sausage->size()) sausage->resize(bin + 1);
+                        (*sausage)[bin][arc.ilabel] += posterior;
+                    }
+                }
+                aiter.SetValue(StdArc(arc.ilabel, arc.olabel, posterior, arc.nextstate));
+            }
+        }
+        if(sausage != NULL) {
+            for(size_t bin = 0; bin < sausage->size(); bin++) {
+                double sum = 0;
+                for(std::map<int, double>::const_iterator i = (*sausage)[bin].begin(); i != (*sausage)[bin].end(); i++) sum += i->second;
+                if(sum < 1 - 1e-6) (*sausage)[bin][0] = 1 - sum;
+                else if(sum > 1)  // rounding errors only
+                    for(std::map<int, double>::iterator i = (*sausage)[bin].begin(); i != (*sausage)[bin].end(); i++) i->second /= sum;
+            }
+        }
+    }
+
+    /* general case, for lattices with cycles */
+    inline void CyclicPosteriors(StdVectorFst *old) {
+        VectorFst<LogArc> input;
+        Map(*old, &input, StdToLogMapper());
+        int numStates = input.NumStates();
+
+        std::vector<LogArc::Weight> alpha(numStates, 0);
+        std::vector<LogArc::Weight> beta(numStates, 0);
+
+        ShortestDistance<LogArc>(input, &alpha, false);
+        ShortestDistance<LogArc>(input, &beta, true);
+
+        for(int64 state = 0; state < numStates; state++) {
+            for(MutableArcIterator<VectorFst<LogArc> > aiter(&input, state); !aiter.Done(); aiter.Next()) {
+                const LogArc &arc = aiter.Value();
+                double posterior = exp(-(alpha[state].Value() + arc.weight.Value() + beta[arc.nextstate].Value() - beta[input.Start()].Value()));
+                aiter.SetValue(LogArc(arc.ilabel, arc.olabel, posterior, arc.nextstate));
+            }
+        }
+        Map(input, old, LogToStdMapper());
+    }
+
+}  // namespace fst
+
+#endif  // FST_UTILS_POSTERIORS_H__
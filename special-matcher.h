@@ -0,0 +1,674 @@
+// special-matcher.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Single-level matcher for <rho>, <sigma> and <phi> arcs, and the phi
+// closure tables it can follow phi arcs with, as used by
+// fstcompose-specials.
+
+#ifndef FST_UTILS_SPECIAL_MATCHER_H__
+#define FST_UTILS_SPECIAL_MATCHER_H__
+
+#include <algorithm>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include <fst/fstlib.h>
+
+namespace fst {
+
+    // Failure-resolved transitions of the states with phi arcs, as in
+    // Aho-Corasick automata: for each label, the arcs found by following phi
+    // arcs from the state, with the weight of the phi arcs followed. Tables
+    // are built first for the states backed off to by most other states, then
+    // for the others, while they fit in a memory budget; from a state without
+    // a table, phi arcs are followed up to the first state which has one.
+    // Arcs are referenced in place, so the fst must store them as arrays
+    // (VectorFst, ConstFst), and must not change while the tables are used.
+    template <class A>
+    class PhiClosure
+    {
+        public:
+            typedef A Arc;
+            typedef typename Arc::StateId StateId;
+            typedef typename Arc::Label Label;
+            typedef typename Arc::Weight Weight;
+
+            struct Entry {
+                Label label;
+                const Arc *arcs;
+                size_t begin, end;
+                Weight weight;                      // of the phi arcs followed
+            };
+
+            struct Table {
+                vector<Entry> entries;              // by label
+                const Arc *loop_arcs;               // phi self-loop at the end of the phi arcs, if not NULL
+                size_t loop;
+                Weight loop_weight;
+            };
+
+            PhiClosure(const ExpandedFst<Arc> &fst, MatchType match_type, Label phi, size_t max_bytes)
+                : fst_(fst), match_type_(match_type), phi_(phi), bytes_(0) {
+                StateId num_states = fst_.NumStates();
+                vector<size_t> backoffs(num_states, 0);
+                vector<StateId> states;
+                for(StateId s = 0; s < num_states; s++) {
+                    const Arc *arcs;
+                    size_t num_arcs, position;
+                    if(!Arcs(s, &arcs, &num_arcs)) return;
+                    if(!FindPhi(arcs, num_arcs, &position) || arcs[position].nextstate == s) continue;
+                    backoffs[arcs[position].nextstate]++;
+                    states.push_back(s);
+                }
+                std::stable_sort(states.begin(), states.end(), ByBackoffs(backoffs));
+                vector<size_t> bounds(num_states, kUnknown);
+                vector<bool> visiting(num_states, false);
+                for(size_t i = 0; i < states.size(); i++) {
+                    size_t bound = UpperBound(states[i], &bounds);
+                    if(bound == kCycle || bytes_ + Bytes(bound) > max_bytes) continue;
+                    Table table;
+                    if(!Compute(states[i], &table, &visiting)) continue;
+                    bytes_ += Bytes(table.entries.size());
+                    tables_[states[i]].entries.swap(table.entries);
+                    tables_[states[i]].loop_arcs = table.loop_arcs;
+                    tables_[states[i]].loop = table.loop;
+                    tables_[states[i]].loop_weight = table.loop_weight;
+                }
+            }
+
+            // table of a state, NULL if it has none
+            const Table *Find(StateId s) const {
+                typename std::unordered_map<StateId, Table>::const_iterator found = tables_.find(s);
+                return found != tables_.end() ? &found->second : NULL;
+            }
+
+            // entry of a label in a table, NULL if it has none
+            static const Entry *Find(const Table &table, Label label) {
+                size_t low = 0, high = table.entries.size();
+                while(low < high) {
+                    size_t middle = (low + high) / 2;
+                    if(table.entries[middle].label < label) low = middle + 1;
+                    else high = middle;
+                }
+                return low < table.entries.size() && table.entries[low].label == label ? &table.entries[low] : NULL;
+            }
+
+            size_t NumTables() const { return tables_.size(); }
+            size_t NumBytes() const { return bytes_; }
+
+        private:
+            static const size_t kUnknown = static_cast<size_t>(-1);
+            static const size_t kCycle = static_cast<size_t>(-2);
+            static const size_t kInProgress = static_cast<size_t>(-3);
+
+            struct ByBackoffs {
+                const vector<size_t> &backoffs;
+                explicit ByBackoffs(const vector<size_t> &b) : backoffs(b) {}
+                bool operator()(StateId a, StateId b) const { return backoffs[a] > backoffs[b]; }
+            };
+
+            static size_t Bytes(size_t num_entries) {
+                return num_entries * sizeof(Entry) + sizeof(Table) + 4 * sizeof(void *);
+            }
+
+            Label MatchLabel(const Arc &arc) const {
+                return match_type_ == MATCH_INPUT ? arc.ilabel : arc.olabel;
+            }
+
+            bool Arcs(StateId s, const Arc **arcs, size_t *num_arcs) const {
+                ArcIteratorData<Arc> data;
+                fst_.InitArcIterator(s, &data);
+                if(data.base != 0) {
+                    delete data.base;
+                    return false;
+                }
+                *arcs = data.arcs;
+                *num_arcs = data.narcs;
+                return true;
+            }
+
+            bool FindPhi(const Arc *arcs, size_t num_arcs, size_t *position) const {
+                size_t low = 0, high = num_arcs;
+                while(low < high) {
+                    size_t middle = (low + high) / 2;
+                    if(MatchLabel(arcs[middle]) < phi_) low = middle + 1;
+                    else high = middle;
+                }
+                *position = low;
+                return low < num_arcs && MatchLabel(arcs[low]) == phi_;
+            }
+
+            // number of entries of the table of a state is at most its number
+            // of arcs plus that of the state it backs off to; the phi arcs
+            // are followed without recursion, with the states on the way
+            // marked in progress until the end of the chain gives its bound
+            size_t UpperBound(StateId s, vector<size_t> *bounds) const {
+                vector<StateId> chain;
+                size_t bound = 0;
+                for(;;) {
+                    const Table *table = Find(s);
+                    if(table) {
+                        bound = table->entries.size();
+                        break;
+                    }
+                    if((*bounds)[s] == kInProgress) {
+                        bound = kCycle;
+                        break;
+                    }
+                    if((*bounds)[s] != kUnknown) {
+                        bound = (*bounds)[s];
+                        break;
+                    }
+                    (*bounds)[s] = kInProgress;
+                    chain.push_back(s);
+                    const Arc *arcs = NULL;
+                    size_t num_arcs = 0, position;
+                    Arcs(s, &arcs, &num_arcs);
+                    if(!FindPhi(arcs, num_arcs, &position) || arcs[position].nextstate == s) break;
+                    s = arcs[position].nextstate;
+                }
+                for(size_t i = chain.size(); i > 0; i--) {
+                    if(bound != kCycle) bound += fst_.NumArcs(chain[i - 1]);
+                    (*bounds)[chain[i - 1]] = bound;
+                }
+                return bound;
+            }
+
+            // tables of the states from s to the first one which has a table
+            // or no phi arc to another state, built from the end of the
+            // chain; false on a cycle of phi arcs, found by the states of the
+            // chain being marked in visiting
+            bool Compute(StateId s, Table *table, vector<bool> *visiting) const {
+                vector<StateId> chain;
+                const Table *backoff = NULL;
+                bool cycle = false;
+                for(;;) {
+                    if((*visiting)[s]) {
+                        cycle = true;
+                        break;
+                    }
+                    (*visiting)[s] = true;
+                    chain.push_back(s);
+                    const Arc *arcs = NULL;
+                    size_t num_arcs = 0, position;
+                    Arcs(s, &arcs, &num_arcs);
+                    if(!FindPhi(arcs, num_arcs, &position) || arcs[position].nextstate == s) break;
+                    s = arcs[position].nextstate;
+                    backoff = Find(s);
+                    if(backoff) break;
+                }
+                for(size_t i = 0; i < chain.size(); i++) (*visiting)[chain[i]] = false;
+                if(cycle) return false;
+                Table computed[2];
+                for(size_t i = chain.size(); i > 0; i--) {
+                    Table *current = i == 1 ? table : &computed[i % 2];
+                    Merge(chain[i - 1], backoff, current);
+                    backoff = current;
+                }
+                return true;
+            }
+
+            // arcs of the state for the labels it has, entries of the table
+            // of the state it backs off to for the others; epsilons are not
+            // looked up through phi arcs, so they get no entry
+            void Merge(StateId s, const Table *backoff, Table *table) const {
+                const Arc *arcs = NULL;
+                size_t num_arcs = 0, position;
+                Arcs(s, &arcs, &num_arcs);
+                table->entries.clear();
+                table->loop_arcs = NULL;
+                bool has_phi = FindPhi(arcs, num_arcs, &position);
+                Weight weight = Weight::One();
+                if(has_phi && arcs[position].nextstate == s) {
+                    table->loop_arcs = arcs;
+                    table->loop = position;
+                    table->loop_weight = Weight::One();
+                    backoff = NULL;
+                } else if(has_phi) {
+                    weight = arcs[position].weight;
+                    if(backoff->loop_arcs) {
+                        table->loop_arcs = backoff->loop_arcs;
+                        table->loop = backoff->loop;
+                        table->loop_weight = Times(weight, backoff->loop_weight);
+                    }
+                } else {
+                    backoff = NULL;
+                }
+                size_t next = 0;
+                for(size_t begin = 0; begin < num_arcs; ) {
+                    Label label = MatchLabel(arcs[begin]);
+                    size_t end = begin + 1;
+                    while(end < num_arcs && MatchLabel(arcs[end]) == label) end++;
+                    if(backoff) {
+                        for(; next < backoff->entries.size() && backoff->entries[next].label < label; next++)
+                            AddBackoff(backoff->entries[next], weight, table);
+                        if(next < backoff->entries.size() && backoff->entries[next].label == label) next++;
+                    }
+                    if(label != phi_ && label != 0) {
+                        Entry entry = {label, arcs, begin, end, Weight::One()};
+                        table->entries.push_back(entry);
+                    }
+                    begin = end;
+                }
+                if(backoff) {
+                    for(; next < backoff->entries.size(); next++)
+                        AddBackoff(backoff->entries[next], weight, table);
+                }
+            }
+
+            static void AddBackoff(const Entry &entry, const Weight &weight, Table *table) {
+                Entry backoff = entry;
+                backoff.weight = Times(weight, entry.weight);
+                table->entries.push_back(backoff);
+            }
+
+            const ExpandedFst<Arc> &fst_;
+            MatchType match_type_;
+            Label phi_;
+            size_t bytes_;
+            std::unordered_map<StateId, Table> tables_;
+
+            DISALLOW_COPY_AND_ASSIGN(PhiClosure);
+    };
+
+    template <class A>
+    const size_t PhiClosure<A>::kUnknown;
+
+    template <class A>
+    const size_t PhiClosure<A>::kCycle;
+
+    template <class A>
+    const size_t PhiClosure<A>::kInProgress;
+
+    // Matcher for <rho>, <sigma> and <phi> arcs on a label-sorted fst, with
+    // the semantics of RhoMatcher<SigmaMatcher<PhiMatcher<SortedMatcher>>>
+    // (special arcs are rewritten with MATCHER_REWRITE_ALWAYS) in a single
+    // level:
+    //  - a label is looked up at the state, then at the end of its phi arcs
+    //    until a state has arcs with that label (a phi self-loop matches it);
+    //  - sigma arcs (also looked up through phi arcs) match any label, after
+    //    the regular arcs; unlike the stacked matchers, a phi self-loop
+    //    does not match sigma, which would give the label a second path
+    //    through the phi arcs, besides the one of the regular lookup;
+    //  - rho arcs match labels which have neither regular nor sigma arcs;
+    //  - epsilons and the special labels themselves are matched as is;
+    //  - states which are not final take the final weight at the end of
+    //    their phi arcs.
+    // The position of the special arcs of each state is found once and
+    // cached, so that states without special arcs cost one binary search as
+    // with SortedMatcher. Special labels absent from the fst should be given
+    // as kNoLabel: the matcher then requires matching only if some are left.
+    // Phi arcs are followed until a state with a phi closure table, if given,
+    // where the label is found with a single lookup. Prepare() finds the
+    // special arcs of all states at once, in a read-only table shared by the
+    // copies of the matcher.
+    template <class F>
+    class SpecialMatcher : public MatcherBase<typename F::Arc>
+    {
+        public:
+            typedef F FST;
+            typedef typename F::Arc Arc;
+            typedef typename Arc::StateId StateId;
+            typedef typename Arc::Label Label;
+            typedef typename Arc::Weight Weight;
+
+            SpecialMatcher(const FST &fst, MatchType match_type,
+                    Label rho = kNoLabel, Label sigma = kNoLabel, Label phi = kNoLabel,
+                    const PhiClosure<Arc> *closure = NULL)
+                : fst_(fst.Copy()), match_type_(match_type), rho_(rho), sigma_(sigma), phi_(phi), closure_(closure) {
+                Init();
+            }
+
+            SpecialMatcher(const SpecialMatcher<F> &matcher, bool safe = false)
+                : fst_(matcher.fst_->Copy(safe)), match_type_(matcher.match_type_),
+                rho_(matcher.rho_), sigma_(matcher.sigma_), phi_(matcher.phi_), closure_(matcher.closure_),
+                prepared_(matcher.prepared_) {
+                Init();
+            }
+
+            // matcher on fst, a copy or a view of the fst of matcher which
+            // shares no reference counts with it (SharedFst), with the labels,
+            // closure and prepared table of matcher
+            SpecialMatcher(const FST &fst, const SpecialMatcher<F> &matcher)
+                : fst_(fst.Copy()), match_type_(matcher.match_type_),
+                rho_(matcher.rho_), sigma_(matcher.sigma_), phi_(matcher.phi_), closure_(matcher.closure_),
+                prepared_(matcher.prepared_) {
+                Init();
+            }
+
+            virtual ~SpecialMatcher() {
+                delete fst_;
+            }
+
+            virtual SpecialMatcher<F> *Copy(bool safe = false) const {
+                return new SpecialMatcher<F>(*this, safe);
+            }
+
+            virtual MatchType Type(bool test) const {
+                if(match_type_ == MATCH_NONE) return match_type_;
+                uint64 true_prop = match_type_ == MATCH_INPUT ? kILabelSorted : kOLabelSorted;
+                uint64 false_prop = match_type_ == MATCH_INPUT ? kNotILabelSorted : kNotOLabelSorted;
+                uint64 props = fst_->Properties(true_prop | false_prop, test);
+                if(props & true_prop) return match_type_;
+                if(props & false_prop) return MATCH_NONE;
+                return MATCH_UNKNOWN;
+            }
+
+            void SetState(StateId s) {
+                if(state_ == s) return;
+                state_ = s;
+                arcs_ = Arcs(s, &buffers_[0], &num_arcs_);
+                info_ = specials_ ? &Info(s, arcs_, num_arcs_) : &no_specials_;
+                loop_.nextstate = s;
+            }
+
+            bool Find(Label label) {
+                num_segments_ = 0;
+                current_loop_ = label == 0;
+                if(label == 0 || label == kNoLabel) {
+                    AddRange(arcs_, num_arcs_, *info_, 0, Weight::One(), kNoLabel, 0);
+                } else if(!specials_ || label == rho_ || label == sigma_ || label == phi_) {
+                    AddRange(arcs_, num_arcs_, *info_, label, Weight::One(), kNoLabel, 0);
+                } else {
+                    bool regular = Resolve(label, label, &buffers_[1]);
+                    bool sigma = sigma_ != kNoLabel && Resolve(sigma_, label, &buffers_[2]);
+                    if(!regular && !sigma && rho_ != kNoLabel) Resolve(rho_, label, &buffers_[3]);
+                }
+                segment_ = 0;
+                if(num_segments_ > 0) position_ = segments_[0].begin;
+                return !Done();
+            }
+
+            bool Done() const {
+                return !current_loop_ && segment_ >= num_segments_;
+            }
+
+            const Arc &Value() const {
+                if(current_loop_) return loop_;
+                const Segment &segment = segments_[segment_];
+                const Arc &arc = segment.arcs[position_];
+                if(segment.weight == Weight::One() && segment.rewrite == kNoLabel) return arc;
+                arc_ = arc;
+                arc_.weight = Times(segment.weight, arc.weight);
+                if(arc_.ilabel == segment.rewrite) arc_.ilabel = segment.label;
+                if(arc_.olabel == segment.rewrite) arc_.olabel = segment.label;
+                return arc_;
+            }
+
+            void Next() {
+                if(current_loop_) {
+                    current_loop_ = false;
+                    return;
+                }
+                if(++position_ < segments_[segment_].end) return;
+                if(++segment_ < num_segments_) position_ = segments_[segment_].begin;
+            }
+
+            virtual const FST &GetFst() const { return *fst_; }
+
+            virtual uint64 Properties(uint64 props) const {
+                if(!specials_) return props;
+                return props & ~(kIDeterministic | kNonIDeterministic | kODeterministic | kNonODeterministic |
+                        kString | kILabelSorted | kNotILabelSorted | kOLabelSorted | kNotOLabelSorted |
+                        kEpsilons | kNoEpsilons | kIEpsilons | kNoIEpsilons | kOEpsilons | kNoOEpsilons);
+            }
+
+            virtual uint32 Flags() const {
+                return specials_ && match_type_ != MATCH_NONE ? kRequireMatch : 0;
+            }
+
+            ssize_t Priority(StateId s) { return fst_->NumArcs(s); }
+
+            // final weight of a state, or as PhiMatcher, of the first final
+            // state at the end of its phi arcs (Zero at a phi self-loop)
+            Weight Final(StateId s) const {
+                Weight weight = Weight::One();
+                vector<Arc> buffer;
+                for(;;) {
+                    Weight final = fst_->Final(s);
+                    if(final != Weight::Zero() || phi_ == kNoLabel) return Times(weight, final);
+                    size_t num_arcs, begin, end;
+                    const Arc *arcs = Arcs(s, &buffer, &num_arcs);
+                    EqualRange(arcs, num_arcs, phi_, &begin, &end);
+                    if(begin == end || arcs[begin].nextstate == s) return Weight::Zero();
+                    weight = Times(weight, arcs[begin].weight);
+                    s = arcs[begin].nextstate;
+                }
+            }
+
+            void Prepare() {
+                InfoMap *infos = new InfoMap();
+                for(StateIterator<FST> siter(*fst_); specials_ && !siter.Done(); siter.Next()) {
+                    size_t num_arcs;
+                    const Arc *arcs = Arcs(siter.Value(), &buffers_[0], &num_arcs);
+                    StateInfo info = ComputeInfo(siter.Value(), arcs, num_arcs);
+                    if(info.phi != kNone || info.sigma_begin < info.sigma_end || info.rho_begin < info.rho_end)
+                        (*infos)[siter.Value()] = info;
+                }
+                prepared_.reset(infos);
+                infos_.clear();
+                state_ = kNoStateId;
+            }
+
+        private:
+            static const size_t kNone = static_cast<size_t>(-1);
+
+            // position of the special arcs of a state
+            struct StateInfo {
+                size_t phi;                         // kNone if no phi arc
+                const typename PhiClosure<Arc>::Table *closure;     // NULL if none
+                size_t sigma_begin, sigma_end;
+                size_t rho_begin, rho_end;
+            };
+
+            typedef std::unordered_map<StateId, StateInfo> InfoMap;
+
+            // arcs of some state from which matches are returned
+            struct Segment {
+                const Arc *arcs;
+                size_t begin, end;
+                Weight weight;                      // of the phi arcs followed
+                Label rewrite;                      // special label replaced by label in matches
+                Label label;
+            };
+
+            void Init() {
+                specials_ = rho_ != kNoLabel || sigma_ != kNoLabel || phi_ != kNoLabel;
+                state_ = kNoStateId;
+                num_segments_ = segment_ = 0;
+                current_loop_ = false;
+                if(match_type_ == MATCH_INPUT) loop_ = Arc(kNoLabel, 0, Weight::One(), kNoStateId);
+                else loop_ = Arc(0, kNoLabel, Weight::One(), kNoStateId);
+                StateInfo none = {kNone, NULL, 0, 0, 0, 0};
+                no_specials_ = none;
+            }
+
+            Label MatchLabel(const Arc &arc) const {
+                return match_type_ == MATCH_INPUT ? arc.ilabel : arc.olabel;
+            }
+
+            // arcs of a state as an array, copied in buffer if the fst does not store them so
+            const Arc *Arcs(StateId s, vector<Arc> *buffer, size_t *num_arcs) const {
+                ArcIteratorData<Arc> data;
+                fst_->InitArcIterator(s, &data);
+                if(data.base == 0) {
+                    *num_arcs = data.narcs;
+                    return data.arcs;
+                }
+                buffer->clear();
+                for(; !data.base->Done(); data.base->Next()) buffer->push_back(data.base->Value());
+                delete data.base;
+                *num_arcs = buffer->size();
+                return buffer->empty() ? 0 : &(*buffer)[0];
+            }
+
+            void EqualRange(const Arc *arcs, size_t num_arcs, Label label, size_t *begin, size_t *end) const {
+                size_t low = 0, high = num_arcs;
+                while(low < high) {
+                    size_t middle = (low + high) / 2;
+                    if(MatchLabel(arcs[middle]) < label) low = middle + 1;
+                    else high = middle;
+                }
+                *begin = low;
+                for(high = low; high < num_arcs && MatchLabel(arcs[high]) == label; high++);
+                *end = high;
+            }
+
+            // states without special arcs are not in the prepared table
+            const StateInfo &Info(StateId s, const Arc *arcs, size_t num_arcs) {
+                if(prepared_) {
+                    typename InfoMap::const_iterator found = prepared_->find(s);
+                    return found != prepared_->end() ? found->second : no_specials_;
+                }
+                typename InfoMap::iterator found = infos_.find(s);
+                if(found != infos_.end()) return found->second;
+                return infos_.insert(std::make_pair(s, ComputeInfo(s, arcs, num_arcs))).first->second;
+            }
+
+            StateInfo ComputeInfo(StateId s, const Arc *arcs, size_t num_arcs) const {
+                StateInfo info = no_specials_;
+                size_t begin, end;
+                if(phi_ != kNoLabel) {
+                    EqualRange(arcs, num_arcs, phi_, &begin, &end);
+                    if(begin < end) info.phi = begin;
+                    if(begin < end && closure_) info.closure = closure_->Find(s);
+                }
+                if(sigma_ != kNoLabel) EqualRange(arcs, num_arcs, sigma_, &info.sigma_begin, &info.sigma_end);
+                if(rho_ != kNoLabel) EqualRange(arcs, num_arcs, rho_, &info.rho_begin, &info.rho_end);
+                return info;
+            }
+
+            // adds the arcs of a state with a label, false if there are none
+            bool AddRange(const Arc *arcs, size_t num_arcs, const StateInfo &info, Label label, const Weight &weight, Label rewrite, Label rewritten) {
+                Segment &segment = segments_[num_segments_];
+                if(label == sigma_ && label != kNoLabel) {
+                    segment.begin = info.sigma_begin;
+                    segment.end = info.sigma_end;
+                } else if(label == rho_ && label != kNoLabel) {
+                    segment.begin = info.rho_begin;
+                    segment.end = info.rho_end;
+                } else {
+                    EqualRange(arcs, num_arcs, label, &segment.begin, &segment.end);
+                }
+                if(segment.begin == segment.end) return false;
+                segment.arcs = arcs;
+                segment.weight = weight;
+                segment.rewrite = rewrite;
+                segment.label = rewritten;
+                num_segments_++;
+                return true;
+            }
+
+            // adds the arcs with label at the end of the phi arcs from the
+            // current state; special arcs are rewritten to match
+            bool Resolve(Label label, Label match, vector<Arc> *buffer) {
+                Label rewrite = label == match ? kNoLabel : label;
+                const Arc *arcs = arcs_;
+                size_t num_arcs = num_arcs_;
+                const StateInfo *info = info_;
+                StateId state = state_;
+                Weight weight = Weight::One();
+                while(!AddRange(arcs, num_arcs, *info, label, weight, rewrite, match)) {
+                    if(info->phi == kNone) return false;
+                    if(info->closure) return AddClosure(*info->closure, label, match, weight);
+                    const Arc &phi = arcs[info->phi];
+                    if(phi.nextstate == state) {
+                        // a phi self-loop consumes regular labels only:
+                        // the regular lookup stopped before it or took it
+                        if(label != match) return false;
+                        Segment &segment = segments_[num_segments_++];
+                        segment.arcs = arcs;
+                        segment.begin = info->phi;
+                        segment.end = info->phi + 1;
+                        segment.weight = weight;
+                        segment.rewrite = phi_;
+                        segment.label = match;
+                        return true;
+                    }
+                    weight = Times(weight, phi.weight);
+                    state = phi.nextstate;
+                    arcs = Arcs(state, buffer, &num_arcs);
+                    info = &Info(state, arcs, num_arcs);
+                }
+                return true;
+            }
+
+            // adds the arcs with label given by a phi closure table
+            bool AddClosure(const typename PhiClosure<Arc>::Table &table, Label label, Label match, const Weight &weight) {
+                Segment &segment = segments_[num_segments_];
+                const typename PhiClosure<Arc>::Entry *entry = PhiClosure<Arc>::Find(table, label);
+                if(entry) {
+                    segment.arcs = entry->arcs;
+                    segment.begin = entry->begin;
+                    segment.end = entry->end;
+                    segment.weight = Times(weight, entry->weight);
+                    segment.rewrite = label == match ? kNoLabel : label;
+                } else if(table.loop_arcs && label == match) {
+                    segment.arcs = table.loop_arcs;
+                    segment.begin = table.loop;
+                    segment.end = table.loop + 1;
+                    segment.weight = Times(weight, table.loop_weight);
+                    segment.rewrite = phi_;
+                } else {
+                    return false;
+                }
+                segment.label = match;
+                num_segments_++;
+                return true;
+            }
+
+            virtual void SetState_(StateId s) { SetState(s); }
+            virtual bool Find_(Label label) { return Find(label); }
+            virtual bool Done_() const { return Done(); }
+            virtual const Arc &Value_() const { return Value(); }
+            virtual void Next_() { Next(); }
+
+            const FST *fst_;
+            MatchType match_type_;
+            Label rho_, sigma_, phi_;
+            const PhiClosure<Arc> *closure_;        // not owned, may be NULL
+            bool specials_;                         // some special label is given
+            StateId state_;
+            const Arc *arcs_;                       // of the current state
+            size_t num_arcs_;
+            const StateInfo *info_;
+            StateInfo no_specials_;                 // of all states if no special label is given
+            std::shared_ptr<const InfoMap> prepared_;       // of all states with special arcs, if prepared
+            InfoMap infos_;                         // of the states visited, if not prepared
+            vector<Arc> buffers_[4];                // arcs of the current state and of the ends of phi arcs
+            Segment segments_[3];
+            int num_segments_;
+            int segment_;
+            size_t position_;
+            bool current_loop_;                     // implicit epsilon loop is the current match
+            Arc loop_;
+            mutable Arc arc_;
+
+            void operator=(const SpecialMatcher<F> &);
+    };
+
+    template <class F>
+    const size_t SpecialMatcher<F>::kNone;
+
+    typedef SpecialMatcher<StdFst> StdSpecialMatcher;
+    typedef PhiClosure<StdArc> StdPhiClosure;
+
+}  // namespace fst
+
+#endif  // FST_UTILS_SPECIAL_MATCHER_H__
@@ -0,0 +1,222 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Throughput of copy, Times, Plus and Divide of CategorialWeight against
+// the former first label + list<L> layout (reproduced below as
+// ListCategorialWeight, with the operations as they were), on tag strings
+// of the lengths met in determinization: a few labels on input arcs, up to
+// a few dozen in residuals.
+// usage: bench-categorial [operations per measure]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <random>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "categorial-weight.h"
+
+using namespace fst;
+
+typedef CategorialWeight<int> Weight;
+
+// Left categorial weight in the former layout, with its iterator.
+class ListCategorialWeight {
+    public:
+        class Iterator {
+            public:
+                explicit Iterator(const ListCategorialWeight &w)
+                    : first_(w.first_), rest_(w.rest_), init_(true), iter_(rest_.begin()) {}
+
+                bool Done() const {
+                    if (init_) return first_ == 0;
+                    else return iter_ == rest_.end();
+                }
+
+                const int &Value() const { return init_ ? first_ : *iter_; }
+
+                void Next() {
+                    if (init_) init_ = false;
+                    else ++iter_;
+                }
+
+                void Reset() {
+                    init_ = true;
+                    iter_ = rest_.begin();
+                }
+
+            private:
+                const int &first_;
+                const std::list<int> &rest_;
+                bool init_;
+                std::list<int>::const_iterator iter_;
+        };
+
+        ListCategorialWeight() : first_(0) {}
+
+        template <typename Iter>
+            ListCategorialWeight(const Iter &begin, const Iter &end) : first_(0) {
+                for (Iter iter = begin; iter != end; ++iter)
+                    PushBack(*iter);
+            }
+
+        explicit ListCategorialWeight(int l) : first_(0) { PushBack(l); }
+
+        static const ListCategorialWeight &Zero() {
+            static const ListCategorialWeight zero(kCategorialInfinity);
+            return zero;
+        }
+
+        static const ListCategorialWeight &One() {
+            static const ListCategorialWeight one;
+            return one;
+        }
+
+        size_t Size() const { return first_ ? rest_.size() + 1 : 0; }
+
+        void PushBack(int l) {
+            if (!first_)
+                first_ = l;
+            else
+                rest_.push_back(l);
+        }
+
+    private:
+        int first_;
+        std::list<int> rest_;
+};
+
+bool operator==(const ListCategorialWeight &w1, const ListCategorialWeight &w2) {
+    if (w1.Size() != w2.Size())
+        return false;
+    ListCategorialWeight::Iterator iter1(w1);
+    ListCategorialWeight::Iterator iter2(w2);
+    for (; !iter1.Done(); iter1.Next(), iter2.Next())
+        if (iter1.Value() != iter2.Value())
+            return false;
+    return true;
+}
+
+ListCategorialWeight Plus(const ListCategorialWeight &w1, const ListCategorialWeight &w2) {
+    if (w1 == ListCategorialWeight::Zero())
+        return w2;
+    if (w2 == ListCategorialWeight::Zero())
+        return w1;
+    ListCategorialWeight::Iterator iter1(w1);
+    ListCategorialWeight::Iterator iter2(w2);
+    for (; !iter1.Done() && !iter2.Done(); iter1.Next(), iter2.Next()) {
+        if (iter1.Value() < iter2.Value()) return w1;
+        else if (iter1.Value() > iter2.Value()) return w2;
+    }
+    if (!iter2.Done()) return w1;
+    return w2;
+}
+
+ListCategorialWeight Times(const ListCategorialWeight &w1, const ListCategorialWeight &w2) {
+    if (w1 == ListCategorialWeight::Zero() || w2 == ListCategorialWeight::Zero())
+        return ListCategorialWeight::Zero();
+    ListCategorialWeight prod(w1);
+    for (ListCategorialWeight::Iterator iter(w2); !iter.Done(); iter.Next())
+        prod.PushBack(iter.Value());
+    return prod;
+}
+
+ListCategorialWeight Divide(const ListCategorialWeight &w1, const ListCategorialWeight &w2, DivideType) {
+    if (w2 == ListCategorialWeight::Zero())
+        return ListCategorialWeight(kCategorialBad);
+    else if (w1 == ListCategorialWeight::Zero())
+        return ListCategorialWeight::Zero();
+    if (w1 == w2)
+        return ListCategorialWeight::One();
+    ListCategorialWeight div;
+    ListCategorialWeight::Iterator iter1(w1);
+    ListCategorialWeight::Iterator iter2(w2);
+    bool needsBrackets = false;
+    for (; !iter2.Done(); iter2.Next()) {
+        if (iter2.Value() == kCategorialLeftDiv) {
+            needsBrackets = true;
+            break;
+        }
+    }
+    iter2.Reset();
+    if (needsBrackets) div.PushBack(kCategorialLeftBracket);
+    for (; !iter2.Done(); iter2.Next())
+        div.PushBack(iter2.Value());
+    if (needsBrackets) div.PushBack(kCategorialRightBracket);
+    div.PushBack(kCategorialLeftDiv);
+    for (; !iter1.Done(); iter1.Next())
+        div.PushBack(iter1.Value());
+    return div;
+}
+
+// Random tag strings of min_length to max_length labels, in both layouts.
+void MakeStrings(std::mt19937 &random, size_t num, int min_length, int max_length,
+        std::vector<ListCategorialWeight> *lists, std::vector<Weight> *weights) {
+    std::uniform_int_distribution<int> lengths(min_length, max_length);
+    std::uniform_int_distribution<int> tags(1, 50);
+    for (size_t i = 0; i < num; i++) {
+        std::vector<int> labels(lengths(random));
+        for (size_t j = 0; j < labels.size(); j++) labels[j] = tags(random);
+        // strings share prefixes, as the residuals of one subset do
+        if (i > 0 && !labels.empty() && i % 2) labels[0] = weights->back().Size() ? weights->back().Labels()[0] : 1;
+        lists->push_back(ListCategorialWeight(labels.begin(), labels.end()));
+        weights->push_back(Weight(labels.begin(), labels.end()));
+    }
+}
+
+// Nanoseconds per call of op on pairs of strings; the sizes of the results
+// are summed so that the calls are not optimized out.
+template <class W, class Op>
+double Measure(const std::vector<W> &strings, size_t count, Op op, size_t *checksum) {
+    size_t n = strings.size();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++) {
+        W result = op(strings[i % n], strings[(i * 7 + 3) % n]);
+        *checksum += result.Size();
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+template <class W>
+void MeasureAll(const std::vector<W> &strings, size_t count, double *ns, size_t *checksum) {
+    ns[0] = Measure(strings, count, [](const W &a, const W &) { return W(a); }, checksum);
+    ns[1] = Measure(strings, count, [](const W &a, const W &b) { return Times(a, b); }, checksum);
+    ns[2] = Measure(strings, count, [](const W &a, const W &b) { return Plus(a, b); }, checksum);
+    ns[3] = Measure(strings, count, [](const W &a, const W &b) { return Divide(a, b, DIVIDE_LEFT); }, checksum);
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? atoll(argv[1]) : 2000000;
+    std::mt19937 random(42);
+    const char *names[] = {"copy", "Times", "Plus", "Divide"};
+    int ranges[][2] = {{1, 3}, {4, 8}, {9, 24}};
+    size_t checksum = 0;
+    std::cout << "operation\tlabels\tlist ns/op\tinline ns/op\tspeedup\n";
+    for (size_t r = 0; r < sizeof(ranges) / sizeof(ranges[0]); r++) {
+        std::vector<ListCategorialWeight> lists;
+        std::vector<Weight> weights;
+        MakeStrings(random, 4096, ranges[r][0], ranges[r][1], &lists, &weights);
+        double before[4], after[4];
+        MeasureAll(lists, count, before, &checksum);
+        MeasureAll(weights, count, after, &checksum);
+        for (int op = 0; op < 4; op++)
+            std::cout << names[op] << "\t" << ranges[r][0] << "-" << ranges[r][1] << "\t"
+                << before[op] << "\t" << after[op] << "\t" << before[op] / after[op] << "x\n";
+    }
+    std::cerr << "checksum " << checksum << "\n";
+    return 0;
+}
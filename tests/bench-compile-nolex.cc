@@ -0,0 +1,150 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Lines per second of the compilation of fstcompile-nolex on a random
+// text transducer (a quarter as many states as lines, 20k words, weights
+// with 4 decimals): the stream-based compilation it replaced (getline,
+// istringstream and symbol tables), then text-compiler.h on one thread
+// and in chunks on 2, 4 and 8 threads. The text is in memory, so that
+// reading the input is not part of the timing; writing the fst neither.
+// The speedup of threads is bounded by the number of cores.
+// usage: bench-compile-nolex [lines] [repeats]
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "text-compiler.h"
+
+using namespace fst;
+
+// fstcompile-nolex before text-reader.h, without its error messages.
+bool CompileWithStreams(std::istream &input, bool is_transducer, StdVectorFst *automaton) {
+    SymbolTable states("states");
+    SymbolTable isyms("input");
+    SymbolTable osyms("output");
+    isyms.AddSymbol("<eps>");
+    osyms.AddSymbol("<eps>");
+    while(!input.eof()) {
+        std::string line;
+        std::getline(input, line);
+        std::vector<std::string> tokens;
+        std::istringstream tokenizer(line);
+        while(1) {
+            std::string token;
+            if(!(tokenizer >> token)) break;
+            tokens.push_back(token);
+        }
+        if(input.eof()) break;
+        double weight = 0;
+        if(tokens.size() == 0) return false;
+        int64 from_state = states.Find(tokens[0]);
+        if(from_state == -1) {
+            from_state = automaton->AddState();
+            states.AddSymbol(tokens[0], from_state);
+        }
+        if(tokens.size() <= 2) {
+            if(tokens.size() == 2 && !(std::istringstream(tokens[1]) >> weight)) return false;
+            automaton->SetFinal(from_state, weight);
+            continue;
+        }
+        int64 to_state = states.Find(tokens[1]);
+        if(to_state == -1) {
+            to_state = automaton->AddState();
+            states.AddSymbol(tokens[1], to_state);
+        }
+        int64 in_symbol = isyms.AddSymbol(tokens[2]), out_symbol = in_symbol;
+        if(is_transducer) {
+            if(tokens.size() < 4 || tokens.size() > 5) return false;
+            out_symbol = osyms.AddSymbol(tokens[3]);
+            if(tokens.size() == 5 && !(std::istringstream(tokens[4]) >> weight)) return false;
+        } else {
+            if(tokens.size() > 4) return false;
+            if(tokens.size() == 4 && !(std::istringstream(tokens[3]) >> weight)) return false;
+        }
+        automaton->AddArc(from_state, StdArc(in_symbol, out_symbol, weight, to_state));
+    }
+    automaton->SetStart(0);
+    automaton->SetInputSymbols(&isyms);
+    automaton->SetOutputSymbols(is_transducer ? &osyms : &isyms);
+    return true;
+}
+
+std::string RandomText(std::mt19937 &random, int num_lines) {
+    std::uniform_int_distribution<int> states(0, num_lines / 4), words(0, 20000), tenth(0, 9);
+    std::uniform_real_distribution<double> costs(0, 20);
+    std::string text;
+    char line[128];
+    for(int i = 0; i < num_lines; i++) {
+        int from = i == 0 ? 0 : states(random);
+        if(tenth(random) == 0) snprintf(line, sizeof(line), "%d\t%.4f\n", from, costs(random));
+        else snprintf(line, sizeof(line), "%d\t%d\tw%d\tw%d\t%.4f\n", from, states(random), words(random), words(random), costs(random));
+        text += line;
+    }
+    return text;
+}
+
+template <class Op>
+double Measure(int repeats, Op op) {
+    double best = 0;
+    for(int i = 0; i < repeats; i++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        if(!op()) {
+            std::cerr << "error: compilation failed\n";
+            exit(1);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if(i == 0 || seconds < best) best = seconds;
+    }
+    return best;
+}
+
+int main(int argc, char** argv) {
+    int num_lines = argc > 1 ? atoi(argv[1]) : 1000000;
+    int repeats = argc > 2 ? atoi(argv[2]) : 3;
+    std::mt19937 random(42);
+    std::string text = RandomText(random, num_lines);
+    std::cout << "cores: " << std::thread::hardware_concurrency() << ", input: " << num_lines << " lines, "
+        << text.size() / 1e6 << " MB\n"
+        << "compilation\tseconds (best of " << repeats << ")\tMlines/s\tspeedup\n";
+    double before = Measure(repeats, [&]() {
+        std::istringstream input(text);
+        StdVectorFst automaton;
+        return CompileWithStreams(input, true, &automaton);
+    });
+    std::cout << "streams\t" << before << "\t" << num_lines / before / 1e6 << "\t1x\n";
+    for(int threads = 1; threads <= 8; threads *= 2) {
+        double seconds = Measure(repeats, [&]() {
+            SymbolNames names;
+            FstBuilder builder(&names);
+            std::string error;
+            if(threads > 1) CompileChunks(text.data(), text.data() + text.size(), true, threads, &builder, &error);
+            else CompileLines(text.data(), text.data() + text.size(), true, &builder, &error);
+            builder.automaton.SetStart(0);
+            SetSymbols(names, true, &builder.automaton);
+            return error == "";
+        });
+        std::cout << threads << " thread" << (threads > 1 ? "s" : "") << "\t" << seconds << "\t"
+            << num_lines / seconds / 1e6 << "\t" << before / seconds << "x\n";
+    }
+    return 0;
+}
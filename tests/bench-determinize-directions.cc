@@ -0,0 +1,93 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Time and size of the subset construction of parallel-determinize.h in
+// both directions, as run by fstdeterminize-tc-lex: forward in the left
+// categorial semiring, and from the end of the lattice (on its reverse)
+// in the right categorial semiring, as --reverse does. Lattices are random
+// acyclic acceptors of the given number of states; words are drawn from a
+// vocabulary of the given size and each arc has one tag. The tool
+// determinizes TCLex weights, whose categorial half is what is measured
+// here.
+// usage: bench-determinize-directions [states] [vocabulary] [threads]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <fst/fstlib.h>
+
+#include "categorial-weight.h"
+#include "parallel-determinize.h"
+
+using namespace fst;
+
+typedef ArcTpl<CategorialWeight<int> > LeftArc;
+typedef ArcTpl<CategorialWeight<int, CATEGORIAL_RIGHT> > RightArc;
+
+// Random lattice from state 0 to its last state, where arcs skip at most
+// two states, and its reverse with weights in the right semiring.
+void RandomLattice(std::mt19937 &random, int num_states, int vocabulary,
+        VectorFst<LeftArc> *forward, VectorFst<RightArc> *reversed) {
+    std::uniform_int_distribution<int> words(1, vocabulary), tags(1, 20), arcs(1, 4), skips(1, 3);
+    for(int s = 0; s < num_states; s++) {
+        forward->AddState();
+        reversed->AddState();
+    }
+    for(int s = 0; s + 1 < num_states; s++) {
+        int n = arcs(random);
+        for(int i = 0; i < n; i++) {
+            int next = std::min(s + skips(random), num_states - 1);
+            int word = words(random), tag = tags(random);
+            forward->AddArc(s, LeftArc(word, 0, CategorialWeight<int>(tag), next));
+            reversed->AddArc(next, RightArc(word, 0, CategorialWeight<int, CATEGORIAL_RIGHT>(tag), s));
+        }
+    }
+    forward->SetStart(0);
+    forward->SetFinal(num_states - 1, CategorialWeight<int>::One());
+    reversed->SetStart(num_states - 1);
+    reversed->SetFinal(0, CategorialWeight<int, CATEGORIAL_RIGHT>::One());
+}
+
+template <class Arc>
+double Measure(const VectorFst<Arc> &fst, int threads, size_t *num_states, size_t *num_arcs) {
+    VectorFst<Arc> determinized;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    ParallelDeterminize(fst, &determinized, threads);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    *num_states = determinized.NumStates();
+    *num_arcs = 0;
+    for(int s = 0; s < determinized.NumStates(); s++) *num_arcs += determinized.NumArcs(s);
+    return ms;
+}
+
+int main(int argc, char** argv) {
+    int max_states = argc > 1 ? atoi(argv[1]) : 32000;
+    int vocabulary = argc > 2 ? atoi(argv[2]) : 20;
+    int threads = argc > 3 ? atoi(argv[3]) : 1;
+    std::mt19937 random(42);
+    std::cout << "states\tforward ms\tforward states\tforward arcs\treverse ms\treverse states\treverse arcs\n";
+    for(int num_states = 250; num_states <= max_states; num_states *= 2) {
+        VectorFst<LeftArc> forward;
+        VectorFst<RightArc> reversed;
+        RandomLattice(random, num_states, vocabulary, &forward, &reversed);
+        size_t forward_states, forward_arcs, reverse_states, reverse_arcs;
+        double forward_ms = Measure(forward, threads, &forward_states, &forward_arcs);
+        double reverse_ms = Measure(reversed, threads, &reverse_states, &reverse_arcs);
+        std::cout << num_states << "\t" << forward_ms << "\t" << forward_states << "\t" << forward_arcs
+            << "\t" << reverse_ms << "\t" << reverse_states << "\t" << reverse_arcs << "\n";
+    }
+    return 0;
+}
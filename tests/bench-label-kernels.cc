@@ -0,0 +1,119 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Throughput of categorial equality and of the tie-break of the TCLex Plus
+// (the categorial half of Plus in fstdeterminize-tc-lex.cc): with the
+// scalar label loops, with the kernels selected for this CPU, and with
+// interned weights. Pairs of strings are either equal, which the TCLex
+// Plus settles with ==, or differ at their last label, which is the worst
+// case of the lexicographic comparison.
+// usage: bench-label-kernels [operations per measure]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "categorial-weight.h"
+#include "interned-categorial-weight.h"
+
+using namespace fst;
+
+typedef CategorialWeight<int> Weight;
+typedef InternedCategorialWeight<int> Interned;
+
+bool EqualScalar(const Weight &w1, const Weight &w2) {
+    return w1.Size() == w2.Size() &&
+        internal::FindLabelMismatchScalar(w1.Labels(), w2.Labels(), w1.Size()) == w1.Size();
+}
+
+int CompareScalar(const int *a, size_t size_a, const int *b, size_t size_b) {
+    size_t size = std::min(size_a, size_b);
+    size_t i = internal::FindLabelMismatchScalar(a, b, size);
+    if (i < size)
+        return a[i] < b[i] ? -1 : 1;
+    return size_a < size_b ? -1 : (size_a > size_b ? 1 : 0);
+}
+
+// Categorial tie-break of the TCLex Plus: true if w is kept.
+template <class C>
+bool TieKeepsFirst(const C &w2, const C &v2) {
+    if (w2 == v2) return false;
+    return CompareLabelStrings(w2.Labels(), w2.Size(), v2.Labels(), v2.Size()) < 0;
+}
+
+bool TieKeepsFirstScalar(const Weight &w2, const Weight &v2) {
+    if (EqualScalar(w2, v2)) return false;
+    return CompareScalar(w2.Labels(), w2.Size(), v2.Labels(), v2.Size()) < 0;
+}
+
+// Nanoseconds per call of op on the pairs; results are counted so that
+// the calls are not optimized out.
+template <class W, class Op>
+double Measure(const std::vector<W> &first, const std::vector<W> &second, size_t count, Op op, size_t *checksum) {
+    size_t n = first.size();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < count; i++)
+        *checksum += op(first[i % n], second[i % n]);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / count;
+}
+
+const char *SelectedKernel() {
+#ifdef FST_LABEL_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return "avx2";
+    if (__builtin_cpu_supports("sse4.1")) return "sse4.1";
+#endif
+    return "scalar";
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? atoll(argv[1]) : 5000000;
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> tags(1, 50);
+    size_t lengths[] = {2, 6, 12, 24, 48};
+    size_t checksum = 0;
+    std::cout << "kernels: " << SelectedKernel() << "\n"
+        << "labels\tpairs\t== scalar\t== kernel\t== interned\tPlus scalar\tPlus kernel\tPlus interned (ns/op)\n";
+    for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+        for (int differ = 0; differ < 2; differ++) {
+            std::vector<Weight> first, second;
+            std::vector<Interned> interned_first, interned_second;
+            for (size_t i = 0; i < 1024; i++) {
+                std::vector<int> labels(lengths[l]);
+                for (size_t j = 0; j < labels.size(); j++) labels[j] = tags(random);
+                first.push_back(Weight(labels.begin(), labels.end()));
+                interned_first.push_back(Interned(labels.begin(), labels.end()));
+                if (differ) labels.back() = labels.back() % 50 + 1;
+                second.push_back(Weight(labels.begin(), labels.end()));
+                interned_second.push_back(Interned(labels.begin(), labels.end()));
+            }
+            double ns[6];
+            ns[0] = Measure(first, second, count, EqualScalar, &checksum);
+            ns[1] = Measure(first, second, count, [](const Weight &a, const Weight &b) { return a == b; }, &checksum);
+            ns[2] = Measure(interned_first, interned_second, count, [](const Interned &a, const Interned &b) { return a == b; }, &checksum);
+            ns[3] = Measure(first, second, count, TieKeepsFirstScalar, &checksum);
+            ns[4] = Measure(first, second, count, TieKeepsFirst<Weight>, &checksum);
+            ns[5] = Measure(interned_first, interned_second, count, TieKeepsFirst<Interned>, &checksum);
+            std::cout << lengths[l] << "\t" << (differ ? "differ" : "equal");
+            for (int i = 0; i < 6; i++) std::cout << "\t" << ns[i];
+            std::cout << "\n";
+        }
+    }
+    std::cerr << "checksum " << checksum << "\n";
+    return 0;
+}
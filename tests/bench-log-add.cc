@@ -0,0 +1,80 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Throughput of the log-add kernels of log-add-kernels.h on batches of
+// the sizes met in forward-backward (the arcs entering or leaving a
+// state): the scalar loop, and the AVX2 and AVX-512 kernels when the CPU
+// has them, then LogSum() with the kernel it selects.
+// usage: bench-log-add [values per measure]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <vector>
+
+#include "log-add-kernels.h"
+
+using namespace fst;
+
+// Nanoseconds per value of sum(values, size) over consecutive batches of
+// the buffer; results are summed so that the calls are not optimized out.
+template <class Sum>
+double Measure(const std::vector<double> &buffer, size_t size, size_t count, Sum sum, double *checksum) {
+    size_t num_batches = buffer.size() / size;
+    size_t calls = count / size + 1;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < calls; i++)
+        *checksum += sum(buffer.data() + (i % num_batches) * size, size);
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / (calls * size);
+}
+
+int main(int argc, char** argv) {
+    size_t count = argc > 1 ? atoll(argv[1]) : 50000000;
+    std::mt19937 random(42);
+    std::uniform_real_distribution<double> costs(0, 30);
+    std::vector<double> buffer(1 << 16);
+    for (size_t i = 0; i < buffer.size(); i++) buffer[i] = costs(random);
+
+    std::vector<const char *> names(1, "scalar");
+    std::vector<internal::SumShiftedExpFunction> kernels(1, internal::SumShiftedExpScalar);
+#ifdef FST_LOG_ADD_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        names.push_back("avx2");
+        kernels.push_back(internal::SumShiftedExpAvx2);
+    }
+    if (__builtin_cpu_supports("avx512f")) {
+        names.push_back("avx512");
+        kernels.push_back(internal::SumShiftedExpAvx512);
+    }
+#endif
+    size_t sizes[] = {2, 4, 8, 16, 32, 64, 256};
+    double checksum = 0;
+    std::cout << "batch";
+    for (size_t k = 0; k < kernels.size(); k++) std::cout << "\t" << names[k];
+    std::cout << "\tLogSum (ns/value)\n";
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        std::cout << sizes[s];
+        for (size_t k = 0; k < kernels.size(); k++) {
+            internal::SumShiftedExpFunction kernel = kernels[k];
+            std::cout << "\t" << Measure(buffer, sizes[s], count, [kernel](const double *values, size_t size) {
+                    return kernel(values, size, values[0] - 30); }, &checksum);
+        }
+        std::cout << "\t" << Measure(buffer, sizes[s], count, LogSum, &checksum) << "\n";
+    }
+    std::cerr << "checksum " << checksum << "\n";
+    return 0;
+}
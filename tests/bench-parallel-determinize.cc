@@ -0,0 +1,90 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Scaling of the subset construction of parallel-determinize.h with 1, 2,
+// 4 and 8 threads, on random layered acceptors with left categorial
+// weights (the categorial half of the TCLex weights of
+// fstdeterminize-tc-lex --threads). Each layer has the given width, so
+// that levels of the construction are wide enough to be split between
+// threads. The speedup is bounded by the number of cores, printed first.
+// usage: bench-parallel-determinize [layers] [width] [repeats]
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <fst/fstlib.h>
+
+#include "categorial-weight.h"
+#include "parallel-determinize.h"
+
+using namespace fst;
+
+typedef ArcTpl<CategorialWeight<int> > CategorialArc;
+typedef CategorialArc::StateId StateId;
+
+// Layers of width states; every state has 1 to 4 arcs to the next layer,
+// with words of a vocabulary of twice the width.
+void RandomLayers(std::mt19937 &random, int num_layers, int width, VectorFst<CategorialArc> *fst) {
+    std::uniform_int_distribution<int> words(1, 2 * width), tags(1, 20), arcs(1, 4), targets(0, width - 1);
+    StateId start = fst->AddState();
+    for(int s = 0; s < num_layers * width; s++) fst->AddState();
+    StateId end = fst->AddState();
+    fst->SetStart(start);
+    fst->SetFinal(end, CategorialWeight<int>::One());
+    for(int s = 0; s < width; s++)
+        fst->AddArc(start, CategorialArc(words(random), 0, CategorialWeight<int>(tags(random)), 1 + targets(random)));
+    for(int layer = 0; layer < num_layers; layer++) {
+        for(int s = 0; s < width; s++) {
+            StateId state = 1 + layer * width + s;
+            int n = arcs(random);
+            for(int i = 0; i < n; i++) {
+                StateId next = layer + 1 < num_layers ? 1 + (layer + 1) * width + targets(random) : end;
+                fst->AddArc(state, CategorialArc(words(random), 0, CategorialWeight<int>(tags(random)), next));
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    int num_layers = argc > 1 ? atoi(argv[1]) : 50;
+    int width = argc > 2 ? atoi(argv[2]) : 2000;
+    int repeats = argc > 3 ? atoi(argv[3]) : 3;
+    std::mt19937 random(42);
+    VectorFst<CategorialArc> fst;
+    RandomLayers(random, num_layers, width, &fst);
+    size_t num_arcs = 0;
+    for(int s = 0; s < fst.NumStates(); s++) num_arcs += fst.NumArcs(s);
+    std::cout << "cores: " << std::thread::hardware_concurrency() << ", input: " << fst.NumStates()
+        << " states, " << num_arcs << " arcs\n"
+        << "threads\tms (best of " << repeats << ")\tspeedup\tstates\n";
+    double single = 0;
+    for(int threads = 1; threads <= 8; threads *= 2) {
+        double best = 0;
+        size_t num_states = 0;
+        for(int i = 0; i < repeats; i++) {
+            VectorFst<CategorialArc> determinized;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            ParallelDeterminize(fst, &determinized, threads);
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            if(i == 0 || ms < best) best = ms;
+            num_states = determinized.NumStates();
+        }
+        if(threads == 1) single = best;
+        std::cout << threads << "\t" << best << "\t" << single / best << "x\t" << num_states << "\n";
+    }
+    return 0;
+}
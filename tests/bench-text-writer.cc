@@ -0,0 +1,140 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Throughput of the path dump of fstprint-nbest-strings: a million random
+// paths of 5 to 20 arcs over a vocabulary of 50k words (one arc in ten
+// with different input and output labels, one in twenty with an epsilon
+// output), printed as before TextWriter (SymbolTable::Find(), << on the
+// weight and std::endl on every path) and through SymbolStrings and
+// TextWriter, to the same file. Both dumps of the first paths must be
+// the same text.
+// usage: bench-text-writer [paths] [output file]
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "text-writer.h"
+
+using namespace fst;
+
+struct Path {
+    float weight;
+    std::vector<StdArc> arcs;
+};
+
+// Path printing of fstprint-nbest-strings before TextWriter.
+void PrintPathBefore(const Path &path, const SymbolTable &symbols, std::ostream &out) {
+    out << TropicalWeight(path.weight);
+    for(size_t i = 0; i < path.arcs.size(); i++) {
+        const StdArc &arc = path.arcs[i];
+        if(arc.ilabel == arc.olabel && arc.olabel != 0) out << " " << symbols.Find(arc.olabel);
+        else if(arc.olabel != 0) out << " " << symbols.Find(arc.ilabel) << "/" << symbols.Find(arc.olabel);
+    }
+    out << std::endl;
+}
+
+// Path printing of fstprint-nbest-strings with TextWriter.
+void PrintPathAfter(const Path &path, const SymbolStrings &symbols, TextWriter &writer) {
+    writer.AppendWeight(path.weight);
+    for(size_t i = 0; i < path.arcs.size(); i++) {
+        const StdArc &arc = path.arcs[i];
+        if(arc.olabel == 0) continue;
+        writer.Append(' ');
+        if(arc.ilabel != arc.olabel) writer.AppendSymbol(symbols, arc.ilabel).Append('/');
+        writer.AppendSymbol(symbols, arc.olabel);
+    }
+    writer.Append('\n');
+}
+
+void Report(const char *name, double seconds, size_t num_paths, size_t bytes, double before) {
+    std::cout << name << "\t" << seconds << "\t" << num_paths / seconds / 1e6 << "\t"
+        << bytes / seconds / 1e6 << "\t" << before / seconds << "x\n";
+}
+
+int main(int argc, char** argv) {
+    size_t num_paths = argc > 1 ? atoll(argv[1]) : 1000000;
+    const char *output = argc > 2 ? argv[2] : "/dev/null";
+    std::mt19937 random(42);
+    SymbolTable symbols("words");
+    symbols.AddSymbol("<eps>", 0);
+    for(int i = 1; i <= 50000; i++) {
+        std::ostringstream word;
+        word << "w" << i * 7919 % 1000003;
+        symbols.AddSymbol(word.str(), i);
+    }
+    // paths are drawn from a pool, which is not part of the timing
+    std::uniform_int_distribution<int> words(1, 50000), lengths(5, 20), twentieth(0, 19);
+    std::uniform_real_distribution<float> costs(0, 200);
+    std::vector<Path> pool(10000);
+    for(size_t i = 0; i < pool.size(); i++) {
+        pool[i].weight = costs(random);
+        int length = lengths(random);
+        for(int j = 0; j < length; j++) {
+            int ilabel = words(random), draw = twentieth(random);
+            int olabel = draw == 0 ? 0 : draw <= 2 ? words(random) : ilabel;
+            pool[i].arcs.push_back(StdArc(ilabel, olabel, 0, 0));
+        }
+    }
+
+    // size of the dump, from the text of each path of the pool
+    std::vector<size_t> sizes(pool.size());
+    for(size_t i = 0; i < pool.size(); i++) {
+        std::ostringstream text;
+        PrintPathBefore(pool[i], symbols, text);
+        sizes[i] = text.str().size();
+    }
+    size_t bytes = 0;
+    for(size_t i = 0; i < num_paths; i++) bytes += sizes[i % pool.size()];
+
+    std::ostringstream before_text, after_text;
+    {
+        SymbolStrings strings(&symbols);
+        TextWriter writer(after_text);
+        for(size_t i = 0; i < 1000; i++) {
+            PrintPathBefore(pool[i], symbols, before_text);
+            PrintPathAfter(pool[i], strings, writer);
+        }
+    }
+    if(before_text.str() != after_text.str()) {
+        std::cerr << argv[0] << ": dumps differ\n";
+        return 1;
+    }
+
+    std::cout << num_paths << " paths to " << output << "\n"
+        << "printing\tseconds\tMpaths/s\tMB/s\tspeedup\n";
+    std::ofstream before_out(output);
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for(size_t i = 0; i < num_paths; i++) PrintPathBefore(pool[i % pool.size()], symbols, before_out);
+    double before = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Report("before", before, num_paths, bytes, before);
+
+    std::ofstream after_out(output);
+    start = std::chrono::steady_clock::now();
+    {
+        // the table of symbols is built in the timed part, as in the tool
+        SymbolStrings strings(&symbols);
+        TextWriter writer(after_out);
+        for(size_t i = 0; i < num_paths; i++) PrintPathAfter(pool[i % pool.size()], strings, writer);
+    }
+    double after = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    Report("TextWriter", after, num_paths, bytes, before);
+    return 0;
+}
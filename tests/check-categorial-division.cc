@@ -0,0 +1,284 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Left and right categorial division: Reverse() maps one to the other,
+// and Plus distributes over Times on the side of each semiring. The subset
+// construction of parallel-determinize.h in the right semiring, run on
+// reversed random acyclic acceptors, must give the mirror image of the one
+// in the left semiring, and every word string must keep the tag string of
+// one of its input paths, found by brute-force enumeration, with 1 and 4
+// threads. Ties are broken on residuals, which hold divisions, so this tag
+// string is not always the minimum of Plus over the paths (the same holds
+// in the left semiring).
+
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "categorial-weight.h"
+#include "parallel-determinize.h"
+
+using namespace fst;
+
+typedef CategorialWeight<int> Left;
+typedef CategorialWeight<int, CATEGORIAL_RIGHT> Right;
+typedef ArcTpl<Left> LeftArc;
+typedef ArcTpl<Right> RightArc;
+
+int failures = 0;
+
+void Check(bool ok, const std::string &what) {
+    if(!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+template <class W>
+std::string Print(const W &w) {
+    std::ostringstream strm;
+    strm << w;
+    return strm.str();
+}
+
+template <class W>
+std::vector<int> Labels(const W &w) {
+    return std::vector<int>(w.Labels(), w.Labels() + w.Size());
+}
+
+// Labels from a small alphabet, so that prefixes and suffixes are shared.
+std::vector<int> RandomLabels(std::mt19937 &random, int max_length) {
+    std::vector<int> labels(std::uniform_int_distribution<int>(0, max_length)(random));
+    for(size_t i = 0; i < labels.size(); i++) labels[i] = std::uniform_int_distribution<int>(1, 3)(random);
+    return labels;
+}
+
+void CheckAlgebra(std::mt19937 &random) {
+    for(int i = 0; i < 20000; i++) {
+        std::vector<int> a = RandomLabels(random, 6), b = RandomLabels(random, 6), c = RandomLabels(random, 6);
+        Right ra(a.begin(), a.end()), rb(b.begin(), b.end()), rc(c.begin(), c.end());
+        Left la(a.begin(), a.end()), lb(b.begin(), b.end()), lc(c.begin(), c.end());
+        std::string what = Print(ra) + ", " + Print(rb) + ", " + Print(rc);
+        Right quotient = Divide(ra, rb, DIVIDE_RIGHT);
+        Check(quotient.Reverse() == Divide(ra.Reverse(), rb.Reverse(), DIVIDE_LEFT), "reverse of a right division " + what);
+        Right nested = Divide(rc, quotient, DIVIDE_RIGHT);
+        Check(nested.Reverse() == Divide(rc.Reverse(), quotient.Reverse(), DIVIDE_LEFT), "reverse of a nested right division " + what);
+        Check(nested.Reverse().Reverse() == nested, "double reverse " + what);
+        Check(Plus(ra, rb).Reverse() == Plus(ra.Reverse(), rb.Reverse()), "reverse of the right Plus " + what);
+        Check(Times(Plus(ra, rb), rc) == Plus(Times(ra, rc), Times(rb, rc)), "right distributivity " + what);
+        Check(Times(lc, Plus(la, lb)) == Plus(Times(lc, la), Times(lc, lb)), "left distributivity " + what);
+        Check(Divide(ra, ra, DIVIDE_RIGHT) == Right::One(), "x/x " + what);
+    }
+    int x[] = {1, 2}, y[] = {3}, z[] = {4};
+    int *px = x, *py = y, *pz = z;
+    Right quotient = Divide(Right(px, px + 2), Right(py, py + 1), DIVIDE_RIGHT);
+    Check(Print(quotient) == "1_2/3", "right division prints as " + Print(quotient));
+    Right nested = Divide(Right(pz, pz + 1), quotient, DIVIDE_RIGHT);
+    Check(Print(nested) == "4/<1_2/3>", "nested right division prints as " + Print(nested));
+    Check(Print(nested.Reverse()) == "<3\\2_1>\\4", "its reverse prints as " + Print(nested.Reverse()));
+    Check(Divide(Right::Zero(), quotient, DIVIDE_RIGHT) == Right::Zero(), "Zero / x");
+    Check(!Divide(quotient, Right::Zero(), DIVIDE_RIGHT).Member(), "x / Zero");
+}
+
+// Tag strings with divisions are resolved in the free group over labels,
+// where x/y is x followed by the inverse of y: along a path, the quotients
+// of the residuals cancel out. Elements are labels with an exponent of 1
+// or -1, kept reduced.
+typedef std::vector<std::pair<int, int> > Element;
+
+void Append(const Element &e, Element *product) {
+    for(size_t i = 0; i < e.size(); i++) {
+        if(!product->empty() && product->back().first == e[i].first && product->back().second == -e[i].second)
+            product->pop_back();
+        else
+            product->push_back(e[i]);
+    }
+}
+
+Element Inverse(const Element &e) {
+    Element inverse;
+    for(size_t i = e.size(); i > 0; i--) inverse.push_back(std::make_pair(e[i - 1].first, -e[i - 1].second));
+    return inverse;
+}
+
+// Value of a right categorial weight: the dividend before the first
+// top-level '/', divided by each part after it; a divisor in brackets is
+// itself resolved. Returns false on a malformed string.
+bool Resolve(const std::vector<int> &labels, Element *value) {
+    std::vector<std::vector<int> > parts(1);
+    int depth = 0;
+    for(size_t i = 0; i < labels.size(); i++) {
+        if(labels[i] == kCategorialLeftBracket) depth++;
+        if(labels[i] == kCategorialRightBracket) depth--;
+        if(depth == 0 && labels[i] == kCategorialRightDiv) parts.push_back(std::vector<int>());
+        else parts.back().push_back(labels[i]);
+    }
+    value->clear();
+    for(size_t i = 0; i < parts.size(); i++) {
+        const std::vector<int> &part = parts[i];
+        Element e;
+        if(!part.empty() && part[0] == kCategorialLeftBracket) {
+            if(part.back() != kCategorialRightBracket) return false;
+            if(!Resolve(std::vector<int>(part.begin() + 1, part.end() - 1), &e)) return false;
+        } else {
+            for(size_t j = 0; j < part.size(); j++) {
+                if(part[j] < 0) return false;
+                e.push_back(std::make_pair(part[j], 1));
+            }
+        }
+        Append(i == 0 ? e : Inverse(e), value);
+    }
+    return true;
+}
+
+// Random acyclic acceptor with one tag label per arc, and its reverse
+// (without epsilons: the start state is the only final state).
+template <class Arc>
+void RandomReversedAcceptor(std::mt19937 &random, int num_states, VectorFst<Arc> *reversed) {
+    typedef typename Arc::Weight Weight;
+    reversed->DeleteStates();
+    for(int s = 0; s < num_states; s++) reversed->AddState();
+    std::uniform_int_distribution<int> words(1, 3), tags(1, 4), arcs(1, 3);
+    for(int s = 0; s + 1 < num_states; s++) {
+        int n = arcs(random);
+        for(int i = 0; i < n; i++) {
+            int next = std::uniform_int_distribution<int>(s + 1, num_states - 1)(random);
+            reversed->AddArc(next, Arc(words(random), 0, Weight(tags(random)), s));
+        }
+    }
+    reversed->SetStart(num_states - 1);
+    reversed->SetFinal(0, Weight::One());
+}
+
+// Best weight of each string of a reversed acceptor, with tag strings in
+// the order of the original paths: arcs extend the weight on the left.
+void BruteForce(const VectorFst<RightArc> &fst, int state, std::vector<int> &words, const Right &weight,
+        std::map<std::vector<int>, Right> *best) {
+    if(fst.Final(state) != Right::Zero()) {
+        Right total = Times(fst.Final(state), weight);
+        std::map<std::vector<int>, Right>::iterator found = best->find(words);
+        if(found == best->end()) (*best)[words] = total;
+        else found->second = Plus(found->second, total);
+    }
+    for(ArcIterator<VectorFst<RightArc> > aiter(fst, state); !aiter.Done(); aiter.Next()) {
+        const RightArc &arc = aiter.Value();
+        words.push_back(arc.ilabel);
+        BruteForce(fst, arc.nextstate, words, Times(arc.weight, weight), best);
+        words.pop_back();
+    }
+}
+
+// Tag strings of the paths of each word string of a reversed acceptor,
+// in the order of the original paths: arcs extend the weight on the left.
+void BruteForce(const VectorFst<RightArc> &fst, int state, std::vector<int> &words, const Right &weight,
+        std::map<std::vector<int>, std::set<Element> > *taggings) {
+    if(fst.Final(state) != Right::Zero()) {
+        Element value;
+        Resolve(Labels(Times(fst.Final(state), weight)), &value);
+        (*taggings)[words].insert(value);
+    }
+    for(ArcIterator<VectorFst<RightArc> > aiter(fst, state); !aiter.Done(); aiter.Next()) {
+        const RightArc &arc = aiter.Value();
+        words.push_back(arc.ilabel);
+        BruteForce(fst, arc.nextstate, words, Times(arc.weight, weight), taggings);
+        words.pop_back();
+    }
+}
+
+// Resolved weight of a string in a deterministic acceptor, extended on
+// the left.
+bool PathValue(const VectorFst<RightArc> &fst, const std::vector<int> &words, Element *value) {
+    int state = fst.Start();
+    std::vector<Right> weights;
+    for(size_t i = 0; i < words.size(); i++) {
+        int next = kNoStateId;
+        for(ArcIterator<VectorFst<RightArc> > aiter(fst, state); !aiter.Done(); aiter.Next()) {
+            if(aiter.Value().ilabel != words[i]) continue;
+            if(next != kNoStateId) return false;
+            next = aiter.Value().nextstate;
+            weights.push_back(aiter.Value().weight);
+        }
+        if(next == kNoStateId) return false;
+        state = next;
+    }
+    if(fst.Final(state) == Right::Zero()) return false;
+    weights.push_back(fst.Final(state));
+    value->clear();
+    for(size_t i = weights.size(); i > 0; i--) {
+        Element e;
+        if(!Resolve(Labels(weights[i - 1]), &e)) return false;
+        Append(e, value);
+    }
+    return true;
+}
+
+void CheckDeterminize(std::mt19937 &random) {
+    for(int i = 0; i < 300; i++) {
+        int num_states = std::uniform_int_distribution<int>(2, 9)(random);
+        std::mt19937 copy = random;
+        VectorFst<RightArc> right;
+        VectorFst<LeftArc> left;
+        RandomReversedAcceptor(random, num_states, &right);
+        RandomReversedAcceptor(copy, num_states, &left);
+        std::ostringstream what;
+        what << "acceptor " << i;
+
+        // right determinization is the mirror image of the left one
+        VectorFst<RightArc> right_det;
+        VectorFst<LeftArc> left_det;
+        ParallelDeterminize(right, &right_det, 1);
+        ParallelDeterminize(left, &left_det, 1);
+        bool mirror = right_det.NumStates() == left_det.NumStates() && right_det.Start() == left_det.Start();
+        for(int s = 0; mirror && s < right_det.NumStates(); s++) {
+            mirror = right_det.NumArcs(s) == left_det.NumArcs(s) && right_det.Final(s).Reverse() == left_det.Final(s);
+            ArcIterator<VectorFst<LeftArc> > liter(left_det, s);
+            for(ArcIterator<VectorFst<RightArc> > riter(right_det, s); mirror && !riter.Done(); riter.Next(), liter.Next())
+                mirror = riter.Value().ilabel == liter.Value().ilabel && riter.Value().nextstate == liter.Value().nextstate &&
+                    riter.Value().weight.Reverse() == liter.Value().weight;
+        }
+        Check(mirror, what.str() + ": right determinization is the reverse of the left one");
+
+        // and keeps a tag string of an input path for every word string
+        std::map<std::vector<int>, std::set<Element> > taggings;
+        std::vector<int> words;
+        BruteForce(right, right.Start(), words, Right::One(), &taggings);
+        for(int threads = 1; threads <= 4; threads += 3) {
+            VectorFst<RightArc> determinized;
+            ParallelDeterminize(right, &determinized, threads);
+            Check(determinized.NumStates() == right_det.NumStates(), what.str() + ": same states with 1 and 4 threads");
+            for(std::map<std::vector<int>, std::set<Element> >::const_iterator it = taggings.begin(); it != taggings.end(); ++it) {
+                Element value;
+                Check(PathValue(determinized, it->first, &value) && it->second.count(value),
+                        what.str() + ": tags of a path of every word string");
+            }
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 random(42);
+    CheckAlgebra(random);
+    CheckDeterminize(random);
+    if(failures) {
+        std::cerr << argv[0] << ": " << failures << " failures\n";
+        return 1;
+    }
+    std::cerr << argv[0] << ": ok\n";
+    return 0;
+}
@@ -0,0 +1,167 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Round trips of the varint and zigzag codes, and of the plain and compact
+// binary encodings of categorial weights; corrupt streams must fail
+// without allocating what they announce.
+
+#include <iostream>
+#include <sstream>
+#include <random>
+#include <vector>
+#include <limits>
+#include <fst/fstlib.h>
+
+#include "compact-categorial-weight.h"
+
+using namespace fst;
+
+typedef CategorialWeight<int> Plain;
+typedef CompactCategorialWeight<int> Compact;
+
+int failures = 0;
+
+void Check(bool ok, const std::string &what) {
+    if(!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+void CheckVarints() {
+    std::vector<uint64> values;
+    for(int shift = 0; shift < 64; shift++) {
+        values.push_back((uint64) 1 << shift);
+        values.push_back(((uint64) 1 << shift) - 1);
+    }
+    values.push_back(std::numeric_limits<uint64>::max());
+    for(size_t i = 0; i < values.size(); i++) {
+        char buffer[10];
+        size_t n = WriteCategorialVarint(values[i], buffer);
+        uint64 value;
+        std::ostringstream what;
+        what << "varint " << values[i];
+        Check(ReadCategorialVarint(buffer, n, &value) == n && value == values[i], what.str());
+        Check(n == 1 || ReadCategorialVarint(buffer, n - 1, &value) == 0, what.str() + " (truncated)");
+        std::istringstream strm(std::string(buffer, n));
+        Check(ReadCategorialVarint(strm, &value) && value == values[i], what.str() + " (stream)");
+    }
+    int64 labels[] = {0, 1, -1, 63, -64, 64, -65, kCategorialInfinity, kCategorialBad, kCategorialLeftBracket,
+        kCategorialRightBracket, kCategorialLeftDiv, std::numeric_limits<int64>::max(), std::numeric_limits<int64>::min()};
+    for(size_t i = 0; i < sizeof(labels) / sizeof(labels[0]); i++) {
+        std::ostringstream what;
+        what << "zigzag " << labels[i];
+        Check(ZigzagDecode(ZigzagEncode(labels[i])) == labels[i], what.str());
+        Check(labels[i] < -64 || labels[i] > 63 || ZigzagEncode(labels[i]) < 0x80, what.str() + " (one byte)");
+    }
+}
+
+template <class W>
+void CheckRoundTrips(std::mt19937 &random) {
+    std::uniform_int_distribution<int> lengths(0, 40);
+    std::uniform_int_distribution<int> kinds(0, 9);
+    std::uniform_int_distribution<int> small(1, 200);
+    std::uniform_int_distribution<int> large(1, std::numeric_limits<int>::max());
+    std::uniform_int_distribution<int> specials(kCategorialLeftDiv, kCategorialLeftBracket);
+    std::vector<W> weights;
+    weights.push_back(W::One());
+    weights.push_back(W::Zero());
+    for(int i = 0; i < 10000; i++) {
+        std::vector<int> labels(lengths(random));
+        for(size_t j = 0; j < labels.size(); j++) {
+            int kind = kinds(random);
+            labels[j] = kind < 7 ? small(random) : kind < 9 ? large(random) : specials(random);
+        }
+        weights.push_back(W(labels.begin(), labels.end()));
+    }
+    std::stringstream strm;
+    for(size_t i = 0; i < weights.size(); i++) weights[i].Write(strm);
+    for(size_t i = 0; i < weights.size(); i++) {
+        W weight;
+        weight.Read(strm);
+        std::ostringstream what;
+        what << W::Type() << " round trip of " << weights[i];
+        Check(strm && weight == weights[i], what.str());
+    }
+    Check(strm.peek() == EOF, W::Type() + " reads all the bytes written");
+}
+
+void CheckCorrupt() {
+    std::vector<int> labels;
+    for(int i = 1; i <= 100; i++) labels.push_back(i * 1000);
+    std::ostringstream written;
+    Compact(labels.begin(), labels.end()).Write(written);
+    std::string bytes = written.str();
+    for(size_t n = 0; n < bytes.size(); n++) {
+        std::istringstream strm(bytes.substr(0, n));
+        Compact weight(7);
+        weight.Read(strm);
+        std::ostringstream what;
+        what << "truncated after " << n << " bytes";
+        Check(!strm && weight == Compact::One(), what.str());
+    }
+    // 2^40 labels in 2^42 bytes, which the stream does not have
+    char header[20];
+    size_t n = WriteCategorialVarint((uint64) 1 << 40, header);
+    n += WriteCategorialVarint((uint64) 1 << 42, header + n);
+    std::istringstream huge(std::string(header, n) + "abc");
+    Compact weight;
+    weight.Read(huge);
+    Check(!huge && weight == Compact::One(), "announced size larger than the stream");
+    // more bytes than 10 per label
+    n = WriteCategorialVarint(1, header);
+    n += WriteCategorialVarint(11, header + n);
+    std::istringstream inconsistent(std::string(header, n) + std::string(11, '\x01'));
+    weight.Read(inconsistent);
+    Check(!inconsistent, "more than 10 bytes per label");
+
+    // the plain encoding: an int32 size, then the labels
+    std::ostringstream plain_written;
+    Plain(labels.begin(), labels.end()).Write(plain_written);
+    bytes = plain_written.str();
+    for(size_t n = 0; n < bytes.size(); n++) {
+        std::istringstream strm(bytes.substr(0, n));
+        Plain plain(7);
+        plain.Read(strm);
+        std::ostringstream what;
+        what << "plain weight truncated after " << n << " bytes";
+        Check(!strm && plain == Plain::One(), what.str());
+    }
+    int32 sizes[] = {std::numeric_limits<int32>::max(), -1, std::numeric_limits<int32>::min()};
+    for(size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        std::ostringstream corrupt;
+        WriteType(corrupt, sizes[i]);
+        std::istringstream strm(corrupt.str() + "abcdefgh");
+        Plain plain(7);
+        plain.Read(strm);
+        std::ostringstream what;
+        what << "plain weight of corrupt size " << sizes[i];
+        Check(!strm && plain == Plain::One(), what.str());
+    }
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 random(42);
+    CheckVarints();
+    CheckRoundTrips<Plain>(random);
+    CheckRoundTrips<Compact>(random);
+    CheckCorrupt();
+    if(failures) {
+        std::cerr << argv[0] << ": " << failures << " failures\n";
+        return 1;
+    }
+    std::cerr << argv[0] << ": ok\n";
+    return 0;
+}
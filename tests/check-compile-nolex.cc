@@ -0,0 +1,250 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// The compilation of fstcompile-nolex (text-compiler.h), on one thread and
+// in chunks on 2, 4 and 8 threads, against the stream-based compilation it
+// replaced, on random text acceptors and transducers: same states, arcs,
+// weights (bit for bit) and symbol tables, or the same error at the same
+// line. Inputs mix spaces, tabs and carriage returns, weights in all the
+// forms >> accepts, some malformed lines, and sometimes a last line
+// without end of line; a few are large enough to be split in chunks.
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "text-compiler.h"
+
+using namespace fst;
+
+int failures = 0;
+
+void Check(bool ok, const std::string &what) {
+    if(!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+// fstcompile-nolex before text-reader.h, reading from a stream instead of
+// std::cin; returns the line of the first error, or 0.
+int CompileWithStreams(std::istream &input, bool is_transducer, StdVectorFst *automaton, std::string *error) {
+    SymbolTable states("states");
+    SymbolTable isyms("input");
+    SymbolTable osyms("output");
+    isyms.AddSymbol("<eps>");
+    osyms.AddSymbol("<eps>");
+    int line_num = 0;
+    while(!input.eof()) {
+        line_num++;
+        std::string line;
+        std::getline(input, line);
+        std::vector<std::string> tokens;
+        std::istringstream tokenizer(line);
+        while(1) {
+            std::string token;
+            if(!(tokenizer >> token)) break;
+            tokens.push_back(token);
+        }
+        if(input.eof()) break;
+        int64 from_state = -1, to_state = -1, in_symbol = -1, out_symbol = -1;
+        double weight = 0;
+        if(tokens.size() == 0) {
+            *error = "empty line in automaton";
+            return line_num;
+        }
+        from_state = states.Find(tokens[0]);
+        if(from_state == -1) {
+            from_state = automaton->AddState();
+            states.AddSymbol(tokens[0], from_state);
+        }
+        if(tokens.size() <= 2) {
+            if(tokens.size() == 2 && !(std::istringstream(tokens[1]) >> weight)) {
+                *error = "weight not a valid number";
+                return line_num;
+            }
+            automaton->SetFinal(from_state, weight);
+            continue;
+        }
+        to_state = states.Find(tokens[1]);
+        if(to_state == -1) {
+            to_state = automaton->AddState();
+            states.AddSymbol(tokens[1], to_state);
+        }
+        in_symbol = isyms.AddSymbol(tokens[2]);
+        if(is_transducer) {
+            if(tokens.size() < 4) {
+                *error = "missing output symbol in transducer";
+                return line_num;
+            }
+            out_symbol = osyms.AddSymbol(tokens[3]);
+            if(tokens.size() == 5 && !(std::istringstream(tokens[4]) >> weight)) {
+                *error = "weight not a valid number";
+                return line_num;
+            }
+            if(tokens.size() > 5) {
+                *error = "too many fields in transudcer";
+                return line_num;
+            }
+        } else {
+            out_symbol = in_symbol;
+            if(tokens.size() == 4 && !(std::istringstream(tokens[3]) >> weight)) {
+                *error = "weight not a valid number";
+                return line_num;
+            }
+            if(tokens.size() > 4) {
+                *error = "too many fields in acceptor";
+                return line_num;
+            }
+        }
+        automaton->AddArc(from_state, StdArc(in_symbol, out_symbol, weight, to_state));
+    }
+    automaton->SetStart(0);
+    automaton->SetInputSymbols(&isyms);
+    if(is_transducer) automaton->SetOutputSymbols(&osyms);
+    else automaton->SetOutputSymbols(&isyms);
+    return 0;
+}
+
+// The compilation of fstcompile-nolex, in builder->automaton; returns the
+// line of the first error, or 0.
+int CompileText(const std::string &text, bool is_transducer, int threads, FstBuilder *builder, std::string *error) {
+    const char *begin = text.data(), *end = text.data() + text.size();
+    int line_num = threads > 1 ? CompileChunks(begin, end, is_transducer, threads, builder, error)
+        : CompileLines(begin, end, is_transducer, builder, error);
+    if(*error != "") return line_num;
+    builder->automaton.SetStart(0);
+    SetSymbols(*builder->symbols, is_transducer, &builder->automaton);
+    return 0;
+}
+
+bool SameSymbols(const SymbolTable *a, const SymbolTable *b) {
+    if(a == NULL || b == NULL) return a == b;
+    SymbolTableIterator a_iter(*a), b_iter(*b);
+    for(; !a_iter.Done() && !b_iter.Done(); a_iter.Next(), b_iter.Next())
+        if(a_iter.Value() != b_iter.Value() || a_iter.Symbol() != b_iter.Symbol()) return false;
+    return a_iter.Done() && b_iter.Done();
+}
+
+bool SameWeight(const TropicalWeight &a, const TropicalWeight &b) {
+    float a_value = a.Value(), b_value = b.Value();
+    return memcmp(&a_value, &b_value, sizeof(float)) == 0;
+}
+
+bool SameFst(const StdVectorFst &a, const StdVectorFst &b) {
+    if(a.NumStates() != b.NumStates() || a.Start() != b.Start()) return false;
+    for(int s = 0; s < a.NumStates(); s++) {
+        if(!SameWeight(a.Final(s), b.Final(s)) || a.NumArcs(s) != b.NumArcs(s)) return false;
+        ArcIterator<StdVectorFst> a_iter(a, s), b_iter(b, s);
+        for(; !a_iter.Done(); a_iter.Next(), b_iter.Next()) {
+            const StdArc &a_arc = a_iter.Value(), &b_arc = b_iter.Value();
+            if(a_arc.ilabel != b_arc.ilabel || a_arc.olabel != b_arc.olabel || a_arc.nextstate != b_arc.nextstate
+                    || !SameWeight(a_arc.weight, b_arc.weight)) return false;
+        }
+    }
+    return SameSymbols(a.InputSymbols(), b.InputSymbols()) && SameSymbols(a.OutputSymbols(), b.OutputSymbols());
+}
+
+std::string RandomSpace(std::mt19937 &random) {
+    const char *spaces[] = {" ", " ", " ", "\t", "  ", " \t", "\r"};
+    return spaces[std::uniform_int_distribution<int>(0, 6)(random)];
+}
+
+// Text fst of about num_lines lines over num_states states; errors is
+// the probability of a malformed line.
+std::string RandomText(std::mt19937 &random, int num_lines, int num_states, bool is_transducer, double errors) {
+    const char *weights[] = {"0", "1", "-2.5", "0.1", "3e2", "1E-3", "+4", ".5", "7.", "1e-400", "123456789012345678901",
+        "2.5abc", "0x1p3"};
+    const char *bad_weights[] = {"x", "e5", "-", ".", "1e", "1e309", "inf", "nan"};
+    const char *words[] = {"a", "b", "c", "<eps>", "word", "\xc3\xa9t\xc3\xa9", "0", "-1"};
+    std::uniform_int_distribution<int> states(0, num_states - 1), word(0, 7), weight(0, 12), bad_weight(0, 7),
+        kind(0, 9), bad_kind(0, 3);
+    std::uniform_real_distribution<double> unit(0, 1);
+    std::ostringstream text;
+    for(int i = 0; i < num_lines; i++) {
+        std::ostringstream from, to;
+        from << (i == 0 ? 0 : states(random)) << "q";
+        to << states(random) << "q";
+        if(unit(random) < errors) {
+            switch(bad_kind(random)) {
+                case 0: text << RandomSpace(random); break;
+                case 1: text << from.str() << RandomSpace(random) << bad_weights[bad_weight(random)]; break;
+                case 2: text << from.str() << " " << to.str() << " a" << (is_transducer ? "" : " b c") << " 1 2"; break;
+                case 3: text << from.str() << " " << to.str() << " a " << (is_transducer ? "b " : "") << bad_weights[bad_weight(random)]; break;
+            }
+        } else if(kind(random) == 0) {
+            text << from.str();
+            if(kind(random) < 7) text << RandomSpace(random) << weights[weight(random)];
+        } else {
+            text << from.str() << RandomSpace(random) << to.str() << RandomSpace(random) << words[word(random)];
+            if(is_transducer) text << RandomSpace(random) << words[word(random)];
+            if(kind(random) < 7) text << RandomSpace(random) << weights[weight(random)];
+        }
+        if(kind(random) == 0) text << RandomSpace(random);
+        text << "\n";
+    }
+    // a last line without end of line is ignored
+    if(kind(random) == 0) text << "0q 1q a" << (is_transducer ? " b" : "");
+    return text.str();
+}
+
+void CheckCompile(const std::string &text, bool is_transducer, const std::string &what) {
+    std::istringstream input(text);
+    StdVectorFst expected;
+    std::string expected_error;
+    int expected_line = CompileWithStreams(input, is_transducer, &expected, &expected_error);
+    for(int threads = 1; threads <= 8; threads *= 2) {
+        SymbolNames names;
+        FstBuilder builder(&names);
+        std::string error;
+        int line_num = CompileText(text, is_transducer, threads, &builder, &error);
+        std::ostringstream with, message;
+        with << what << " with " << threads << " threads";
+        message << with.str() << ": error \"" << error << "\" line " << line_num << " for \"" << expected_error << "\" line " << expected_line;
+        Check(error == expected_error && line_num == expected_line, message.str());
+        if(error == "" && expected_error == "") Check(SameFst(builder.automaton, expected), with.str() + ": same fst");
+    }
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 random(42);
+    for(int i = 0; i < 2000; i++) {
+        bool is_transducer = i % 2 == 1;
+        int num_lines = std::uniform_int_distribution<int>(0, 40)(random);
+        int num_states = std::uniform_int_distribution<int>(1, 20)(random);
+        std::ostringstream what;
+        what << (is_transducer ? "transducer " : "acceptor ") << i;
+        CheckCompile(RandomText(random, num_lines, num_states, is_transducer, i % 4 < 2 ? 0 : 0.02), is_transducer, what.str());
+    }
+    // 200k to 700k characters: chunks of 64k at least
+    for(int i = 0; i < 12; i++) {
+        bool is_transducer = i % 2 == 1;
+        int num_lines = std::uniform_int_distribution<int>(20000, 50000)(random);
+        std::ostringstream what;
+        what << "large " << (is_transducer ? "transducer " : "acceptor ") << i;
+        CheckCompile(RandomText(random, num_lines, num_lines / 4, is_transducer, i % 4 < 2 ? 0 : 5e-5), is_transducer, what.str());
+    }
+    if(failures) {
+        std::cerr << argv[0] << ": " << failures << " failures\n";
+        return 1;
+    }
+    std::cerr << argv[0] << ": ok\n";
+    return 0;
+}
@@ -0,0 +1,108 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// The vectorized log-add kernels against the scalar one, and LogSum
+// against a long double reference, on random batches with infinities.
+
+#include <algorithm>
+#include <iostream>
+#include <random>
+#include <vector>
+#include <cmath>
+#include <limits>
+
+#include "log-add-kernels.h"
+
+using namespace fst;
+
+const double kMaxRelativeError = 1e-14;
+
+int failures = 0;
+
+double RelativeError(double value, double reference) {
+    if(value == reference) return 0;
+    return std::fabs(value - reference) / std::max(std::fabs(reference), std::numeric_limits<double>::min());
+}
+
+/* -log(sum exp(-values[i])) in long double, with the same shift */
+double Reference(const std::vector<double> &values) {
+    double min = std::numeric_limits<double>::infinity();
+    for(size_t i = 0; i < values.size(); i++) min = std::min(min, values[i]);
+    if(min == std::numeric_limits<double>::infinity()) return min;
+    long double sum = 0;
+    for(size_t i = 0; i < values.size(); i++) sum += expl((long double) min - values[i]);
+    return (double) (min - logl(sum));
+}
+
+void CheckKernel(const char *name, internal::SumShiftedExpFunction kernel, const std::vector<std::vector<double> > &batches) {
+    double worst = 0;
+    for(size_t i = 0; i < batches.size(); i++) {
+        const std::vector<double> &values = batches[i];
+        double shift = std::numeric_limits<double>::infinity();
+        for(size_t j = 0; j < values.size(); j++) shift = std::min(shift, values[j]);
+        if(shift == std::numeric_limits<double>::infinity()) continue;
+        double expected = internal::SumShiftedExpScalar(values.data(), values.size(), shift);
+        double error = RelativeError(kernel(values.data(), values.size(), shift), expected);
+        worst = std::max(worst, error);
+    }
+    std::cerr << name << ": max relative error " << worst << " against the scalar kernel\n";
+    if(worst > kMaxRelativeError) failures++;
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> sizes(0, 70);
+    std::uniform_real_distribution<double> weights(0, 30);
+    std::uniform_real_distribution<double> spread(0, 800);
+    std::uniform_int_distribution<int> kinds(0, 19);
+    std::vector<std::vector<double> > batches(100000);
+    for(size_t i = 0; i < batches.size(); i++) {
+        batches[i].resize(sizes(random));
+        for(size_t j = 0; j < batches[i].size(); j++) {
+            int kind = kinds(random);
+            batches[i][j] = kind == 0 ? std::numeric_limits<double>::infinity() : kind == 1 ? spread(random) : weights(random);
+        }
+    }
+
+    CheckKernel("scalar", internal::SumShiftedExpScalar, batches);
+#ifdef FST_LOG_ADD_KERNELS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        CheckKernel("avx2", internal::SumShiftedExpAvx2, batches);
+    if(__builtin_cpu_supports("avx512f"))
+        CheckKernel("avx512", internal::SumShiftedExpAvx512, batches);
+#endif
+
+    double worst = 0;
+    for(size_t i = 0; i < batches.size(); i++) {
+        double value = LogSum(batches[i].data(), batches[i].size());
+        double reference = Reference(batches[i]);
+        if(std::isinf(reference)) {
+            if(value != reference) failures++;
+            continue;
+        }
+        /* results close to 0 are compared in absolute error */
+        worst = std::max(worst, std::fabs(value - reference) / std::max(1.0, std::fabs(reference)));
+    }
+    std::cerr << "LogSum: max error " << worst << " against long double\n";
+    if(worst > kMaxRelativeError) failures++;
+
+    if(failures) {
+        std::cerr << argv[0] << ": " << failures << " failures\n";
+        return 1;
+    }
+    std::cerr << argv[0] << ": ok\n";
+    return 0;
+}
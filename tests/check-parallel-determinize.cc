@@ -0,0 +1,275 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// The subset construction of parallel-determinize.h against brute force
+// on random acyclic acceptors, in the tropical and the left categorial
+// semirings: the result must be deterministic and accept the same word
+// strings, with the best tropical weight of their paths, or the tag
+// string of one of their paths. Acceptors are small, or layered and wide
+// enough for levels of the construction to be split between threads;
+// results with 2, 4 and 8 threads must be the one of a single thread up
+// to the numbering of states.
+
+#include <algorithm>
+#include <iostream>
+#include <map>
+#include <random>
+#include <set>
+#include <sstream>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "categorial-weight.h"
+#include "parallel-determinize.h"
+
+using namespace fst;
+
+typedef CategorialWeight<int> Categorial;
+typedef ArcTpl<Categorial> CategorialArc;
+
+int failures = 0;
+
+void Check(bool ok, const std::string &what) {
+    if(!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+// Tag strings with divisions are resolved in the free group over labels,
+// where y\x is the inverse of y followed by x: along a path, the quotients
+// of the residuals cancel out. Elements are labels with an exponent of 1
+// or -1, kept reduced.
+typedef std::vector<std::pair<int, int> > Element;
+
+void Append(const Element &e, Element *product) {
+    for(size_t i = 0; i < e.size(); i++) {
+        if(!product->empty() && product->back().first == e[i].first && product->back().second == -e[i].second)
+            product->pop_back();
+        else
+            product->push_back(e[i]);
+    }
+}
+
+Element Inverse(const Element &e) {
+    Element inverse;
+    for(size_t i = e.size(); i > 0; i--) inverse.push_back(std::make_pair(e[i - 1].first, -e[i - 1].second));
+    return inverse;
+}
+
+// Value of a left categorial weight: the dividend after the last top-level
+// '\', divided by each part before it, innermost last; a divisor in
+// brackets is itself resolved. Returns false on a malformed string.
+bool Resolve(const std::vector<int> &labels, Element *value) {
+    std::vector<std::vector<int> > parts(1);
+    int depth = 0;
+    for(size_t i = 0; i < labels.size(); i++) {
+        if(labels[i] == kCategorialLeftBracket) depth++;
+        if(labels[i] == kCategorialRightBracket) depth--;
+        if(depth == 0 && labels[i] == kCategorialLeftDiv) parts.push_back(std::vector<int>());
+        else parts.back().push_back(labels[i]);
+    }
+    value->clear();
+    for(size_t i = 0; i < parts.size(); i++) {
+        const std::vector<int> &part = parts[i];
+        Element e;
+        if(!part.empty() && part[0] == kCategorialLeftBracket) {
+            if(part.back() != kCategorialRightBracket) return false;
+            if(!Resolve(std::vector<int>(part.begin() + 1, part.end() - 1), &e)) return false;
+        } else {
+            for(size_t j = 0; j < part.size(); j++) {
+                if(part[j] < 0) return false;
+                e.push_back(std::make_pair(part[j], 1));
+            }
+        }
+        Append(i + 1 == parts.size() ? e : Inverse(e), value);
+    }
+    return true;
+}
+
+// What is compared between the brute force and the determinized fst:
+// the weight itself in the tropical semiring, its resolved tag string in
+// the categorial one.
+struct TropicalTraits {
+    typedef StdArc Arc;
+    typedef TropicalWeight Value;
+    static Value Resolved(const TropicalWeight &w) { return w; }
+    static bool Accepts(const std::vector<Value> &values, const Value &value) {
+        return ApproxEqual(values[0], value);
+    }
+    static void Add(const Value &value, std::vector<Value> *values) {
+        if(values->empty()) values->push_back(value);
+        else (*values)[0] = Plus((*values)[0], value);
+    }
+    static Value Extend(const Value &value, const TropicalWeight &w) { return Times(value, w); }
+};
+
+struct CategorialTraits {
+    typedef CategorialArc Arc;
+    typedef Element Value;
+    static Value Resolved(const Categorial &w) {
+        Element value;
+        if(!Resolve(std::vector<int>(w.Labels(), w.Labels() + w.Size()), &value)) value.push_back(std::make_pair(0, 0));
+        return value;
+    }
+    static bool Accepts(const std::vector<Value> &values, const Value &value) {
+        return std::find(values.begin(), values.end(), value) != values.end();
+    }
+    static void Add(const Value &value, std::vector<Value> *values) {
+        values->push_back(value);
+    }
+    static Value Extend(const Value &value, const Categorial &w) {
+        Value extended(value);
+        Append(Resolved(w), &extended);
+        return extended;
+    }
+};
+
+// Random acyclic acceptor: num_states states in a row, with arcs forward
+// to any later state; or layers of the given width, with arcs to the next
+// layer only.
+template <class Arc>
+void RandomAcceptor(std::mt19937 &random, int num_states, int width, int vocabulary, VectorFst<Arc> *fst) {
+    typedef typename Arc::Weight Weight;
+    std::uniform_int_distribution<int> words(1, vocabulary), tags(1, 4), arcs(1, 3);
+    for(int s = 0; s < num_states; s++) fst->AddState();
+    fst->SetStart(0);
+    for(int s = 0; s + 1 < num_states; s++) {
+        int n = s == 0 && width > 1 ? 2 * width : arcs(random);
+        int layer = width > 1 ? (s + width - 1) / width : s;
+        int first = width > 1 ? layer * width + 1 : s + 1;
+        int last = width > 1 ? std::min(first + width - 1, num_states - 1) : num_states - 1;
+        if(first > num_states - 1) first = last = num_states - 1;
+        for(int i = 0; i < n; i++) {
+            int next = std::uniform_int_distribution<int>(first, last)(random);
+            int tag = tags(random);
+            fst->AddArc(s, Arc(words(random), 0, Weight(tag), next));
+        }
+    }
+    fst->SetFinal(num_states - 1, Weight::One());
+}
+
+// Values of all the paths of each word string.
+template <class Traits>
+void BruteForce(const VectorFst<typename Traits::Arc> &fst, int state, std::vector<int> &words,
+        const typename Traits::Arc::Weight &weight, std::map<std::vector<int>, std::vector<typename Traits::Value> > *values) {
+    typedef typename Traits::Arc Arc;
+    if(fst.Final(state) != Arc::Weight::Zero())
+        Traits::Add(Traits::Resolved(Times(weight, fst.Final(state))), &(*values)[words]);
+    for(ArcIterator<VectorFst<Arc> > aiter(fst, state); !aiter.Done(); aiter.Next()) {
+        words.push_back(aiter.Value().ilabel);
+        BruteForce<Traits>(fst, aiter.Value().nextstate, words, Times(weight, aiter.Value().weight), values);
+        words.pop_back();
+    }
+}
+
+// Number of word strings of a deterministic fst; each of them must be
+// accepted by the brute force with the value of the path, where weights
+// are resolved one by one. Returns -1 if the fst is not deterministic.
+template <class Traits>
+int CheckPaths(const VectorFst<typename Traits::Arc> &fst, int state, std::vector<int> &words,
+        const typename Traits::Value &value, const std::map<std::vector<int>, std::vector<typename Traits::Value> > &values,
+        const std::string &what) {
+    typedef typename Traits::Arc Arc;
+    int count = 0;
+    if(fst.Final(state) != Arc::Weight::Zero()) {
+        typename std::map<std::vector<int>, std::vector<typename Traits::Value> >::const_iterator found = values.find(words);
+        Check(found != values.end() && Traits::Accepts(found->second, Traits::Extend(value, fst.Final(state))),
+                what + ": value of a word string");
+        count++;
+    }
+    std::set<int> labels;
+    for(ArcIterator<VectorFst<Arc> > aiter(fst, state); !aiter.Done(); aiter.Next()) {
+        if(!labels.insert(aiter.Value().ilabel).second) return -1;
+        words.push_back(aiter.Value().ilabel);
+        int n = CheckPaths<Traits>(fst, aiter.Value().nextstate, words, Traits::Extend(value, aiter.Value().weight), values, what);
+        words.pop_back();
+        if(n < 0) return -1;
+        count += n;
+    }
+    return count;
+}
+
+// Whether two deterministic acceptors are the same up to the numbering of
+// their states.
+template <class Arc>
+bool Isomorphic(const VectorFst<Arc> &a, const VectorFst<Arc> &b) {
+    if(a.NumStates() != b.NumStates()) return false;
+    if(a.Start() == kNoStateId || b.Start() == kNoStateId) return a.Start() == b.Start();
+    std::vector<int> image(a.NumStates(), kNoStateId);
+    std::vector<int> queue(1, a.Start());
+    image[a.Start()] = b.Start();
+    for(size_t i = 0; i < queue.size(); i++) {
+        int s = queue[i], t = image[s];
+        if(a.Final(s) != b.Final(t) || a.NumArcs(s) != b.NumArcs(t)) return false;
+        std::map<int, Arc> arcs;
+        for(ArcIterator<VectorFst<Arc> > aiter(b, t); !aiter.Done(); aiter.Next()) arcs[aiter.Value().ilabel] = aiter.Value();
+        for(ArcIterator<VectorFst<Arc> > aiter(a, s); !aiter.Done(); aiter.Next()) {
+            const Arc &arc = aiter.Value();
+            typename std::map<int, Arc>::const_iterator found = arcs.find(arc.ilabel);
+            if(found == arcs.end() || found->second.weight != arc.weight) return false;
+            if(image[arc.nextstate] == kNoStateId) {
+                image[arc.nextstate] = found->second.nextstate;
+                queue.push_back(arc.nextstate);
+            } else if(image[arc.nextstate] != found->second.nextstate) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+template <class Traits>
+void CheckSemiring(const std::string &name, std::mt19937 &random) {
+    typedef typename Traits::Arc Arc;
+    for(int i = 0; i < 240; i++) {
+        // one acceptor in four is layered: 3 layers of 40 to 100 states
+        bool wide = i % 4 == 3;
+        int width = wide ? std::uniform_int_distribution<int>(40, 100)(random) : 1;
+        int num_states = wide ? 3 * width + 2 : std::uniform_int_distribution<int>(2, 12)(random);
+        int vocabulary = wide ? 2 * width : 3;
+        VectorFst<Arc> fst;
+        RandomAcceptor(random, num_states, width, vocabulary, &fst);
+        std::ostringstream what;
+        what << name << " acceptor " << i << " (" << num_states << " states)";
+
+        std::map<std::vector<int>, std::vector<typename Traits::Value> > values;
+        std::vector<int> words;
+        BruteForce<Traits>(fst, fst.Start(), words, Arc::Weight::One(), &values);
+        VectorFst<Arc> single;
+        ParallelDeterminize(fst, &single, 1);
+        int count = CheckPaths<Traits>(single, single.Start(), words, Traits::Resolved(Arc::Weight::One()), values, what.str());
+        Check(count == static_cast<int>(values.size()), what.str() + ": deterministic, with the same word strings");
+        for(int threads = 2; threads <= 8; threads *= 2) {
+            VectorFst<Arc> parallel;
+            ParallelDeterminize(fst, &parallel, threads);
+            std::ostringstream with;
+            with << what.str() << ": same result with " << threads << " threads";
+            Check(Isomorphic(single, parallel), with.str());
+        }
+    }
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 random(42);
+    CheckSemiring<TropicalTraits>("tropical", random);
+    CheckSemiring<CategorialTraits>("categorial", random);
+    if(failures) {
+        std::cerr << argv[0] << ": " << failures << " failures\n";
+        return 1;
+    }
+    std::cerr << argv[0] << ": ok\n";
+    return 0;
+}
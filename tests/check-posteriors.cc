@@ -0,0 +1,180 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// Arc posteriors of the acyclic fast path of fstposteriors (forward-backward
+// in topological order) against ShortestDistance() in the log semiring, as
+// in the general path but with a small delta (the default one, 1/1024, is
+// the precision of the general path), on random acyclic lattices with
+// epsilons, several final states and dead ends; cycles must be detected.
+// Confusion networks must keep the expected number of words of the
+// lattice, with a mass of 1 in every bin (epsilon included) and no
+// posterior above 1.
+
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "posteriors.h"
+
+using namespace fst;
+
+// the reference goes through float weights
+const double kMaxError = 1e-4;
+const float kReferenceDelta = 1e-6;
+
+int failures = 0;
+
+// Posterior of each arc from ShortestDistance() in the log semiring.
+void ReferencePosteriors(const StdVectorFst &lattice, std::vector<std::vector<double> > *posteriors) {
+    VectorFst<LogArc> input;
+    Map(lattice, &input, StdToLogMapper());
+    std::vector<LogWeight> alpha, beta;
+    ShortestDistance(input, &alpha, false, kReferenceDelta);
+    ShortestDistance(input, &beta, true, kReferenceDelta);
+    alpha.resize(input.NumStates(), LogWeight::Zero());
+    beta.resize(input.NumStates(), LogWeight::Zero());
+    double total = beta[input.Start()].Value();
+    posteriors->resize(input.NumStates());
+    for(int state = 0; state < input.NumStates(); state++) {
+        for(ArcIterator<VectorFst<LogArc> > aiter(input, state); !aiter.Done(); aiter.Next()) {
+            const LogArc &arc = aiter.Value();
+            (*posteriors)[state].push_back(exp(-((double) alpha[state].Value() + arc.weight.Value() + beta[arc.nextstate].Value() - total)));
+        }
+    }
+}
+
+void Check(bool ok, const std::string &what) {
+    if(!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+// Random acyclic lattice over states numbered in a shuffled order, so
+// that the topological order is not the numbering: a chain of arcs from
+// the start to the last state, more arcs which skip up to 3 states, some
+// final states in the middle and dead ends. One word in five is an
+// epsilon.
+void RandomLattice(std::mt19937 &random, int num_states, StdVectorFst *lattice) {
+    std::vector<int> ids(num_states);
+    for(int i = 0; i < num_states; i++) ids[i] = i;
+    std::shuffle(ids.begin() + 1, ids.end(), random);
+    for(int i = 0; i < num_states; i++) lattice->AddState();
+    lattice->SetStart(ids[0]);
+    std::uniform_int_distribution<int> words(0, 4), arcs(0, 2), tenth(0, 9);
+    std::uniform_real_distribution<float> costs(0, 5);
+    for(int i = 0; i + 1 < num_states; i++) {
+        int n = 1 + arcs(random);
+        for(int j = 0; j < n; j++) {
+            int next = j == 0 ? i + 1 : std::uniform_int_distribution<int>(i + 1, std::min(i + 4, num_states - 1))(random);
+            int word = words(random);
+            lattice->AddArc(ids[i], StdArc(word, word, costs(random), ids[next]));
+        }
+        if(tenth(random) == 0) lattice->SetFinal(ids[i], costs(random));
+        if(tenth(random) == 0) {
+            int word = words(random);
+            lattice->AddArc(ids[i], StdArc(word, word, costs(random), lattice->AddState()));
+        }
+    }
+    lattice->SetFinal(ids[num_states - 1], costs(random));
+}
+
+void CheckPosteriors(std::mt19937 &random) {
+    for(int i = 0; i < 500; i++) {
+        StdVectorFst fast;
+        RandomLattice(random, std::uniform_int_distribution<int>(2, 60)(random), &fast);
+        std::vector<std::vector<double> > reference;
+        ReferencePosteriors(fast, &reference);
+        std::vector<int> order;
+        std::ostringstream what;
+        what << "lattice " << i;
+        Check(TopologicalOrder(fast, &order), what.str() + " is acyclic");
+        AcyclicPosteriors(&fast, order, NULL);
+        double error = 0;
+        for(int state = 0; state < fast.NumStates(); state++) {
+            size_t i = 0;
+            for(ArcIterator<StdVectorFst> aiter(fast, state); !aiter.Done(); aiter.Next(), i++) {
+                double difference = std::fabs(aiter.Value().weight.Value() - reference[state][i]);
+                if(error == error && !(difference <= error)) error = difference;  // a NaN sticks
+            }
+        }
+        std::ostringstream error_what;
+        error_what << what.str() << ": posteriors differ by " << error;
+        Check(error <= kMaxError, error_what.str());
+    }
+}
+
+void CheckSausages(std::mt19937 &random) {
+    for(int i = 0; i < 500; i++) {
+        StdVectorFst lattice;
+        RandomLattice(random, std::uniform_int_distribution<int>(2, 60)(random), &lattice);
+        std::vector<int> order;
+        TopologicalOrder(lattice, &order);
+        Sausage sausage;
+        AcyclicPosteriors(&lattice, order, &sausage);
+        double words = 0;
+        for(int state = 0; state < lattice.NumStates(); state++)
+            for(ArcIterator<StdVectorFst> aiter(lattice, state); !aiter.Done(); aiter.Next())
+                if(aiter.Value().ilabel != 0) words += aiter.Value().weight.Value();
+        double mass = 0, max_posterior = 0, max_error = 0;
+        for(size_t bin = 0; bin < sausage.size(); bin++) {
+            double sum = 0;
+            for(std::map<int, double>::const_iterator it = sausage[bin].begin(); it != sausage[bin].end(); ++it) {
+                sum += it->second;
+                if(it->first != 0) mass += it->second;
+                max_posterior = std::max(max_posterior, it->second);
+            }
+            max_error = std::max(max_error, std::fabs(sum - 1));
+        }
+        std::ostringstream what;
+        what << "sausage " << i << " (" << sausage.size() << " bins): ";
+        std::ostringstream bins, posterior, expected;
+        bins << what.str() << "bins sum to 1 up to " << max_error;
+        posterior << what.str() << "posterior " << max_posterior;
+        expected << what.str() << mass << " words for " << words << " expected";
+        Check(max_error <= 1e-6, bins.str());
+        Check(max_posterior <= 1, posterior.str());
+        Check(std::fabs(mass - words) <= 1e-4 * std::max(words, 1.0), expected.str());
+    }
+}
+
+void CheckCycles() {
+    StdVectorFst lattice;
+    for(int i = 0; i < 3; i++) lattice.AddState();
+    lattice.SetStart(0);
+    lattice.AddArc(0, StdArc(1, 1, 1, 1));
+    lattice.AddArc(1, StdArc(2, 2, 1, 2));
+    lattice.AddArc(2, StdArc(3, 3, 1, 1));
+    lattice.SetFinal(2, 0);
+    std::vector<int> order;
+    Check(!TopologicalOrder(lattice, &order), "cycle detected");
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 random(42);
+    CheckPosteriors(random);
+    CheckSausages(random);
+    CheckCycles();
+    if(failures) {
+        std::cerr << argv[0] << ": " << failures << " failures\n";
+        return 1;
+    }
+    std::cerr << argv[0] << ": ok\n";
+    return 0;
+}
@@ -0,0 +1,293 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// The single-level special matcher against the stacked rho, sigma and phi
+// matchers of OpenFst, by the paths of the compositions of random
+// sentences with random models, and the time both take on a rho-heavy
+// model. Epsilons on both sides must compose as with the default matchers.
+
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "special-matcher.h"
+
+using namespace fst;
+
+typedef RhoMatcher<SigmaMatcher<PhiMatcher<SortedMatcher<StdFst> > > > StackedMatcher;
+
+// best weight and number of the paths of each pair of label strings,
+// epsilons removed
+struct Paths {
+    std::map<std::pair<std::vector<int>, std::vector<int> >, float> best;
+    size_t count;
+};
+
+const int kVocabulary = 8;
+const int kRho = kVocabulary + 1;
+const int kSigma = kVocabulary + 2;
+const int kPhi = kVocabulary + 3;
+
+int failures = 0;
+
+void Check(bool ok, const std::string &what) {
+    if(!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+void AddPaths(const StdVectorFst &fst, StdArc::StateId s, std::vector<int> *input, std::vector<int> *output, float weight, Paths *paths) {
+    if(fst.Final(s) != StdArc::Weight::Zero()) {
+        float total = weight + fst.Final(s).Value();
+        std::pair<std::vector<int>, std::vector<int> > key(*input, *output);
+        if(paths->best.find(key) == paths->best.end() || total < paths->best[key]) paths->best[key] = total;
+        paths->count++;
+    }
+    for(ArcIterator<StdVectorFst> aiter(fst, s); !aiter.Done(); aiter.Next()) {
+        const StdArc &arc = aiter.Value();
+        if(arc.ilabel != 0) input->push_back(arc.ilabel);
+        if(arc.olabel != 0) output->push_back(arc.olabel);
+        AddPaths(fst, arc.nextstate, input, output, weight + arc.weight.Value(), paths);
+        if(arc.ilabel != 0) input->pop_back();
+        if(arc.olabel != 0) output->pop_back();
+    }
+}
+
+bool GetPaths(const StdVectorFst &fst, Paths *paths) {
+    paths->best.clear();
+    paths->count = 0;
+    if(fst.Start() == kNoStateId) return true;
+    if(!fst.Properties(kAcyclic, true)) return false;
+    std::vector<int> input, output;
+    AddPaths(fst, fst.Start(), &input, &output, 0, paths);
+    return true;
+}
+
+// all the paths of a are paths of b with the same best weight, or (if
+// !exact) with a better one in b
+bool Included(const Paths &a, const Paths &b, bool exact) {
+    for(std::map<std::pair<std::vector<int>, std::vector<int> >, float>::const_iterator i = a.best.begin(); i != a.best.end(); i++) {
+        std::map<std::pair<std::vector<int>, std::vector<int> >, float>::const_iterator found = b.best.find(i->first);
+        if(found == b.best.end()) return false;
+        if(exact ? std::fabs(found->second - i->second) > 1e-4 : found->second > i->second + 1e-4) return false;
+    }
+    return true;
+}
+
+// linear fst over the vocabulary, with output epsilons if epsilons is set
+void RandomSentence(std::mt19937 &random, int length, bool epsilons, StdVectorFst *sentence) {
+    std::uniform_int_distribution<int> labels(1, kVocabulary);
+    std::uniform_int_distribution<int> kinds(0, 3);
+    sentence->DeleteStates();
+    StdArc::StateId state = sentence->AddState();
+    sentence->SetStart(state);
+    for(int i = 0; i < length; i++) {
+        StdArc::StateId next = sentence->AddState();
+        int label = labels(random);
+        sentence->AddArc(state, StdArc(label, epsilons && kinds(random) == 0 ? 0 : label, StdArc::Weight::One(), next));
+        state = next;
+    }
+    sentence->SetFinal(state, StdArc::Weight::One());
+    ArcSort(sentence, StdOLabelCompare());
+}
+
+// backoff model: state 0 is the root, the others back off to a lower
+// state with a phi arc; input epsilons only go to higher states, so the
+// compositions with sentences are acyclic
+void RandomModel(std::mt19937 &random, int num_states, bool specials, bool epsilons, bool loop, StdVectorFst *model) {
+    std::uniform_int_distribution<int> labels(1, kVocabulary);
+    std::uniform_int_distribution<int> outputs(0, kVocabulary);
+    std::uniform_int_distribution<int> states(0, num_states - 1);
+    std::uniform_int_distribution<int> degrees(0, 4);
+    std::uniform_int_distribution<int> kinds(0, 9);
+    std::uniform_real_distribution<float> weights(0, 5);
+    model->DeleteStates();
+    for(int s = 0; s < num_states; s++) model->AddState();
+    model->SetStart(states(random));
+    for(int s = 0; s < num_states; s++) {
+        if(kinds(random) < 3) model->SetFinal(s, weights(random));
+        for(int degree = degrees(random); degree > 0; degree--)
+            model->AddArc(s, StdArc(labels(random), outputs(random), weights(random), states(random)));
+        if(!specials) continue;
+        if(kinds(random) < 2) model->AddArc(s, StdArc(kSigma, outputs(random), weights(random), states(random)));
+        if(kinds(random) < 3) model->AddArc(s, StdArc(kRho, outputs(random), weights(random), states(random)));
+        if(s > 0) {
+            std::uniform_int_distribution<int> lower(0, s - 1);
+            model->AddArc(s, StdArc(kPhi, 0, weights(random), lower(random)));
+        } else if(loop) {
+            model->AddArc(s, StdArc(kPhi, 0, weights(random), s));
+        }
+    }
+    if(epsilons) {
+        for(int s = 0; s + 1 < num_states; s++) {
+            std::uniform_int_distribution<int> higher(s + 1, num_states - 1);
+            if(kinds(random) < 3) model->AddArc(s, StdArc(0, outputs(random), weights(random), higher(random)));
+        }
+    }
+    ArcSort(model, StdILabelCompare());
+}
+
+template <class M>
+void ComposeWith(const StdVectorFst &sentence, M *matcher1, M *matcher2, const StdVectorFst &model, StdVectorFst *output) {
+    ComposeFstOptions<StdArc, M> opts;
+    opts.matcher1 = matcher1;
+    opts.matcher2 = matcher2;
+    *output = ComposeFst<StdArc>(sentence, model, opts);
+    Connect(output);
+}
+
+void ComposeSpecial(const StdVectorFst &sentence, const StdVectorFst &model, bool specials, const StdPhiClosure *closure, StdVectorFst *output) {
+    int rho = specials ? kRho : kNoLabel, sigma = specials ? kSigma : kNoLabel, phi = specials ? kPhi : kNoLabel;
+    ComposeWith(sentence, new StdSpecialMatcher(sentence, MATCH_OUTPUT),
+            new StdSpecialMatcher(model, MATCH_INPUT, rho, sigma, phi, closure), model, output);
+}
+
+void ComposeStacked(const StdVectorFst &sentence, const StdVectorFst &model, StdVectorFst *output) {
+    ComposeWith(sentence,
+            new StackedMatcher(sentence, MATCH_OUTPUT, kNoLabel, MATCHER_REWRITE_ALWAYS,
+                new SigmaMatcher<PhiMatcher<SortedMatcher<StdFst> > >(sentence, MATCH_OUTPUT, kNoLabel, MATCHER_REWRITE_ALWAYS,
+                    new PhiMatcher<SortedMatcher<StdFst> >(sentence, MATCH_OUTPUT, kNoLabel, MATCHER_REWRITE_ALWAYS))),
+            new StackedMatcher(model, MATCH_INPUT, kRho, MATCHER_REWRITE_ALWAYS,
+                new SigmaMatcher<PhiMatcher<SortedMatcher<StdFst> > >(model, MATCH_INPUT, kSigma, MATCHER_REWRITE_ALWAYS,
+                    new PhiMatcher<SortedMatcher<StdFst> >(model, MATCH_INPUT, kPhi, MATCHER_REWRITE_ALWAYS))),
+            model, output);
+}
+
+// a sentence with output epsilons on a model with input epsilons and no
+// special arcs composes as with the default matchers
+void CheckEpsilons(std::mt19937 &random) {
+    StdVectorFst sentence, model, expected, output;
+    Paths expected_paths, paths;
+    for(int i = 0; i < 200; i++) {
+        RandomSentence(random, 6, true, &sentence);
+        RandomModel(random, 6, false, true, false, &model);
+        Compose(sentence, model, &expected);
+        Connect(&expected);
+        ComposeSpecial(sentence, model, false, NULL, &output);
+        std::ostringstream what;
+        what << "epsilons, case " << i;
+        Check(GetPaths(expected, &expected_paths) && GetPaths(output, &paths), what.str() + " (cyclic composition)");
+        Check(paths.count == expected_paths.count, what.str() + " (number of paths)");
+        Check(Included(paths, expected_paths, true) && Included(expected_paths, paths, true), what.str() + " (paths)");
+    }
+}
+
+// on models where no sigma lookup reaches a phi self-loop, both matchers
+// give the same paths; otherwise the stacked ones also take the loop for
+// sigma, which only adds paths to the same strings
+void CheckStacked(std::mt19937 &random) {
+    std::uniform_int_distribution<int> coins(0, 1);
+    StdVectorFst sentence, model, expected, output;
+    Paths expected_paths, paths;
+    int differing = 0;
+    for(int i = 0; i < 1000; i++) {
+        bool epsilons = coins(random), loop = coins(random);
+        RandomSentence(random, 5, epsilons, &sentence);
+        RandomModel(random, 8, true, epsilons, loop, &model);
+        bool exact = !loop;
+        for(ArcIterator<StdVectorFst> aiter(model, 0); !aiter.Done(); aiter.Next())
+            if(aiter.Value().ilabel == kSigma) exact = true;
+        ComposeStacked(sentence, model, &expected);
+        Check(GetPaths(expected, &expected_paths), "stacked composition is acyclic");
+        StdPhiClosure closure(model, MATCH_INPUT, kPhi, 1 << 20);
+        for(int with_closure = 0; with_closure < 2; with_closure++) {
+            ComposeSpecial(sentence, model, true, with_closure ? &closure : NULL, &output);
+            std::ostringstream what;
+            what << "stacked, case " << i << (with_closure ? " with closure" : "");
+            Check(GetPaths(output, &paths), what.str() + " (cyclic composition)");
+            Check(Included(paths, expected_paths, exact), what.str() + " (paths missing from the stacked matchers)");
+            Check(!exact || Included(expected_paths, paths, true), what.str() + " (paths missing from the special matcher)");
+            if(!with_closure && paths.count != expected_paths.count) differing++;
+        }
+    }
+    std::cerr << "stacked: " << differing << " of 1000 compositions with a different number of paths\n";
+}
+
+// rho arcs at every state of a large backoff model, as for the unknown
+// words of a class language model
+void TimeRho(std::mt19937 &random) {
+    const int kStates = 5000, kLabels = 10000;
+    std::uniform_int_distribution<int> labels(1, kLabels);
+    std::uniform_int_distribution<int> states(0, kStates - 1);
+    std::uniform_real_distribution<float> weights(0, 5);
+    StdVectorFst model;
+    for(int s = 0; s < kStates; s++) model.AddState();
+    model.SetStart(0);
+    for(int s = 0; s < kStates; s++) {
+        model.SetFinal(s, weights(random));
+        for(int i = 0; i < 20; i++) model.AddArc(s, StdArc(labels(random), labels(random), weights(random), states(random)));
+        model.AddArc(s, StdArc(kLabels + 1, kLabels + 1, weights(random), states(random)));
+        if(s > 0) model.AddArc(s, StdArc(kLabels + 3, 0, weights(random), s / 2));
+    }
+    ArcSort(&model, StdILabelCompare());
+    std::vector<StdVectorFst> sentences(100);
+    for(size_t i = 0; i < sentences.size(); i++) {
+        StdArc::StateId state = sentences[i].AddState();
+        sentences[i].SetStart(state);
+        for(int j = 0; j < 30; j++) {
+            StdArc::StateId next = sentences[i].AddState();
+            int label = labels(random);
+            sentences[i].AddArc(state, StdArc(label, label, StdArc::Weight::One(), next));
+            state = next;
+        }
+        sentences[i].SetFinal(state, StdArc::Weight::One());
+    }
+    StdVectorFst output;
+    size_t arcs[2] = {0, 0};
+    double seconds[2];
+    for(int stacked = 0; stacked < 2; stacked++) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for(size_t i = 0; i < sentences.size(); i++) {
+            ComposeFstOptions<StdArc, StackedMatcher> stacked_opts;
+            ComposeFstOptions<StdArc, StdSpecialMatcher> special_opts;
+            if(stacked) {
+                stacked_opts.matcher1 = new StackedMatcher(sentences[i], MATCH_OUTPUT, kNoLabel);
+                stacked_opts.matcher2 = new StackedMatcher(model, MATCH_INPUT, kLabels + 1, MATCHER_REWRITE_ALWAYS,
+                        new SigmaMatcher<PhiMatcher<SortedMatcher<StdFst> > >(model, MATCH_INPUT, kNoLabel, MATCHER_REWRITE_ALWAYS,
+                            new PhiMatcher<SortedMatcher<StdFst> >(model, MATCH_INPUT, kLabels + 3, MATCHER_REWRITE_ALWAYS)));
+                output = ComposeFst<StdArc>(sentences[i], model, stacked_opts);
+            } else {
+                special_opts.matcher1 = new StdSpecialMatcher(sentences[i], MATCH_OUTPUT);
+                special_opts.matcher2 = new StdSpecialMatcher(model, MATCH_INPUT, kLabels + 1, kNoLabel, kLabels + 3);
+                output = ComposeFst<StdArc>(sentences[i], model, special_opts);
+            }
+            for(StateIterator<StdVectorFst> siter(output); !siter.Done(); siter.Next())
+                arcs[stacked] += output.NumArcs(siter.Value());
+        }
+        seconds[stacked] = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    std::cerr << "rho model: special " << seconds[0] << "s, stacked " << seconds[1] << "s for "
+        << sentences.size() << " sentences\n";
+    Check(arcs[0] == arcs[1], "rho model compositions have the same number of arcs");
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 random(42);
+    CheckEpsilons(random);
+    CheckStacked(random);
+    TimeRho(random);
+    if(failures) {
+        std::cerr << argv[0] << ": " << failures << " failures\n";
+        return 1;
+    }
+    std::cerr << argv[0] << ": ok\n";
+    return 0;
+}
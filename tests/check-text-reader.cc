@@ -0,0 +1,171 @@
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+
+// The parsing of text-reader.h against the streams it replaced in
+// fstcompile-nolex: ParseTextWeight() must accept the tokens which the >>
+// operator accepts, with the same double bit for bit, on random tokens
+// (random characters of numbers, numbers of up to 40 digits with
+// exponents which overflow or underflow, trailing characters);
+// SplitTextLine() must split lines as >> on strings does, and
+// TextNameTable must number names in order of first occurrence.
+
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "text-reader.h"
+
+using namespace fst;
+
+int failures = 0;
+
+void Check(bool ok, const std::string &what) {
+    if(!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        failures++;
+    }
+}
+
+std::string RandomDigits(std::mt19937 &random, int max_digits) {
+    std::string digits;
+    int n = std::uniform_int_distribution<int>(0, max_digits)(random);
+    std::uniform_int_distribution<int> digit(0, 9), zero(0, 3);
+    // leading and trailing zeros are frequent
+    for(int i = 0; i < n; i++) digits += zero(random) == 0 ? '0' : '0' + digit(random);
+    return digits;
+}
+
+// A number with optional sign, fraction and exponent, sometimes broken or
+// followed by other characters.
+std::string RandomNumber(std::mt19937 &random) {
+    std::uniform_int_distribution<int> coin(0, 1), quarter(0, 3), signs(0, 2), exponents(0, 400);
+    const char *sign = "+-";
+    std::string number;
+    if(signs(random) < 2) number += sign[signs(random) % 2];
+    number += RandomDigits(random, quarter(random) == 0 ? 40 : 8);
+    if(coin(random)) number += "." + RandomDigits(random, quarter(random) == 0 ? 40 : 8);
+    if(coin(random)) {
+        number += quarter(random) == 0 ? 'E' : 'e';
+        if(signs(random) < 2) number += sign[signs(random) % 2];
+        if(quarter(random) > 0) {
+            std::ostringstream exponent;
+            exponent << (quarter(random) == 0 ? exponents(random) : exponents(random) % 30);
+            number += exponent.str();
+        }
+    }
+    if(quarter(random) == 0) {
+        const char *tails[] = {"x", "e", "e+", ".", ".5", "-1", "abc", "0x1p3"};
+        number += tails[std::uniform_int_distribution<int>(0, 7)(random)];
+    }
+    return number;
+}
+
+std::string RandomCharacters(std::mt19937 &random) {
+    const char alphabet[] = "0123456789.+-eEx";
+    std::uniform_int_distribution<int> length(1, 12), character(0, sizeof(alphabet) - 2);
+    std::string token;
+    for(int n = length(random); n > 0; n--) token += alphabet[character(random)];
+    return token;
+}
+
+void CheckWeight(const std::string &token) {
+    double expected = 0, value = 0;
+    bool expected_ok = static_cast<bool>(std::istringstream(token) >> expected);
+    TextToken text = {token.data(), token.size()};
+    bool ok = ParseTextWeight(text, &value);
+    Check(ok == expected_ok, "\"" + token + "\" accepted as by >>");
+    if(ok && expected_ok) {
+        uint64_t bits, expected_bits;
+        memcpy(&bits, &value, sizeof(bits));
+        memcpy(&expected_bits, &expected, sizeof(expected_bits));
+        std::ostringstream what;
+        what.precision(17);
+        what << "\"" << token << "\" parsed as " << value << " for " << expected;
+        Check(bits == expected_bits, what.str());
+    }
+}
+
+void CheckWeights(std::mt19937 &random) {
+    const char *tokens[] = {"0", "-0", "+0", "0.0", "-0.0", "1", "-1", ".5", "5.", ".", "-", "+", "e5", "1e",
+        "1e+", "1e-", "1e5", "1E5", "1e-5", "inf", "-inf", "nan", "Infinity", "1e308", "1e309", "-1e309",
+        "1e-320", "1e-400", "4.9406564584124654e-324", "2.2250738585072014e-308", "9007199254740993",
+        "0.1", "0.30000000000000004", "123456789012345678901234567890", "00000000000000000000001.5",
+        "0.000000000000000000000000000001", "1e-22", "1e22", "1e23", "3.14159abc", "0x10"};
+    for(size_t i = 0; i < sizeof(tokens) / sizeof(tokens[0]); i++) CheckWeight(tokens[i]);
+    for(int i = 0; i < 200000; i++) CheckWeight(RandomNumber(random));
+    for(int i = 0; i < 200000; i++) CheckWeight(RandomCharacters(random));
+}
+
+void CheckSplit(std::mt19937 &random) {
+    const char pieces[][4] = {" ", "\t", "\r", "\v", "\f", "  ", "a", "bc", "12", "<e>", "\xe9", "-"};
+    std::uniform_int_distribution<int> length(0, 20), piece(0, sizeof(pieces) / sizeof(pieces[0]) - 1);
+    for(int i = 0; i < 20000; i++) {
+        std::string line;
+        for(int n = length(random); n > 0; n--) line += pieces[piece(random)];
+        std::vector<std::string> expected;
+        std::istringstream tokenizer(line);
+        std::string token;
+        while(tokenizer >> token) expected.push_back(token);
+        TextToken tokens[6];
+        size_t num_tokens = SplitTextLine(line.data(), line.data() + line.size(), tokens, 6);
+        bool same = num_tokens == expected.size();
+        for(size_t j = 0; same && j < std::min<size_t>(num_tokens, 6); j++)
+            same = std::string(tokens[j].data, tokens[j].size) == expected[j];
+        Check(same, "split of \"" + line + "\"");
+    }
+}
+
+void CheckNames(std::mt19937 &random) {
+    // enough names for the table to grow several times
+    std::uniform_int_distribution<int> names(0, 30000), length(0, 20);
+    std::vector<std::string> inputs(100000);
+    for(size_t i = 0; i < inputs.size(); i++) {
+        std::ostringstream name;
+        name << std::string(length(random) / 4, 'n') << names(random);
+        inputs[i] = name.str();
+    }
+    TextNameTable table;
+    std::map<std::string, int64> expected;
+    for(size_t i = 0; i < inputs.size(); i++) {
+        TextToken name = {inputs[i].data(), inputs[i].size()};
+        bool added;
+        int64 id = table.FindOrAdd(name, &added);
+        std::map<std::string, int64>::iterator found = expected.find(inputs[i]);
+        bool is_new = found == expected.end();
+        if(is_new) found = expected.insert(std::make_pair(inputs[i], (int64) expected.size())).first;
+        Check(added == is_new && id == found->second, "id of " + inputs[i]);
+    }
+    Check(table.Size() == expected.size(), "number of names");
+    for(std::map<std::string, int64>::const_iterator it = expected.begin(); it != expected.end(); ++it)
+        Check(std::string(table.Name(it->second).data, table.Name(it->second).size) == it->first, "name of the id of " + it->first);
+}
+
+int main(int argc, char** argv) {
+    std::mt19937 random(42);
+    CheckWeights(random);
+    CheckSplit(random);
+    CheckNames(random);
+    if(failures) {
+        std::cerr << argv[0] << ": " << failures << " failures\n";
+        return 1;
+    }
+    std::cerr << argv[0] << ": ok\n";
+    return 0;
+}
@@ -0,0 +1,233 @@
+// text-compiler.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Compilation of text fsts as done by fstcompile-nolex: states and symbols
+// are numbered in order of first occurrence, on one thread or in chunks
+// compiled on several threads and merged in input order.
+
+#ifndef FST_UTILS_TEXT_COMPILER_H__
+#define FST_UTILS_TEXT_COMPILER_H__
+
+#include <string.h>
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fst/fstlib.h>
+
+#include "parallel.h"
+#include "text-reader.h"
+
+namespace fst {
+
+    /* input and output symbols, numbered in order of first occurrence after epsilon */
+    struct SymbolNames {
+        TextNameTable isyms;
+        TextNameTable osyms;
+
+        SymbolNames() {
+            TextToken epsilon = {"<eps>", 5};
+            isyms.FindOrAdd(epsilon);
+            osyms.FindOrAdd(epsilon);
+        }
+    };
+
+    /* fst being compiled, states numbered in order of first occurrence; the
+     * symbols may be shared with other fsts */
+    struct FstBuilder {
+        TextNameTable states;
+        SymbolNames *symbols;
+        StdVectorFst automaton;
+
+        explicit FstBuilder(SymbolNames *names) : symbols(names) {}
+
+        int State(const TextToken &name) {
+            bool added;
+            int state = states.FindOrAdd(name, &added);
+            if(added) automaton.AddState();
+            return state;
+        }
+        void AddFinal(const TextToken &state, double weight) {
+            automaton.SetFinal(State(state), weight);
+        }
+        /* output is NULL for acceptors */
+        void AddArc(const TextToken &from, const TextToken &to, const TextToken &input, const TextToken *output, double weight) {
+            int from_state = State(from);
+            int to_state = State(to);
+            int in_symbol = symbols->isyms.FindOrAdd(input);
+            int out_symbol = output != NULL ? symbols->osyms.FindOrAdd(*output) : in_symbol;
+            automaton.AddArc(from_state, StdArc(in_symbol, out_symbol, weight, to_state));
+        }
+    };
+
+    /* part of the input compiled on its own: names are numbered within the
+     * chunk and arcs are kept in input order until they are merged */
+    struct ChunkBuilder {
+        TextNameTable states;
+        TextNameTable isyms;
+        TextNameTable osyms;
+        std::vector<std::pair<int, StdArc> > arcs;    /* source state and arc, nextstate is kNoStateId for final weights */
+
+        void AddFinal(const TextToken &state, double weight) {
+            arcs.push_back(std::make_pair(states.FindOrAdd(state), StdArc(0, 0, weight, kNoStateId)));
+        }
+        /* acceptors have an output label of -1 */
+        void AddArc(const TextToken &from, const TextToken &to, const TextToken &input, const TextToken *output, double weight) {
+            int from_state = states.FindOrAdd(from);
+            int to_state = states.FindOrAdd(to);
+            int in_symbol = isyms.FindOrAdd(input);
+            int out_symbol = output != NULL ? osyms.FindOrAdd(*output) : -1;
+            arcs.push_back(std::make_pair(from_state, StdArc(in_symbol, out_symbol, weight, to_state)));
+        }
+    };
+
+    /* ids of the names of a chunk in a global table; the new names are added
+     * in chunk order, as if the chunk had been read after the previous ones */
+    inline std::vector<int> MergeNames(const TextNameTable &local, TextNameTable *global) {
+        std::vector<int> ids(local.Size());
+        for(size_t i = 0; i < local.Size(); i++) ids[i] = global->FindOrAdd(local.Name(i));
+        return ids;
+    }
+
+    inline void MergeChunk(const ChunkBuilder &chunk, FstBuilder *builder) {
+        std::vector<int> states = MergeNames(chunk.states, &builder->states);
+        std::vector<int> isyms = MergeNames(chunk.isyms, &builder->symbols->isyms);
+        std::vector<int> osyms = MergeNames(chunk.osyms, &builder->symbols->osyms);
+        while(builder->automaton.NumStates() < (int) builder->states.Size()) builder->automaton.AddState();
+        for(size_t i = 0; i < chunk.arcs.size(); i++) {
+            int from_state = states[chunk.arcs[i].first];
+            const StdArc &arc = chunk.arcs[i].second;
+            if(arc.nextstate == kNoStateId) {
+                builder->automaton.SetFinal(from_state, arc.weight);
+            } else {
+                int in_symbol = isyms[arc.ilabel];
+                int out_symbol = arc.olabel != -1 ? osyms[arc.olabel] : in_symbol;
+                builder->automaton.AddArc(from_state, StdArc(in_symbol, out_symbol, arc.weight, states[arc.nextstate]));
+            }
+        }
+    }
+
+    /* compiles the lines of [begin, end), a last line without end of line is
+     * ignored; returns the number of lines, or the line of the first error */
+    template <class Builder>
+    inline int CompileLines(const char *begin, const char *end, bool is_transducer, Builder *builder, std::string *error) {
+        int line_num = 0;
+        const char *current = begin;
+        while(current < end) {
+            const char *line_end = static_cast<const char*>(memchr(current, '\n', end - current));
+            if(line_end == NULL) break;
+            line_num++;
+            TextToken tokens[6];
+            size_t num_tokens = SplitTextLine(current, line_end, tokens, 6);
+            current = line_end + 1;
+            double weight = 0;
+            if(num_tokens == 0) {
+                *error = "empty line in automaton";
+                return line_num;
+            } else if(num_tokens <= 2) {
+                if(num_tokens == 2 && !ParseTextWeight(tokens[1], &weight)) {
+                    *error = "weight not a valid number";
+                    return line_num;
+                }
+                builder->AddFinal(tokens[0], weight);
+            } else if(is_transducer) {
+                if(num_tokens < 4) {
+                    *error = "missing output symbol in transducer";
+                    return line_num;
+                }
+                if(num_tokens == 5 && !ParseTextWeight(tokens[4], &weight)) {
+                    *error = "weight not a valid number";
+                    return line_num;
+                }
+                if(num_tokens > 5) {
+                    *error = "too many fields in transudcer";
+                    return line_num;
+                }
+                builder->AddArc(tokens[0], tokens[1], tokens[2], &tokens[3], weight);
+            } else {
+                if(num_tokens == 4 && !ParseTextWeight(tokens[3], &weight)) {
+                    *error = "weight not a valid number";
+                    return line_num;
+                }
+                if(num_tokens > 4) {
+                    *error = "too many fields in acceptor";
+                    return line_num;
+                }
+                builder->AddArc(tokens[0], tokens[1], tokens[2], NULL, weight);
+            }
+        }
+        return line_num;
+    }
+
+    /* compiles line-aligned chunks of the input on several threads, a few
+     * chunks at a time, and merges them in input order so that the result
+     * does not depend on the number of threads; returns the line of the first
+     * error, or 0 */
+    inline int CompileChunks(const char *begin, const char *end, bool is_transducer, int threads, FstBuilder *builder, std::string *error) {
+        size_t chunk_size = std::min<size_t>(4 << 20, std::max<size_t>(64 << 10, (end - begin) / threads + 1));
+        int line_offset = 0;
+        while(begin < end) {
+            std::vector<std::pair<const char*, const char*> > bounds;
+            for(int i = 0; i < threads && begin < end; i++) {
+                const char *chunk_end = end;
+                if((size_t) (end - begin) > chunk_size) {
+                    const char *newline = static_cast<const char*>(memchr(begin + chunk_size, '\n', end - begin - chunk_size));
+                    if(newline != NULL) chunk_end = newline + 1;
+                }
+                bounds.push_back(std::make_pair(begin, chunk_end));
+                begin = chunk_end;
+            }
+            std::vector<ChunkBuilder> chunks(bounds.size());
+            std::vector<int> lines(bounds.size());
+            std::vector<std::string> errors(bounds.size());
+            ParallelFor(bounds.size(), threads, [&](size_t i) {
+                lines[i] = CompileLines(bounds[i].first, bounds[i].second, is_transducer, &chunks[i], &errors[i]);
+            });
+            for(size_t i = 0; i < chunks.size(); i++) {
+                if(errors[i] != "") {
+                    *error = errors[i];
+                    return line_offset + lines[i];
+                }
+                MergeChunk(chunks[i], builder);
+                line_offset += lines[i];
+            }
+        }
+        return 0;
+    }
+
+    /* symbol table with the names in id order */
+    inline void FillSymbols(const TextNameTable &names, SymbolTable *symbols) {
+        for(size_t id = 0; id < names.Size(); id++) {
+            const TextToken &name = names.Name(id);
+            symbols->AddSymbol(std::string(name.data, name.size));
+        }
+    }
+
+    inline void SetSymbols(const SymbolNames &names, bool is_transducer, StdVectorFst *automaton) {
+        SymbolTable isymbols("input");
+        SymbolTable osymbols("output");
+        FillSymbols(names.isyms, &isymbols);
+        FillSymbols(names.osyms, &osymbols);
+        automaton->SetInputSymbols(&isymbols);
+        if(is_transducer) automaton->SetOutputSymbols(&osymbols);
+        else automaton->SetOutputSymbols(&isymbols);
+    }
+
+}  // namespace fst
+
+#endif  // FST_UTILS_TEXT_COMPILER_H__
@@ -0,0 +1,248 @@
+// text-reader.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Fast reading of large text fsts: the input is mapped (or read at once
+// from a pipe), tokens point into it instead of being copied, numbers are
+// parsed without streams and names are looked up in an open-addressing
+// hash table.
+
+#ifndef FST_UTILS_TEXT_READER_H__
+#define FST_UTILS_TEXT_READER_H__
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cmath>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include <fst/compat.h>
+
+namespace fst {
+
+    // Whole content of a file descriptor: mapped if it is a regular file,
+    // read in memory otherwise (pipes).
+    class TextInput {
+        public:
+            explicit TextInput(int fd) : data_(NULL), size_(0), mapped_(false), error_(false) {
+                struct stat info;
+                if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0 && lseek(fd, 0, SEEK_CUR) == 0) {
+                    void *data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                    if (data != MAP_FAILED) {
+                        madvise(data, info.st_size, MADV_SEQUENTIAL);
+                        data_ = static_cast<const char *>(data);
+                        size_ = info.st_size;
+                        mapped_ = true;
+                        return;
+                    }
+                }
+                const size_t kBlockSize = 1 << 20;
+                ssize_t count;
+                do {
+                    size_t size = buffer_.size();
+                    buffer_.resize(size + kBlockSize);
+                    count = read(fd, &buffer_[size], kBlockSize);
+                    buffer_.resize(size + (count > 0 ? count : 0));
+                } while (count > 0);
+                error_ = count < 0;
+                data_ = buffer_.data();
+                size_ = buffer_.size();
+            }
+
+            ~TextInput() {
+                if (mapped_) munmap(const_cast<char *>(data_), size_);
+            }
+
+            const char *Data() const { return data_; }
+            size_t Size() const { return size_; }
+            bool Error() const { return error_; }
+
+        private:
+            const char *data_;
+            size_t size_;
+            bool mapped_;
+            bool error_;
+            std::string buffer_;
+
+            DISALLOW_COPY_AND_ASSIGN(TextInput);
+    };
+
+    // Characters of a token, in the input.
+    struct TextToken {
+        const char *data;
+        size_t size;
+    };
+
+    // Whitespace as for the >> operator of streams (C locale).
+    inline bool IsTextSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+    }
+
+    // Splits [begin, end) at whitespace into at most max_tokens tokens;
+    // returns the total number of tokens.
+    inline size_t SplitTextLine(const char *begin, const char *end, TextToken *tokens, size_t max_tokens) {
+        size_t num_tokens = 0;
+        const char *p = begin;
+        while (true) {
+            while (p < end && IsTextSpace(*p)) ++p;
+            if (p == end) break;
+            const char *start = p;
+            while (p < end && !IsTextSpace(*p)) ++p;
+            if (num_tokens < max_tokens) {
+                tokens[num_tokens].data = start;
+                tokens[num_tokens].size = p - start;
+            }
+            ++num_tokens;
+        }
+        return num_tokens;
+    }
+
+    // Number at the start of a token, accepting what the >> operator of
+    // streams accepts: the longest prefix of the form [+-]digits[.digits]
+    // [(e|E)[+-]digits] must be a valid number, which must not overflow.
+    // Mantissas of up to 2^53 scaled by at most 10^22 are computed exactly
+    // (Clinger's fast path); other numbers go through strtod().
+    inline bool ParseTextWeight(const TextToken &token, double *value) {
+        static const double kPowersOfTen[] = {
+            1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+            1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+        const char *p = token.data, *end = token.data + token.size;
+        bool negative = false;
+        if (p < end && (*p == '+' || *p == '-')) negative = *p++ == '-';
+        uint64_t mantissa = 0;
+        int digits = 0, exponent = 0;
+        bool found_mantissa = false, fast = true;
+        for (; p < end && *p >= '0' && *p <= '9'; ++p) {
+            found_mantissa = true;
+            if (mantissa == 0 && *p == '0') continue;
+            if (digits++ < 19) mantissa = mantissa * 10 + (*p - '0');
+            else fast = false;
+        }
+        if (p < end && *p == '.') {
+            for (++p; p < end && *p >= '0' && *p <= '9'; ++p) {
+                found_mantissa = true;
+                if (mantissa == 0 && *p == '0') {
+                    --exponent;
+                    continue;
+                }
+                if (digits++ < 19) {
+                    mantissa = mantissa * 10 + (*p - '0');
+                    --exponent;
+                } else {
+                    fast = false;
+                }
+            }
+        }
+        if (!found_mantissa) return false;
+        if (p < end && (*p == 'e' || *p == 'E')) {
+            ++p;
+            bool negative_exponent = false;
+            if (p < end && (*p == '+' || *p == '-')) negative_exponent = *p++ == '-';
+            if (p == end || *p < '0' || *p > '9') return false;
+            int explicit_exponent = 0;
+            for (; p < end && *p >= '0' && *p <= '9'; ++p)
+                if (explicit_exponent < 100000) explicit_exponent = explicit_exponent * 10 + (*p - '0');
+            exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+        }
+        if (fast && mantissa == 0) {
+            *value = negative ? -0.0 : 0.0;
+            return true;
+        }
+        if (fast && mantissa <= (uint64_t(1) << 53) && exponent >= -22 && exponent <= 22) {
+            double result = static_cast<double>(mantissa);
+            if (exponent < 0) result /= kPowersOfTen[-exponent];
+            else result *= kPowersOfTen[exponent];
+            *value = negative ? -result : result;
+            return true;
+        }
+        std::string number(token.data, p - token.data);
+        double result = strtod(number.c_str(), NULL);
+        if (std::isinf(result)) return false;
+        *value = result;
+        return true;
+    }
+
+    // Names (tokens of the input) numbered in order of first occurrence.
+    class TextNameTable {
+        public:
+            TextNameTable() : slots_(1024, -1) {}
+
+            // Id of the name, added with the next id if it is new.
+            int64 FindOrAdd(const TextToken &name, bool *added = NULL) {
+                uint64_t hash = Hash(name.data, name.size);
+                size_t mask = slots_.size() - 1;
+                for (size_t slot = hash & mask; ; slot = (slot + 1) & mask) {
+                    int64 id = slots_[slot];
+                    if (id == -1) {
+                        id = names_.size();
+                        names_.push_back(name);
+                        hashes_.push_back(hash);
+                        slots_[slot] = id;
+                        if (2 * names_.size() > slots_.size()) Grow();
+                        if (added) *added = true;
+                        return id;
+                    }
+                    if (hashes_[id] == hash && names_[id].size == name.size && memcmp(names_[id].data, name.data, name.size) == 0) {
+                        if (added) *added = false;
+                        return id;
+                    }
+                }
+            }
+
+            size_t Size() const { return names_.size(); }
+            const TextToken &Name(int64 id) const { return names_[id]; }
+
+        private:
+            static uint64_t Hash(const char *data, size_t size) {
+                uint64_t hash = size * 0x9e3779b97f4a7c15ULL;
+                for (; size >= 8; data += 8, size -= 8) {
+                    uint64_t word;
+                    memcpy(&word, data, 8);
+                    hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+                    hash ^= hash >> 32;
+                }
+                uint64_t word = 0;
+                memcpy(&word, data, size);
+                hash = (hash ^ word) * 0xc4ceb9fe1a85ec53ULL;
+                return hash ^ (hash >> 29);
+            }
+
+            void Grow() {
+                slots_.assign(2 * slots_.size(), -1);
+                size_t mask = slots_.size() - 1;
+                for (size_t id = 0; id < names_.size(); ++id) {
+                    size_t slot = hashes_[id] & mask;
+                    while (slots_[slot] != -1) slot = (slot + 1) & mask;
+                    slots_[slot] = id;
+                }
+            }
+
+            std::vector<TextToken> names_;
+            std::vector<uint64_t> hashes_;
+            std::vector<int64> slots_;     // ids, -1 for empty slots
+
+            DISALLOW_COPY_AND_ASSIGN(TextNameTable);
+    };
+
+}  // namespace fst
+
+#endif  // FST_UTILS_TEXT_READER_H__
@@ -0,0 +1,168 @@
+// text-writer.h
+
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+//
+// Copyright 2012 Aix-Marseille Univ.
+// Author: benoit.favre@lif.univ-mrs.fr (Benoit Favre)
+//
+// \file
+// Buffered text output for the tools which print many labels and weights:
+// symbols are copied once in a table indexed by label, text is appended to
+// a large buffer, and the buffer goes to the stream in a single write when
+// it is full.
+
+#ifndef FST_UTILS_TEXT_WRITER_H__
+#define FST_UTILS_TEXT_WRITER_H__
+
+#include <stdio.h>
+#include <limits>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <fst/symbol-table.h>
+
+namespace fst {
+
+    // Symbols of a table, stored contiguously and indexed by label.
+    class SymbolStrings {
+        public:
+            // Without a table (symbols == NULL), labels are written as numbers.
+            explicit SymbolStrings(const SymbolTable *symbols) {
+                if (symbols == NULL) return;
+                size_t num_symbols = symbols->NumSymbols();
+                for (SymbolTableIterator iter(*symbols); !iter.Done(); iter.Next()) {
+                    int64 label = iter.Value();
+                    std::string symbol = iter.Symbol();
+                    Entry entry = {text_.size(), symbol.size()};
+                    text_.append(symbol);
+                    // dense labels go in the vector, unusually large ones in the map
+                    if (label >= 0 && (size_t) label < 4 * num_symbols + 1024) {
+                        if ((size_t) label >= dense_.size()) {
+                            Entry missing = {kMissing, 0};
+                            dense_.resize(label + 1, missing);
+                        }
+                        dense_[label] = entry;
+                    } else {
+                        sparse_[label] = entry;
+                    }
+                }
+            }
+
+            // Symbol of a label; false if the label has none.
+            bool Find(int64 label, const char **data, size_t *size) const {
+                const Entry *entry = NULL;
+                if (label >= 0 && (size_t) label < dense_.size()) {
+                    entry = &dense_[label];
+                } else {
+                    std::unordered_map<int64, Entry>::const_iterator found = sparse_.find(label);
+                    if (found != sparse_.end()) entry = &found->second;
+                }
+                if (entry == NULL || entry->offset == kMissing) return false;
+                *data = text_.data() + entry->offset;
+                *size = entry->size;
+                return true;
+            }
+
+        private:
+            static const size_t kMissing = static_cast<size_t>(-1);   // offset of absent labels
+
+            struct Entry {
+                size_t offset;
+                size_t size;
+            };
+
+            std::string text_;
+            std::vector<Entry> dense_;
+            std::unordered_map<int64, Entry> sparse_;
+
+            DISALLOW_COPY_AND_ASSIGN(SymbolStrings);
+    };
+
+
+    class TextWriter {
+        public:
+            explicit TextWriter(std::ostream &strm, size_t flush_size = 1 << 20)
+                : strm_(strm), flush_size_(flush_size) {
+                buffer_.reserve(flush_size_ + 4096);
+            }
+
+            ~TextWriter() { Flush(); }
+
+            void Flush() {
+                if (!buffer_.empty()) strm_.write(buffer_.data(), buffer_.size());
+                strm_.flush();
+                buffer_.clear();
+            }
+
+            TextWriter &Append(const char *data, size_t size) {
+                buffer_.append(data, size);
+                if (buffer_.size() >= flush_size_) Flush();
+                return *this;
+            }
+
+            TextWriter &Append(const std::string &text) { return Append(text.data(), text.size()); }
+
+            TextWriter &Append(char c) {
+                buffer_.push_back(c);
+                if (buffer_.size() >= flush_size_) Flush();
+                return *this;
+            }
+
+            TextWriter &AppendInt(int64 value) {
+                char digits[24];
+                char *end = digits + sizeof(digits), *p = end;
+                uint64 magnitude = value < 0 ? 0 - static_cast<uint64>(value) : value;
+                do {
+                    *--p = '0' + magnitude % 10;
+                    magnitude /= 10;
+                } while (magnitude);
+                if (value < 0) *--p = '-';
+                return Append(p, end - p);
+            }
+
+            // As an ostream with default precision (6 significant digits).
+            TextWriter &AppendDouble(double value) {
+                char text[32];
+                int size = snprintf(text, sizeof(text), "%g", value);
+                return Append(text, size);
+            }
+
+            // As the << operator of TropicalWeight.
+            TextWriter &AppendWeight(float value) {
+                if (value == std::numeric_limits<float>::infinity()) return Append("Infinity", 8);
+                if (value == -std::numeric_limits<float>::infinity()) return Append("-Infinity", 9);
+                if (value != value) return Append("BadNumber", 9);
+                return AppendDouble(value);
+            }
+
+            // Symbol of the label, or its number if it has none.
+            TextWriter &AppendSymbol(const SymbolStrings &symbols, int64 label) {
+                const char *data;
+                size_t size;
+                if (symbols.Find(label, &data, &size)) return Append(data, size);
+                return AppendInt(label);
+            }
+
+        private:
+            std::ostream &strm_;
+            size_t flush_size_;
+            std::string buffer_;
+
+            DISALLOW_COPY_AND_ASSIGN(TextWriter);
+    };
+
+}  // namespace fst
+
+#endif  // FST_UTILS_TEXT_WRITER_H__